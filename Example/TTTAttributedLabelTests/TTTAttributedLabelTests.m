@@ -38,6 +38,19 @@ static inline void TTTSizeAttributedLabel(TTTAttributedLabel *label) {
     [label setFrame:CGRectMake(0, 0, size.width, size.height)];
 };
 
+static inline NSData * TTTRenderedLabelData(TTTAttributedLabel *label) {
+    UIGraphicsBeginImageContextWithOptions(label.bounds.size, NO, 1);
+    [label.layer renderInContext:UIGraphicsGetCurrentContext()];
+    UIImage *image = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+
+    return UIImagePNGRepresentation(image);
+};
+
+static inline CALayer * TTTContentLayerOfLabel(TTTAttributedLabel *label) {
+    return [label valueForKey:@"contentLayer"];
+};
+
 static inline void TTTSimulateTapOnLabelAtPoint(TTTAttributedLabel *label, CGPoint point) {
     UIWindow *window = [[UIApplication sharedApplication].windows lastObject];
     [window addSubview:label];
@@ -51,6 +64,48 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
 };
 
 
+// Records the text it is asked to search
+@interface TTTRecordingDataDetector : NSObject <TTTAttributedLabelDataDetector>
+@property (readonly, atomic, copy) NSArray *searchedStrings;
+@end
+
+@implementation TTTRecordingDataDetector {
+    TTTAttributedLabelScanner *_scanner;
+    NSMutableArray *_searchedStrings;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _scanner = [TTTAttributedLabelScanner scannerWithTypes:NSTextCheckingTypeLink];
+        _searchedStrings = [NSMutableArray array];
+    }
+
+    return self;
+}
+
+- (NSTextCheckingTypes)checkingTypes {
+    return _scanner.checkingTypes;
+}
+
+- (NSArray *)matchesInString:(NSString *)string
+                     options:(NSMatchingOptions)options
+                       range:(NSRange)range
+{
+    @synchronized(self) {
+        [_searchedStrings addObject:[string substringWithRange:range]];
+    }
+
+    return [_scanner matchesInString:string options:options range:range];
+}
+
+- (NSArray *)searchedStrings {
+    @synchronized(self) {
+        return [_searchedStrings copy];
+    }
+}
+
+@end
+
 @interface TTTAttributedLabelTests : FBSnapshotTestCase
 
 @end
@@ -103,6 +158,59 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     expect(label.highlighted).to.beTruthy();
 }
 
+- (void)testActiveLinkDrawnWithoutChangingText {
+    label.text = TTTAttributedTestString();
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+    NSAttributedString *inactiveText = label.attributedText;
+
+    [label setValue:link forKey:@"activeLink"];
+    expect(label.attributedText).to.equal(inactiveText);
+
+    UIGraphicsBeginImageContext(label.bounds.size);
+    [label.layer renderInContext:UIGraphicsGetCurrentContext()];
+    UIGraphicsEndImageContext();
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, 5)], @"Label should hit-test the active link with its existing layout");
+
+    [label setValue:nil forKey:@"activeLink"];
+    expect(label.attributedText).to.equal(inactiveText);
+}
+
+- (void)testActiveLinkDrawnOverJustifiedLine {
+    NSMutableParagraphStyle *paragraphStyle = [[NSMutableParagraphStyle alloc] init];
+    paragraphStyle.alignment = NSTextAlignmentJustified;
+    NSMutableAttributedString *text = [[NSMutableAttributedString alloc] initWithString:kTestLabelText
+                                                                             attributes:@{ NSParagraphStyleAttributeName : paragraphStyle }];
+
+    label.activeLinkAttributes = @{ NSForegroundColorAttributeName : [UIColor redColor] };
+    label.text = text;
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange(0, 8)];
+    [label setFrame:CGRectMake(0, 0, 120, 60)];
+    TTTRenderedLabelData(label);
+    [label setValue:link forKey:@"activeLink"];
+
+    // The line with the active link stays stretched to the width of the label
+    TTTAttributedLabel *expectedLabel = [[TTTAttributedLabel alloc] initWithFrame:label.frame];
+    NSMutableAttributedString *expectedText = [label.attributedText mutableCopy];
+    [expectedText addAttributes:label.activeLinkAttributes range:link.result.range];
+    expectedLabel.text = expectedText;
+
+    expect(TTTRenderedLabelData(label)).to.equal(TTTRenderedLabelData(expectedLabel));
+}
+
+- (void)testActiveLinkAffectingLayoutChangesText {
+    label.activeLinkAttributes = @{ NSFontAttributeName : [UIFont boldSystemFontOfSize:24.f] };
+    label.text = TTTAttributedTestString();
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    NSAttributedString *inactiveText = label.attributedText;
+
+    [label setValue:link forKey:@"activeLink"];
+    expect(label.attributedText).notTo.equal(inactiveText);
+
+    [label setValue:nil forKey:@"activeLink"];
+    expect(label.attributedText).to.equal(inactiveText);
+}
+
 - (void)testAttributedTextAccess {
     label.text = TTTAttributedTestString();
     XCTAssertTrue([label.attributedText isEqualToAttributedString:TTTAttributedTestString()], @"Attributed strings should match");
@@ -202,6 +310,82 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     XCTAssertGreaterThan(size.height, font.pointSize, @"Text should size to more than one line");
 }
 
+- (void)testMultilineLabelSizingWithFirstLineIndent {
+    label.firstLineIndent = 60.f;
+    label.text = kTestLabelText;
+    NSAttributedString *testString = label.attributedText;
+    CGSize constraints = CGSizeMake(150, CGFLOAT_MAX);
+
+    CGSize size = [TTTAttributedLabel sizeThatFitsAttributedString:testString
+                                                   withConstraints:constraints
+                                            limitedToNumberOfLines:2];
+
+    // The size of the first two lines as the framesetter lays them out, with the indent
+    CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)testString);
+    CGPathRef path = CGPathCreateWithRect(CGRectMake(0, 0, constraints.width, 100000), NULL);
+    CTFrameRef frame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, 0), path, NULL);
+    NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
+    expect([lines count]).to.beGreaterThan(2);
+
+    CFRange secondLineRange = CTLineGetStringRange((__bridge CTLineRef)lines[1]);
+    CGSize expectedSize = CTFramesetterSuggestFrameSizeWithConstraints(framesetter, CFRangeMake(0, secondLineRange.location + secondLineRange.length), NULL, constraints, NULL);
+    CFRelease(frame);
+    CGPathRelease(path);
+    CFRelease(framesetter);
+
+    expect(size.height).to.equal(ceil(expectedSize.height));
+}
+
+- (void)testSizeCacheReusesCalculatedSizes {
+    NSMutableAttributedString *testString = [TTTAttributedTestString() mutableCopy];
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    [[TTTAttributedLabel sharedSizeCache] resetStatistics];
+    
+    CGSize size = [TTTAttributedLabel sizeThatFitsAttributedString:testString
+                                                   withConstraints:kTestLabelSize
+                                            limitedToNumberOfLines:0];
+    CGSize cachedSize = [TTTAttributedLabel sizeThatFitsAttributedString:[testString copy]
+                                                         withConstraints:kTestLabelSize
+                                                  limitedToNumberOfLines:0];
+    
+    XCTAssertTrue(CGSizeEqualToSize(size, cachedSize), @"Cached size should match calculated size");
+    expect([TTTAttributedLabel sharedSizeCache].missCount).to.equal(1);
+    expect([TTTAttributedLabel sharedSizeCache].hitCount).to.equal(1);
+    
+    // Mutating the measured string must not affect the cached entry
+    [testString appendAttributedString:TTTAttributedTestString()];
+    CGSize mutatedSize = [TTTAttributedLabel sizeThatFitsAttributedString:testString
+                                                          withConstraints:kTestLabelSize
+                                                   limitedToNumberOfLines:0];
+    
+    XCTAssertGreaterThan(mutatedSize.height, size.height, @"Longer text should not hit the cached size");
+    expect([TTTAttributedLabel sharedSizeCache].missCount).to.equal(2);
+}
+
+- (void)testCacheEvictsLeastRecentlyUsedEntries {
+    TTTAttributedLabelCache *cache = [[TTTAttributedLabelCache alloc] init];
+    cache.countLimit = 2;
+    
+    [cache setObject:@1 forKey:@"a"];
+    [cache setObject:@2 forKey:@"b"];
+    expect([cache objectForKey:@"a"]).to.equal(@1);
+    [cache setObject:@3 forKey:@"c"];
+    
+    expect(cache.count).to.equal(2);
+    expect([cache objectForKey:@"b"]).to.beNil();
+    expect([cache objectForKey:@"a"]).to.equal(@1);
+    expect([cache objectForKey:@"c"]).to.equal(@3);
+    
+    cache.totalCostLimit = 10;
+    [cache setObject:@4 forKey:@"d" cost:8];
+    [cache setObject:@5 forKey:@"e" cost:4];
+    
+    expect([cache objectForKey:@"d"]).to.beNil();
+    expect(cache.totalCost).to.equal(4);
+    expect(cache.hitCount).to.equal(3);
+    expect(cache.missCount).to.equal(2);
+}
+
 - (void)testContainsLinkAtPoint {
     label.text = TTTAttributedTestString();
     [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
@@ -210,6 +394,50 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     XCTAssertFalse([label containslinkAtPoint:CGPointMake(50, 5)], @"Label should not contain a link elsewhere in the string");
 }
 
+- (void)testContainsLinkAtPointAfterLayoutChange {
+    label.text = TTTAttributedTestString();
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+    label.frame = CGRectMake(0, 0, CGRectGetWidth(label.frame), CGRectGetHeight(label.frame) * 3);
+    label.verticalAlignment = TTTAttributedLabelVerticalAlignmentTop;
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, 5)], @"Top aligned text should have a link at the top of the label");
+
+    label.verticalAlignment = TTTAttributedLabelVerticalAlignmentBottom;
+    XCTAssertFalse([label containslinkAtPoint:CGPointMake(5, 5)], @"Bottom aligned text should not have a link at the top of the label");
+}
+
+- (void)testContainsLinkInExtendedTouchArea {
+    label.extendsLinkTouchArea = YES;
+    label.text = TTTAttributedTestString();
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(27, 5)], @"Label should contain a link next to the link text");
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, -5)], @"Label should contain a link just above the link text");
+    XCTAssertFalse([label containslinkAtPoint:CGPointMake(80, 5)], @"Label should not contain a link far from the link text");
+}
+
+- (void)testTextLayout {
+    TTTAttributedLabelLayout *layout = [[TTTAttributedLabelLayout alloc] initWithAttributedString:TTTAttributedTestString()
+                                                                                            width:kTestLabelSize.width
+                                                                                    numberOfLines:0
+                                                                                       textInsets:UIEdgeInsetsZero];
+    CGSize size = [TTTAttributedLabel sizeThatFitsAttributedString:TTTAttributedTestString()
+                                                   withConstraints:kTestLabelSize
+                                            limitedToNumberOfLines:0];
+    expect(layout.size).to.equal(size);
+
+    label.textLayout = layout;
+    label.frame = CGRectMake(0, 0, layout.width, layout.size.height);
+    expect(label.textLayout).to.equal(layout);
+    expect(label.attributedText).to.equal(TTTAttributedTestString());
+
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, 5)], @"Label should contain a link at the start of the text");
+
+    label.text = kTestLabelText;
+    expect(label.textLayout).to.beNil();
+}
+
 - (void)testLinkDetection {
     label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
     label.text = [testURL absoluteString];
@@ -222,12 +450,94 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
 - (void)testAttributedStringLinkDetection {
     label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
     label.text = [[NSAttributedString alloc] initWithString:[testURL absoluteString]];
-    
+
     // Data detection is performed asynchronously in a background thread
     expect([label.links count]).will.equal(1);
     expect(((NSTextCheckingResult *)label.links[0]).URL).will.equal(testURL);
 }
 
+- (void)testCachedLinkDetection {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = [testURL absoluteString];
+    expect([label.links count]).will.equal(1);
+
+    // Recycled labels showing the same text reuse the detected links immediately
+    TTTAttributedLabel *otherLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 300, 100)];
+    otherLabel.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    otherLabel.text = [testURL absoluteString];
+    expect([otherLabel.links count]).to.equal(1);
+    expect(((NSTextCheckingResult *)otherLabel.links[0]).URL).to.equal(testURL);
+}
+
+- (void)testSupersededLinkDetection {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = [testURL absoluteString];
+    label.text = kTestLabelText;
+
+    expect([label.links count]).after(1).to.equal(0);
+}
+
+- (void)testScannerMatches {
+    TTTAttributedLabelScanner *scanner = [TTTAttributedLabelScanner scannerWithTypes:NSTextCheckingTypeLink | NSTextCheckingTypePhoneNumber];
+    NSDictionary *expectedMatches = @{
+        @"Visit http://helios.io, or www.example.com/path." : @[ @"http://helios.io", @"www.example.com/path" ],
+        @"Mail foo.bar@example.com today" : @[ @"foo.bar@example.com" ],
+        @"Call (555) 123-4567 or +1 555 123 4567" : @[ @"(555) 123-4567", @"+1 555 123 4567" ],
+        @"Pi is 3.14159265, e.g. Mr.Smith" : @[],
+    };
+
+    [expectedMatches enumerateKeysAndObjectsUsingBlock:^(NSString *string, NSArray *expectedStrings, __unused BOOL *stop) {
+        NSMutableArray *matchedStrings = [NSMutableArray array];
+        for (NSTextCheckingResult *result in [scanner matchesInString:string options:0 range:NSMakeRange(0, [string length])]) {
+            [matchedStrings addObject:[string substringWithRange:result.range]];
+        }
+
+        expect(matchedStrings).to.equal(expectedStrings);
+    }];
+}
+
+- (void)testScannerMentionsAndHashtags {
+    TTTAttributedLabelScanner *scanner = [[TTTAttributedLabelScanner alloc] initWithTypes:NSTextCheckingTypeLink | TTTTextCheckingTypeMention | TTTTextCheckingTypeHashtag mentionURLScheme:@"app-user" hashtagURLScheme:@"app-tag"];
+    NSDictionary *expectedURLs = @{
+        @"Thanks @mattt_t and @helios!" : @[ @"app-user:mattt_t", @"app-user:helios" ],
+        @"Mail foo@example.com, not @example" : @[ @"mailto:foo@example.com", @"app-user:example" ],
+        @"#iOS #日本 and #1 on http://helios.io/#top" : @[ @"app-tag:iOS", @"app-tag:%E6%97%A5%E6%9C%AC", @"http://helios.io/#top" ],
+        @"C# and it&#39;s" : @[],
+    };
+
+    [expectedURLs enumerateKeysAndObjectsUsingBlock:^(NSString *string, NSArray *expectedStrings, __unused BOOL *stop) {
+        NSMutableArray *matchedURLs = [NSMutableArray array];
+        for (NSTextCheckingResult *result in [scanner matchesInString:string options:0 range:NSMakeRange(0, [string length])]) {
+            [matchedURLs addObject:[result.URL absoluteString]];
+        }
+
+        expect(matchedURLs).to.equal(expectedStrings);
+    }];
+
+    // Mentions and hashtags are only found when their types are enabled
+    NSString *string = @"@mattt #iOS";
+    expect([[TTTAttributedLabelScanner scannerWithTypes:NSTextCheckingTypeLink] matchesInString:string options:0 range:NSMakeRange(0, [string length])]).to.haveCountOf(0);
+}
+
+- (void)testMentionDetection {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink | TTTTextCheckingTypeMention;
+    expect(label.dataDetector).to.beKindOf([TTTAttributedLabelScanner class]);
+
+    label.text = @"Ask @mattt about it";
+
+    expect([label.links count]).will.equal(1);
+    expect(((NSTextCheckingResult *)label.links[0]).URL).will.equal([NSURL URLWithString:@"mention:mattt"]);
+}
+
+- (void)testScannerLinkDetection {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.dataDetector = [TTTAttributedLabelScanner scannerWithTypes:NSTextCheckingTypeLink];
+    label.text = [NSString stringWithFormat:@"Go to %@ now", [testURL absoluteString]];
+
+    expect([label.links count]).will.equal(1);
+    expect(((NSTextCheckingResult *)label.links[0]).URL).will.equal(testURL);
+}
+
 - (void)testLinkArray {
     label.text = TTTAttributedTestString();
     [label addLinkToURL:testURL withRange:NSMakeRange(0, 1)];
@@ -293,6 +603,80 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     [self testInheritsAttributesFromLabel:label text:string];
 }
 
+- (void)testAttributedTruncationTokenLinkRegisteredOnce {
+    NSURL *tokenURL = [NSURL URLWithString:@"http://ytmnd.com"];
+    label.attributedTruncationToken = [[NSAttributedString alloc] initWithString:@"[more]"
+                                                                      attributes:@{ NSFontAttributeName : [UIFont boldSystemFontOfSize:12],
+                                                                                    NSLinkAttributeName : tokenURL }];
+    label.text = TTTAttributedTestString();
+    [label setFrame:CGRectMake(0, 0, 120, 60)];
+    NSAttributedString *attributedText = label.attributedText;
+
+    UIGraphicsBeginImageContext(label.bounds.size);
+    for (int i = 3; i--;) {
+        [label setNeedsDisplay];
+        [label.layer renderInContext:UIGraphicsGetCurrentContext()];
+    }
+    UIGraphicsEndImageContext();
+
+    expect(label.attributedText).to.equal(attributedText);
+    expect([label.links count]).to.equal(1);
+    expect(((NSTextCheckingResult *)label.links[0]).URL).to.equal(tokenURL);
+}
+
+- (void)testAttributedTruncationTokenLinkRegisteredOnMainThread {
+    label.attributedTruncationToken = [[NSAttributedString alloc] initWithString:@"[more]"
+                                                                      attributes:@{ NSFontAttributeName : [UIFont boldSystemFontOfSize:12],
+                                                                                    NSLinkAttributeName : testURL }];
+    label.text = TTTAttributedTestString();
+    [label setFrame:CGRectMake(0, 0, 120, 60)];
+
+    // Hit-testing lays the text out without changing the links
+    dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [label containslinkAtPoint:CGPointMake(5, 5)];
+    });
+    expect(label.links).to.haveCountOf(0);
+
+    TTTRenderedLabelData(label);
+    expect(label.links).to.haveCountOf(1);
+}
+
+- (void)testActiveTruncationTokenLinkDrawnOverTruncatedLine {
+    label.numberOfLines = 2;
+    label.activeLinkAttributes = @{ NSForegroundColorAttributeName : [UIColor blueColor] };
+    label.attributedTruncationToken = [[NSAttributedString alloc] initWithString:@"[more]"
+                                                                      attributes:@{ NSFontAttributeName : [UIFont boldSystemFontOfSize:12],
+                                                                                    NSLinkAttributeName : testURL }];
+    label.text = TTTAttributedTestString();
+    [label setFrame:CGRectMake(0, 0, 120, 40)];
+    TTTRenderedLabelData(label);
+
+    TTTAttributedLabelLink *tokenLink = [[label valueForKey:@"linkModels"] lastObject];
+    expect(tokenLink.result.URL).to.equal(testURL);
+    [label setValue:tokenLink forKey:@"activeLink"];
+
+    // Typesetting the text with the active attributes applied draws the same lines
+    TTTAttributedLabel *expectedLabel = [[TTTAttributedLabel alloc] initWithFrame:label.frame];
+    expectedLabel.numberOfLines = 2;
+    expectedLabel.attributedTruncationToken = label.attributedTruncationToken;
+    NSMutableAttributedString *expectedText = [TTTAttributedTestString() mutableCopy];
+    [expectedText addAttributes:label.activeLinkAttributes range:tokenLink.result.range];
+    expectedLabel.text = expectedText;
+
+    expect(TTTRenderedLabelData(label)).to.equal(TTTRenderedLabelData(expectedLabel));
+}
+
+- (void)testLineBreakModeChangesTruncatedLine {
+    label.numberOfLines = 1;
+    label.lineBreakMode = NSLineBreakByTruncatingTail;
+    label.text = TTTAttributedTestString();
+    [label setFrame:CGRectMake(0, 0, 120, 30)];
+    NSData *tailTruncatedData = TTTRenderedLabelData(label);
+
+    label.lineBreakMode = NSLineBreakByTruncatingHead;
+    expect(TTTRenderedLabelData(label)).notTo.equal(tailTruncatedData);
+}
+
 - (void)testTextRectWithoutAttributedText {
     CGRect rect = [label textRectForBounds:CGRectMake(0, 0, 10, 10) limitedToNumberOfLines:0];
     XCTAssertTrue(CGRectEqualToRect(rect, CGRectMake(0, 0, 0, 0)));
@@ -358,6 +742,30 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     }];
 }
 
+- (void)testPerformanceOfCreatingLabels {
+    [self measureBlock:^{
+        NSMutableArray *measureLabels = [NSMutableArray array];
+        for (int i = 500; i--;) {
+            TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+            measureLabel.text = kTestLabelText;
+            [measureLabels addObject:measureLabel];
+        }
+    }];
+}
+
+- (void)testPerformanceOfReusingLabels {
+    TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 300, 100)];
+    NSURL *linkURL = testURL;
+    [self measureBlock:^{
+        for (int i = 500; i--;) {
+            [measureLabel prepareForReuse];
+            measureLabel.text = kTestLabelText;
+            [measureLabel addLinkToURL:linkURL withRange:NSMakeRange(0, 8)];
+            [measureLabel containslinkAtPoint:CGPointMake(5, 5)];
+        }
+    }];
+}
+
 - (void)testSetTextAsyncWorkHang {
     // See the fix in commit 284a1b656204652b27625cbf1402116cdb36883b.
     // The previous dispatch_sync to main queue would seemingly deadlock an iPhone 5. (Possible exhaustion of OS handles/resources?)
@@ -378,6 +786,527 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     }];
 }
 
+- (void)measureLayoutOfLabelsWithTextRepeated:(NSUInteger)repeatCount {
+    NSMutableString *mutableText = [NSMutableString string];
+    for (NSUInteger i = 0; i < repeatCount; i++) {
+        [mutableText appendString:kTestLabelText];
+        [mutableText appendString:@" "];
+    }
+
+    NSAttributedString *attributedText = [[NSAttributedString alloc] initWithString:mutableText attributes:TTTAttributedTestAttributesDictionary()];
+    [self measureBlock:^{
+        for (int i = 20; i--;) {
+            [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+
+            TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+            measureLabel.numberOfLines = 3;
+            measureLabel.text = attributedText;
+            CGSize size = [measureLabel sizeThatFits:CGSizeMake(300, CGFLOAT_MAX)];
+            measureLabel.frame = CGRectMake(0, 0, 300, size.height);
+
+            UIGraphicsBeginImageContext(measureLabel.bounds.size);
+            [measureLabel.layer renderInContext:UIGraphicsGetCurrentContext()];
+            UIGraphicsEndImageContext();
+            [measureLabel containslinkAtPoint:CGPointMake(5, 5)];
+        }
+    }];
+}
+
+// Labels limited to a number of lines only typeset the lines they show, so these should take about the same time
+- (void)testPerformanceOfBoundedLayoutWithShortText {
+    [self measureLayoutOfLabelsWithTextRepeated:4];
+}
+
+- (void)testPerformanceOfBoundedLayoutWithLongText {
+    [self measureLayoutOfLabelsWithTextRepeated:400];
+}
+
+- (void)testPerformanceOfDrawingDecorations {
+    NSMutableAttributedString *mutableAttributedText = [[NSMutableAttributedString alloc] init];
+    NSArray *colors = @[[UIColor redColor], [UIColor greenColor], [UIColor blueColor]];
+    for (NSUInteger i = 0; i < 60; i++) {
+        NSDictionary *attributes = @{ NSFontAttributeName : [UIFont systemFontOfSize:14],
+                                      kTTTBackgroundFillColorAttributeName : (id)[colors[i % 3] CGColor],
+                                      kTTTBackgroundStrokeColorAttributeName : (id)[[UIColor blackColor] CGColor],
+                                      kTTTBackgroundCornerRadiusAttributeName : @4,
+                                      kTTTStrikeOutAttributeName : @(i % 2) };
+        [mutableAttributedText appendAttributedString:[[NSAttributedString alloc] initWithString:@"decorated " attributes:attributes]];
+    }
+
+    label.numberOfLines = 0;
+    label.text = mutableAttributedText;
+    label.frame = CGRectMake(0, 0, 300, [label sizeThatFits:CGSizeMake(300, CGFLOAT_MAX)].height);
+
+    UIGraphicsBeginImageContext(label.bounds.size);
+    [self measureBlock:^{
+        for (int i = 50; i--;) {
+            [label drawTextInRect:label.bounds];
+        }
+    }];
+    UIGraphicsEndImageContext();
+}
+
+- (void)testInstrumentationCountsLabelWork {
+    NSMutableArray *mutableTracedEvents = [NSMutableArray array];
+    [TTTAttributedLabel setTraceBlock:^(TTTAttributedLabelTraceEvent event, TTTAttributedLabelTracePhase phase, TTTAttributedLabel *tracedLabel) {
+        if (tracedLabel && phase == TTTAttributedLabelTracePhaseEnd) {
+            @synchronized(mutableTracedEvents) {
+                [mutableTracedEvents addObject:@(event)];
+            }
+        }
+    }];
+    [TTTAttributedLabel setInstrumentationEnabled:YES];
+
+    label.text = kTestLabelText;
+    [label sizeThatFits:kTestLabelSize];
+    TTTSizeAttributedLabel(label);
+    [label containslinkAtPoint:CGPointMake(5, 5)];
+
+    [TTTAttributedLabel setInstrumentationEnabled:NO];
+    [TTTAttributedLabel setTraceBlock:nil];
+
+    TTTAttributedLabelStatistics *statistics = [label statistics];
+    expect([statistics countForEvent:TTTAttributedLabelTraceEventSizeThatFits]).to.equal(1);
+    expect([statistics countForEvent:TTTAttributedLabelTraceEventFramesetterCreation]).to.equal(1);
+    expect([statistics countForEvent:TTTAttributedLabelTraceEventFrameCreation]).to.equal(1);
+    expect([statistics durationForEvent:TTTAttributedLabelTraceEventSizeThatFits]).to.beGreaterThan(0);
+    expect(mutableTracedEvents).to.contain(@(TTTAttributedLabelTraceEventFrameCreation));
+    expect([[TTTAttributedLabel globalStatistics] countForEvent:TTTAttributedLabelTraceEventSizeThatFits]).to.beGreaterThanOrEqualTo(1);
+
+    // Nothing is recorded while instrumentation is disabled
+    [label resetStatistics];
+    [label sizeThatFits:kTestLabelSize];
+    expect([[label statistics] countForEvent:TTTAttributedLabelTraceEventSizeThatFits]).to.equal(0);
+}
+
+- (void)testQueuedDataDetectionDiscardedForLabel {
+    [[TTTAttributedLabel sharedDataDetectionCache] removeAllObjects];
+    NSOperationQueue *dataDetectionQueue = [TTTAttributedLabel valueForKey:@"dataDetectionQueue"];
+    [dataDetectionQueue setSuspended:YES];
+    [TTTAttributedLabel setInstrumentationEnabled:YES];
+
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = [NSString stringWithFormat:@"Go to %@ now", [testURL absoluteString]];
+    [label prepareForReuse];
+
+    [TTTAttributedLabel setInstrumentationEnabled:NO];
+    [dataDetectionQueue setSuspended:NO];
+
+    expect([[label statistics] countForEvent:TTTAttributedLabelTraceEventDataDetectionQueued]).to.equal(1);
+    expect([[label statistics] countForEvent:TTTAttributedLabelTraceEventDataDetectionDiscarded]).to.equal(1);
+}
+
+- (void)testRenderedTextSharesLabelText {
+    label.text = kTestLabelText;
+
+    expect([label valueForKey:@"renderedAttributedText"]).to.beIdenticalTo(label.attributedText);
+    expect([label textMemoryFootprint]).to.equal([kTestLabelText length] * sizeof(unichar));
+
+    label.attributedTruncationToken = [[NSAttributedString alloc] initWithString:@"[more]"];
+    label.text = kTestLabelText;
+
+    expect([label valueForKey:@"renderedAttributedText"]).notTo.beIdenticalTo(label.attributedText);
+    expect([label textMemoryFootprint]).to.equal(([kTestLabelText length] * 2 + 6) * sizeof(unichar));
+}
+
+#pragma mark - Corpus benchmarks
+
+static inline NSArray * TTTEspressosCorpus() {
+    NSString *filePath = [[NSBundle mainBundle] pathForResource:@"espressos" ofType:@"txt"];
+    NSString *text = [NSString stringWithContentsOfFile:filePath usedEncoding:nil error:nil];
+    NSMutableArray *mutableCorpus = [NSMutableArray array];
+    for (NSString *line in [text componentsSeparatedByCharactersInSet:[NSCharacterSet newlineCharacterSet]]) {
+        if ([line length] > 0) {
+            [mutableCorpus addObject:line];
+        }
+    }
+
+    return mutableCorpus;
+}
+
+static inline NSArray * TTTChatCorpus() {
+    NSArray *words = @[@"hey", @"are", @"we", @"still", @"on", @"for", @"coffee", @"later", @"sure", @"see", @"you", @"at", @"noon"];
+    NSMutableArray *mutableCorpus = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 200; i++) {
+        NSMutableArray *mutableWords = [NSMutableArray array];
+        for (NSUInteger j = 0; j < 3 + i % 6; j++) {
+            [mutableWords addObject:words[(i * 7 + j * 3) % [words count]]];
+        }
+        [mutableCorpus addObject:[mutableWords componentsJoinedByString:@" "]];
+    }
+
+    return mutableCorpus;
+}
+
+static inline NSArray * TTTLongPostCorpus() {
+    NSString *text = [TTTEspressosCorpus() componentsJoinedByString:@" "];
+    NSMutableArray *mutableCorpus = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 10; i++) {
+        [mutableCorpus addObject:[text substringFromIndex:i * 10]];
+    }
+
+    return mutableCorpus;
+}
+
+static inline NSArray * TTTLinkDenseCorpus() {
+    NSMutableArray *mutableCorpus = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 50; i++) {
+        [mutableCorpus addObject:[NSString stringWithFormat:@"Order %lu at https://example.com/espresso/%lu or www.espressos.org, call 415-555-%04lu, or mail barista%lu@example.com.", (unsigned long)i, (unsigned long)i, (unsigned long)i, (unsigned long)i]];
+    }
+
+    return mutableCorpus;
+}
+
+static int TTTCompareTimeIntervals(const void *a, const void *b) {
+    CFTimeInterval intervalA = *(const CFTimeInterval *)a;
+    CFTimeInterval intervalB = *(const CFTimeInterval *)b;
+
+    return intervalA < intervalB ? -1 : (intervalA > intervalB ? 1 : 0);
+}
+
+// The slowest a single string may take through the whole pipeline, at the 99th percentile, on a debug build in the simulator
+static CFTimeInterval const kTTTBenchmarkMaximumLatency = 0.05;
+
+// Returns the nearest-rank percentile of the sorted intervals
+static inline CFTimeInterval TTTPercentileOfSortedTimeIntervals(const CFTimeInterval *intervals, NSUInteger count, double percentile) {
+    NSUInteger rank = (NSUInteger)ceil(percentile / 100.0 * count);
+
+    return count > 0 ? intervals[MAX(rank, (NSUInteger)1) - 1] : 0;
+}
+
+// Sets, measures, draws and hit-tests a label for each string in the corpus, the way a table view would
+- (void)measureLabelPipelineWithCorpus:(NSArray *)corpus {
+    NSMutableArray *mutableAttributedCorpus = [NSMutableArray array];
+    for (NSString *text in corpus) {
+        [mutableAttributedCorpus addObject:[[NSAttributedString alloc] initWithString:text attributes:TTTAttributedTestAttributesDictionary()]];
+    }
+
+    // The time taken by each string, over every iteration, from which the latency percentiles are reported
+    NSMutableData *timeIntervals = [NSMutableData data];
+    NSURL *linkURL = testURL;
+    [self measureBlock:^{
+        [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+
+        UIGraphicsBeginImageContext(CGSizeMake(300, 300));
+        for (NSAttributedString *attributedText in mutableAttributedCorpus) {
+            CFTimeInterval beginTime = CACurrentMediaTime();
+            TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+            measureLabel.numberOfLines = 0;
+            measureLabel.text = attributedText;
+            [measureLabel addLinkToURL:linkURL withRange:NSMakeRange(0, MIN((NSUInteger)4, [attributedText length]))];
+            CGSize size = [measureLabel sizeThatFits:CGSizeMake(300, CGFLOAT_MAX)];
+            measureLabel.frame = CGRectMake(0, 0, 300, MIN(size.height, 300));
+
+            [measureLabel drawTextInRect:measureLabel.bounds];
+            [measureLabel containslinkAtPoint:CGPointMake(5, 5)];
+
+            CFTimeInterval timeInterval = CACurrentMediaTime() - beginTime;
+            [timeIntervals appendBytes:&timeInterval length:sizeof(timeInterval)];
+        }
+        UIGraphicsEndImageContext();
+    }];
+
+    NSUInteger count = [timeIntervals length] / sizeof(CFTimeInterval);
+    qsort([timeIntervals mutableBytes], count, sizeof(CFTimeInterval), TTTCompareTimeIntervals);
+    CFTimeInterval p50 = TTTPercentileOfSortedTimeIntervals([timeIntervals bytes], count, 50);
+    CFTimeInterval p99 = TTTPercentileOfSortedTimeIntervals([timeIntervals bytes], count, 99);
+    expect(p99).to.beLessThan(kTTTBenchmarkMaximumLatency);
+
+    // One line of JSON per corpus, so that results can be collected from the log of a run with TTT_BENCHMARK_REPORT=1 passed to xcodebuild
+    if ([[[[NSProcessInfo processInfo] environment] objectForKey:@"TTT_BENCHMARK_REPORT"] boolValue]) {
+        NSDictionary *report = @{ @"benchmark" : NSStringFromSelector(self.invocation.selector), @"samples" : @(count), @"p50_us" : @(p50 * 1e6), @"p99_us" : @(p99 * 1e6) };
+        NSLog(@"%@", [[NSString alloc] initWithData:[NSJSONSerialization dataWithJSONObject:report options:0 error:nil] encoding:NSUTF8StringEncoding]);
+    }
+}
+
+- (void)testPerformanceOfEspressosCorpus {
+    [self measureLabelPipelineWithCorpus:TTTEspressosCorpus()];
+}
+
+- (void)testPerformanceOfChatCorpus {
+    [self measureLabelPipelineWithCorpus:TTTChatCorpus()];
+}
+
+- (void)testPerformanceOfLongPostCorpus {
+    [self measureLabelPipelineWithCorpus:TTTLongPostCorpus()];
+}
+
+- (void)testPerformanceOfDisplayingRepeatedLabelsWithBitmapCache {
+    NSMutableArray *measureLabels = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 500; i++) {
+        TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 100, 20)];
+        measureLabel.bitmapCachingEnabled = YES;
+        measureLabel.text = (i % 2) ? @"Reply" : @"5 min ago";
+        [measureLabels addObject:measureLabel];
+    }
+
+    [self measureBlock:^{
+        for (TTTAttributedLabel *measureLabel in measureLabels) {
+            [measureLabel setNeedsDisplay];
+            [measureLabel layoutIfNeeded];
+        }
+    }];
+}
+
+- (void)testPerformanceOfDrawingTileOfLongPost {
+    NSString *text = [TTTLongPostCorpus() componentsJoinedByString:@"\n"];
+    TTTAttributedLabel *measureLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+    measureLabel.numberOfLines = 0;
+    measureLabel.text = [[NSAttributedString alloc] initWithString:text attributes:TTTAttributedTestAttributesDictionary()];
+    CGSize size = [measureLabel sizeThatFits:CGSizeMake(300, CGFLOAT_MAX)];
+    measureLabel.frame = CGRectMake(0, 0, 300, size.height);
+    measureLabel.tiledRenderingEnabled = YES;
+    [measureLabel layoutIfNeeded];
+
+    // Draw one screenful from the middle of the text, the way a tile is drawn as it scrolls into view
+    CALayer *tiledLayer = TTTContentLayerOfLabel(measureLabel);
+    CGRect tileRect = CGRectMake(0, (CGFloat)floor(size.height / 2), 300, 512);
+    [self measureBlock:^{
+        UIGraphicsBeginImageContextWithOptions(tileRect.size, NO, 0);
+        CGContextRef c = UIGraphicsGetCurrentContext();
+        CGContextTranslateCTM(c, 0, -tileRect.origin.y);
+        CGContextClipToRect(c, tileRect);
+        [tiledLayer.delegate drawLayer:tiledLayer inContext:c];
+        UIGraphicsEndImageContext();
+    }];
+}
+
+- (void)testPerformanceOfScanningLinkDenseCorpus {
+    NSArray *corpus = TTTLinkDenseCorpus();
+    TTTAttributedLabelScanner *scanner = [TTTAttributedLabelScanner scannerWithTypes:NSTextCheckingTypeLink | NSTextCheckingTypePhoneNumber];
+    expect([[scanner matchesInString:corpus[0] options:0 range:NSMakeRange(0, [corpus[0] length])] count]).to.beGreaterThan(0);
+
+    [self measureBlock:^{
+        for (int i = 20; i--;) {
+            for (NSString *text in corpus) {
+                [scanner matchesInString:text options:0 range:NSMakeRange(0, [text length])];
+            }
+        }
+    }];
+}
+
+- (void)testPerformanceOfMeasuringLinkDenseCorpus {
+    [self measureLabelPipelineWithCorpus:TTTLinkDenseCorpus()];
+}
+
+- (NSArray *)batchMeasurementCorpus {
+    NSArray *corpus = [TTTEspressosCorpus() arrayByAddingObjectsFromArray:TTTChatCorpus()];
+    NSMutableArray *mutableAttributedStrings = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 1000; i++) {
+        NSString *text = [NSString stringWithFormat:@"%lu %@", (unsigned long)i, corpus[i % [corpus count]]];
+        [mutableAttributedStrings addObject:[[NSAttributedString alloc] initWithString:text attributes:TTTAttributedTestAttributesDictionary()]];
+    }
+
+    return mutableAttributedStrings;
+}
+
+- (void)testBatchMeasurementMatchesSerialMeasurement {
+    NSArray *attributedStrings = [[self batchMeasurementCorpus] subarrayWithRange:NSMakeRange(0, 100)];
+    NSArray *sizes = [TTTAttributedLabel sizesThatFitAttributedStrings:attributedStrings withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+
+    expect(sizes).to.haveCountOf([attributedStrings count]);
+    [attributedStrings enumerateObjectsUsingBlock:^(NSAttributedString *attributedString, NSUInteger idx, __unused BOOL *stop) {
+        CGSize size = [TTTAttributedLabel sizeThatFitsAttributedString:attributedString withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+        expect(CGSizeEqualToSize([sizes[idx] CGSizeValue], size)).to.beTruthy();
+    }];
+}
+
+- (void)testPrecomputedSize {
+    label.textInsets = UIEdgeInsetsMake(5, 5, 5, 5);
+    label.text = kTestLabelText;
+    [TTTAttributedLabel setPrecomputedSize:CGSizeMake(42, 420) forAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+
+    expect([TTTAttributedLabel sizeThatFitsAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0]).to.equal(CGSizeMake(42, 420));
+    expect([label sizeThatFits:kTestLabelSize]).to.equal(CGSizeMake(52, 430));
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+}
+
+- (void)testSizeThatFitsOffMainThreadUsesPublishedConfiguration {
+    label.text = kTestLabelText;
+    [TTTAttributedLabel setPrecomputedSize:CGSizeMake(42, 420) forAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:2];
+
+    // Insets and the number of lines set after the text are published with it for measuring
+    label.textInsets = UIEdgeInsetsMake(5, 5, 5, 5);
+    label.numberOfLines = 2;
+
+    __block CGSize size = CGSizeZero;
+    dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        size = [label sizeThatFits:kTestLabelSize];
+    });
+    expect(size).to.equal(CGSizeMake(52, 430));
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+}
+
+- (void)testPrecomputedSizeOfLabelWithTruncationToken {
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    label.attributedTruncationToken = [[NSAttributedString alloc] initWithString:@"[more]"];
+    label.text = kTestLabelText;
+
+    // The label measures its text with the token appended, so a size provided for the text as set is not found
+    [TTTAttributedLabel setPrecomputedSize:CGSizeMake(42, 420) forAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+    expect([label sizeThatFits:kTestLabelSize]).notTo.equal(CGSizeMake(42, 420));
+
+    [label setPrecomputedSize:CGSizeMake(24, 240) withConstraints:kTestLabelSize];
+    expect([label sizeThatFits:kTestLabelSize]).to.equal(CGSizeMake(24, 240));
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+}
+
+- (void)testCacheArchiveRoundTrip {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TTTAttributedLabelCacheArchive"];
+    label.text = kTestLabelText;
+    CGSize size = [TTTAttributedLabel sizeThatFitsAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+
+    NSError *error = nil;
+    expect([TTTAttributedLabel writeCacheArchiveToFile:path error:&error]).to.beTruthy();
+    expect(error).to.beNil();
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    expect([TTTAttributedLabel loadCacheArchiveFromFile:path error:&error]).to.beTruthy();
+
+    NSUInteger hitCount = [TTTAttributedLabel sharedSizeCache].hitCount;
+    expect([TTTAttributedLabel sizeThatFitsAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0]).to.equal(size);
+    expect([TTTAttributedLabel sharedSizeCache].count).to.beGreaterThan(0);
+    expect([TTTAttributedLabel sharedSizeCache].hitCount).to.equal(hitCount);
+
+    [TTTAttributedLabel unloadCacheArchive];
+}
+
+- (void)testUnloadedCacheArchiveNotUsed {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TTTAttributedLabelCacheArchive"];
+    label.text = kTestLabelText;
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    [TTTAttributedLabel setPrecomputedSize:CGSizeMake(42, 420) forAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+    expect([TTTAttributedLabel writeCacheArchiveToFile:path error:NULL]).to.beTruthy();
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    expect([TTTAttributedLabel loadCacheArchiveFromFile:path error:NULL]).to.beTruthy();
+    [TTTAttributedLabel unloadCacheArchive];
+
+    expect([TTTAttributedLabel sizeThatFitsAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0]).notTo.equal(CGSizeMake(42, 420));
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+}
+
+- (void)testCorruptCacheArchiveNotUsed {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TTTAttributedLabelCacheArchive"];
+    label.text = kTestLabelText;
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    [[TTTAttributedLabel sharedDataDetectionCache] removeAllObjects];
+    [TTTAttributedLabel setPrecomputedSize:CGSizeMake(42, 420) forAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+    expect([TTTAttributedLabel writeCacheArchiveToFile:path error:NULL]).to.beTruthy();
+
+    // Corrupting the only entry leaves the file loadable, but the entry is not used
+    NSMutableData *data = [NSMutableData dataWithContentsOfFile:path];
+    ((uint8_t *)[data mutableBytes])[[data length] - 1] ^= 0xFF;
+    [data writeToFile:path atomically:YES];
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+    expect([TTTAttributedLabel loadCacheArchiveFromFile:path error:NULL]).to.beTruthy();
+    expect([TTTAttributedLabel sizeThatFitsAttributedString:label.attributedText withConstraints:kTestLabelSize limitedToNumberOfLines:0]).notTo.equal(CGSizeMake(42, 420));
+    [TTTAttributedLabel unloadCacheArchive];
+
+    // Corrupting the header does not load the file
+    ((uint8_t *)[data mutableBytes])[20] ^= 0xFF;
+    [data writeToFile:path atomically:YES];
+
+    NSError *error = nil;
+    expect([TTTAttributedLabel loadCacheArchiveFromFile:path error:&error]).to.beFalsy();
+    expect(error.code).to.equal(NSFileReadCorruptFileError);
+
+    [[data subdataWithRange:NSMakeRange(0, 8)] writeToFile:path atomically:YES];
+    expect([TTTAttributedLabel loadCacheArchiveFromFile:path error:NULL]).to.beFalsy();
+
+    [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+}
+
+- (void)testCancellingBatchMeasurement {
+    __block BOOL completed = NO;
+    __block NSArray *completedSizes = @[];
+    NSProgress *progress = [TTTAttributedLabel calculateSizesThatFitAttributedStrings:[self batchMeasurementCorpus] withConstraints:kTestLabelSize limitedToNumberOfLines:0 completion:^(NSArray *sizes) {
+        completedSizes = sizes;
+        completed = YES;
+    }];
+    [progress cancel];
+
+    expect(completed).will.beTruthy();
+    expect(completedSizes).to.beNil();
+}
+
+- (void)testPerformanceOfMeasurementFromCacheArchive {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"TTTAttributedLabelCacheArchivePerformance"];
+    NSArray *attributedStrings = [self batchMeasurementCorpus];
+    [TTTAttributedLabel sizesThatFitAttributedStrings:attributedStrings withConstraints:CGSizeMake(300, CGFLOAT_MAX) limitedToNumberOfLines:0];
+    [TTTAttributedLabel writeCacheArchiveToFile:path error:NULL];
+
+    [self measureBlock:^{
+        [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+        [TTTAttributedLabel loadCacheArchiveFromFile:path error:NULL];
+        for (NSAttributedString *attributedString in attributedStrings) {
+            [TTTAttributedLabel sizeThatFitsAttributedString:attributedString withConstraints:CGSizeMake(300, CGFLOAT_MAX) limitedToNumberOfLines:0];
+        }
+    }];
+
+    [TTTAttributedLabel unloadCacheArchive];
+}
+
+- (void)testPerformanceOfSerialMeasurement {
+    NSArray *attributedStrings = [self batchMeasurementCorpus];
+    [self measureBlock:^{
+        [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+        for (NSAttributedString *attributedString in attributedStrings) {
+            [TTTAttributedLabel sizeThatFitsAttributedString:attributedString withConstraints:CGSizeMake(300, CGFLOAT_MAX) limitedToNumberOfLines:0];
+        }
+    }];
+}
+
+// Should be faster than serial measurement by about the number of cores
+- (void)testPerformanceOfBatchMeasurement {
+    NSArray *attributedStrings = [self batchMeasurementCorpus];
+    [self measureBlock:^{
+        [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+        [TTTAttributedLabel sizesThatFitAttributedStrings:attributedStrings withConstraints:CGSizeMake(300, CGFLOAT_MAX) limitedToNumberOfLines:0];
+    }];
+}
+
+- (void)testSharedStyleAttributes {
+    TTTAttributedLabel *otherLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+    label.text = kTestLabelText;
+    otherLabel.text = kTestLabelText;
+
+    NSDictionary *attributes = [label.attributedText attributesAtIndex:0 effectiveRange:NULL];
+    NSDictionary *otherAttributes = [otherLabel.attributedText attributesAtIndex:0 effectiveRange:NULL];
+    expect(otherAttributes[NSParagraphStyleAttributeName]).to.beIdenticalTo(attributes[NSParagraphStyleAttributeName]);
+
+    otherLabel.lineSpacing = 10.0f;
+    otherLabel.text = kTestLabelText;
+    otherAttributes = [otherLabel.attributedText attributesAtIndex:0 effectiveRange:NULL];
+    expect(otherAttributes[NSParagraphStyleAttributeName]).notTo.beIdenticalTo(attributes[NSParagraphStyleAttributeName]);
+    expect([otherAttributes[NSParagraphStyleAttributeName] lineSpacing]).to.equal(10.0f);
+}
+
+- (void)testAdjustsFontSizeToFitWidthKeepsFittedText {
+    label.adjustsFontSizeToFitWidth = YES;
+    label.minimumScaleFactor = 0.25f;
+    label.numberOfLines = 1;
+    label.text = TTTAttributedTestString();
+    CGFloat unscaledWidth = [label sizeThatFits:CGSizeZero].width;
+
+    [label setFrame:CGRectMake(0, 0, 150, 50)];
+    UIGraphicsBeginImageContext(label.bounds.size);
+    [label.layer renderInContext:UIGraphicsGetCurrentContext()];
+    label.highlighted = YES;
+    [label.layer renderInContext:UIGraphicsGetCurrentContext()];
+    UIGraphicsEndImageContext();
+
+    expect([label sizeThatFits:CGSizeZero].width).to.beLessThanOrEqualTo(150);
+
+    label.adjustsFontSizeToFitWidth = NO;
+    expect([label sizeThatFits:CGSizeZero].width).to.equal(unscaledWidth);
+}
+
 #pragma mark - FBSnapshotTestCase tests
 
 - (void)testAdjustsFontSizeToFitWidth {
@@ -587,6 +1516,58 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     XCTAssertGreaterThan(size.height, font.pointSize, @"Text should size to more than one line");
 }
 
+- (void)testSizeThatFitsWhileTextChanges {
+    NSAttributedString *shortString = [[NSAttributedString alloc] initWithString:@"Short" attributes:TTTAttributedTestAttributesDictionary()];
+    NSAttributedString *longString = TTTAttributedTestString();
+    label.numberOfLines = 0;
+    label.frame = CGRectMake(0, 0, kTestLabelSize.width, 100);
+
+    CGSize shortSize = [TTTAttributedLabel sizeThatFitsAttributedString:shortString withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+    CGSize longSize = [TTTAttributedLabel sizeThatFitsAttributedString:longString withConstraints:kTestLabelSize limitedToNumberOfLines:0];
+
+    __block BOOL finished = NO;
+    __block NSUInteger unexpectedSizeCount = 0;
+    TTTAttributedLabel *measuredLabel = label;
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger i = 0; i < 4; i++) {
+        dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            while (!finished) {
+                [[TTTAttributedLabel sharedSizeCache] removeAllObjects];
+
+                // Each measurement sees the text and framesetter of the same snapshot
+                CGSize size = [measuredLabel sizeThatFits:kTestLabelSize];
+                if (!CGSizeEqualToSize(size, shortSize) && !CGSizeEqualToSize(size, longSize)) {
+                    @synchronized(group) {
+                        unexpectedSizeCount++;
+                    }
+                }
+            }
+        });
+    }
+
+    for (NSUInteger i = 0; i < 500; i++) {
+        label.text = (i % 2) ? longString : shortString;
+        [label containslinkAtPoint:CGPointMake(5, 5)];
+    }
+
+    finished = YES;
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    expect(unexpectedSizeCount).to.equal(0);
+    expect([label sizeThatFits:kTestLabelSize]).to.equal(longSize);
+}
+
+- (void)testSizeThatFitsWithoutTextOffMainThread {
+    TTTAttributedLabel *emptyLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+
+    __block CGSize size = CGSizeMake(1, 1);
+    dispatch_sync(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        size = [emptyLabel sizeThatFits:kTestLabelSize];
+    });
+
+    expect(size).to.equal(CGSizeZero);
+}
+
 - (void)testOversizedAttributedFontSize {
     CGFloat fontSize = 13.f;
     
@@ -629,6 +1610,29 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     expect([label indexOfAccessibilityElement:(id)[NSNull null]]).to.equal(NSNotFound);
 }
 
+- (void)testAccessibilityElementsReusedWhenAddingLinks {
+    label.text = kTestLabelText;
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+
+    UIAccessibilityElement *linkElement = [label accessibilityElementAtIndex:0];
+    expect(CGRectIsEmpty(linkElement.accessibilityFrame)).to.beFalsy();
+
+    [label addLinkToURL:testURL withRange:NSMakeRange(5, 4)];
+
+    expect(label.accessibilityElementCount).to.equal(3);
+    expect([label accessibilityElementAtIndex:0]).to.beIdenticalTo(linkElement);
+}
+
+- (void)testAccessibilityPathForLinkSpanningLines {
+    label.text = kTestLabelText;
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, [kTestLabelText length])];
+    TTTSizeAttributedLabel(label);
+
+    UIAccessibilityElement *linkElement = [label accessibilityElementAtIndex:0];
+    expect(linkElement.accessibilityPath).toNot.beNil();
+}
+
 #pragma mark - TTTAttributedLabelLink tests
 
 - (void)testDesignatedInitializer {
@@ -672,6 +1676,72 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
 
 #pragma mark - TTTAttributedLabelDelegate tests
 
+- (void)testLongPressGestureRecognizerAddedWithLinks {
+    label.text = kTestLabelText;
+    expect(label.gestureRecognizers).to.beNil();
+
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    expect(label.gestureRecognizers).to.contain(label.longPressGestureRecognizer);
+}
+
+- (void)testPrepareForReuse {
+    [[TTTAttributedLabel sharedDataDetectionCache] removeAllObjects];
+    NSString *text = @"See https://www.yahoo.com/ for more information.";
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = text;
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 3)];
+    UILongPressGestureRecognizer *longPressGestureRecognizer = label.longPressGestureRecognizer;
+
+    [label prepareForReuse];
+
+    expect(label.text).to.beNil();
+    expect(label.links).to.haveCountOf(0);
+    expect(label.longPressGestureRecognizer).to.beIdenticalTo(longPressGestureRecognizer);
+    expect(label.enabledTextCheckingTypes).to.equal(NSTextCheckingTypeLink);
+
+    // Detection started for the previous text does not add links to the reused label, even if it shows the same text
+    label.enabledTextCheckingTypes = 0;
+    label.text = text;
+    [[TTTAttributedLabel valueForKey:@"dataDetectionQueue"] waitUntilAllOperationsAreFinished];
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+
+    expect(label.links).to.haveCountOf(0);
+}
+
+- (void)testPrepareForReuseKeepsStorage {
+    label.text = TTTAttributedTestString();
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, 5)], @"Label should hit-test the link of its first text");
+    NSArray *accessibilityElements = label.accessibilityElements;
+    id linkIndex = [label valueForKey:@"linkIndex"];
+    id linkAccessibilityElements = [label valueForKey:@"linkAccessibilityElements"];
+
+    [label prepareForReuse];
+
+    // Clearing publishes the snapshot shared by all labels without text, rather than a new one
+    TTTAttributedLabel *otherLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+    [otherLabel prepareForReuse];
+    expect([label valueForKey:@"publishedTextSnapshot"]).to.beIdenticalTo([otherLabel valueForKey:@"publishedTextSnapshot"]);
+    expect([[label valueForKey:@"linkAccessibilityElements"] count]).to.equal(0);
+
+    label.text = TTTAttributedTestString();
+    [label addLinkToURL:testURL withRange:NSMakeRange(0, 4)];
+    TTTSizeAttributedLabel(label);
+
+    XCTAssertTrue([label containslinkAtPoint:CGPointMake(5, 5)], @"Label should hit-test the link of its next text");
+    expect([label valueForKey:@"linkIndex"]).to.beIdenticalTo(linkIndex);
+    expect(label.accessibilityElements).to.beIdenticalTo(accessibilityElements);
+    expect(label.accessibilityElements).to.haveCountOf(2);
+    expect([label valueForKey:@"linkAccessibilityElements"]).to.beIdenticalTo(linkAccessibilityElements);
+}
+
+- (void)testDefaultLinkAttributesShared {
+    TTTAttributedLabel *otherLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectZero];
+    expect(otherLabel.linkAttributes).to.beIdenticalTo(label.linkAttributes);
+    expect(otherLabel.activeLinkAttributes).to.beIdenticalTo(label.activeLinkAttributes);
+}
+
 - (void)testDefaultLongPressValues {
     XCTAssertGreaterThan(label.longPressGestureRecognizer.minimumPressDuration, 0, @"Should have a default minimum long press duration");
     XCTAssertGreaterThan(label.longPressGestureRecognizer.allowableMovement, 0, @"Should have a default allowable long press movement distance");
@@ -1020,6 +2090,147 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
     expect(newLabel.text).to.equal(label.text);
 }
 
+- (void)testEncodingTiledLabel {
+    label.tiledRenderingEnabled = YES;
+    label.text = TTTAttributedTestString();
+
+    TTTAttributedLabel *newLabel = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:label]];
+
+    expect(newLabel.tiledRenderingEnabled).to.beTruthy();
+    expect(newLabel.subviews).to.beEmpty();
+    expect(TTTContentLayerOfLabel(newLabel)).to.beKindOf([CATiledLayer class]);
+}
+
+- (void)testTiledRenderingUsesTiledLayer {
+    label.text = TTTAttributedTestString();
+    label.tiledRenderingEnabled = YES;
+    [label layoutIfNeeded];
+
+    CATiledLayer *tiledLayer = (CATiledLayer *)TTTContentLayerOfLabel(label);
+    expect(tiledLayer).to.beKindOf([CATiledLayer class]);
+    expect(tiledLayer.superlayer).to.beIdenticalTo(label.layer);
+    expect(tiledLayer.tileSize.width).to.equal(ceil(CGRectGetWidth(label.bounds) * label.contentScaleFactor));
+
+    label.tiledRenderingEnabled = NO;
+    expect(TTTContentLayerOfLabel(label)).to.beNil();
+    expect(tiledLayer.superlayer).to.beNil();
+}
+
+- (void)testTiledLabelHasNoBackingStore {
+    label.text = TTTAttributedTestString();
+    label.tiledRenderingEnabled = YES;
+    [label.layer displayIfNeeded];
+
+    // Neither changing the text nor resizing the label draws its own layer
+    label.text = kTestLabelText;
+    label.frame = CGRectMake(0, 0, 300, 2000);
+    [label layoutIfNeeded];
+
+    expect(label.layer.needsDisplay).to.beFalsy();
+    expect(label.layer.contents).to.beNil();
+}
+
+- (void)testBitmapCacheSharedByIdenticalLabels {
+    TTTAttributedLabelCache *bitmapCache = [TTTAttributedLabel sharedBitmapCache];
+    [bitmapCache removeAllObjects];
+    [bitmapCache resetStatistics];
+
+    NSMutableArray *labels = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 2; i++) {
+        TTTAttributedLabel *cachedLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 100, 20)];
+        cachedLabel.bitmapCachingEnabled = YES;
+        cachedLabel.text = @"Reply";
+        [cachedLabel layoutIfNeeded];
+        [labels addObject:cachedLabel];
+    }
+
+    expect(bitmapCache.missCount).to.equal(1);
+    expect(bitmapCache.hitCount).to.equal(1);
+    expect(TTTContentLayerOfLabel(labels[0]).contents).toNot.beNil();
+    expect(TTTContentLayerOfLabel(labels[1]).contents).to.equal(TTTContentLayerOfLabel(labels[0]).contents);
+
+    // Highlighted labels draw differently, so they are cached separately
+    TTTAttributedLabel *highlightedLabel = labels[1];
+    highlightedLabel.highlightedTextColor = [UIColor redColor];
+    highlightedLabel.highlighted = YES;
+    [highlightedLabel layoutIfNeeded];
+
+    expect(bitmapCache.missCount).to.equal(2);
+    expect(TTTContentLayerOfLabel(highlightedLabel).contents).toNot.equal(TTTContentLayerOfLabel(labels[0]).contents);
+
+    [bitmapCache removeAllObjects];
+}
+
+- (void)testBitmapCacheRespectsByteBudget {
+    TTTAttributedLabelCache *bitmapCache = [TTTAttributedLabel sharedBitmapCache];
+    NSUInteger totalCostLimit = bitmapCache.totalCostLimit;
+    [bitmapCache removeAllObjects];
+
+    TTTAttributedLabel *cachedLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 100, 20)];
+    cachedLabel.bitmapCachingEnabled = YES;
+    cachedLabel.text = @"1";
+    [cachedLabel layoutIfNeeded];
+
+    // Leave room for a single bitmap of this size
+    bitmapCache.totalCostLimit = bitmapCache.totalCost;
+    for (NSUInteger i = 2; i < 10; i++) {
+        cachedLabel.text = [@(i) stringValue];
+        [cachedLabel layoutIfNeeded];
+    }
+
+    expect(bitmapCache.count).to.equal(1);
+    expect(bitmapCache.totalCost).to.beLessThanOrEqualTo(bitmapCache.totalCostLimit);
+
+    bitmapCache.totalCostLimit = totalCostLimit;
+    [bitmapCache removeAllObjects];
+}
+
+- (void)testBitmapCacheSkipsBitmapsLargerThanByteBudget {
+    TTTAttributedLabelCache *bitmapCache = [TTTAttributedLabel sharedBitmapCache];
+    NSUInteger totalCostLimit = bitmapCache.totalCostLimit;
+    [bitmapCache removeAllObjects];
+
+    TTTAttributedLabel *smallLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 100, 20)];
+    smallLabel.bitmapCachingEnabled = YES;
+    smallLabel.text = @"1";
+    [smallLabel layoutIfNeeded];
+    expect(bitmapCache.count).to.equal(1);
+
+    bitmapCache.totalCostLimit = bitmapCache.totalCost;
+
+    TTTAttributedLabel *largeLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 300, 200)];
+    largeLabel.bitmapCachingEnabled = YES;
+    largeLabel.text = @"2";
+    [largeLabel layoutIfNeeded];
+
+    // The large label still shows its text, without evicting the small one
+    expect(TTTContentLayerOfLabel(largeLabel).contents).toNot.beNil();
+    expect(bitmapCache.count).to.equal(1);
+
+    bitmapCache.totalCostLimit = totalCostLimit;
+    [bitmapCache removeAllObjects];
+}
+
+- (void)testBitmapCacheKeysOnLineBreakMode {
+    TTTAttributedLabelCache *bitmapCache = [TTTAttributedLabel sharedBitmapCache];
+    [bitmapCache removeAllObjects];
+    [bitmapCache resetStatistics];
+
+    TTTAttributedLabel *cachedLabel = [[TTTAttributedLabel alloc] initWithFrame:CGRectMake(0, 0, 60, 20)];
+    cachedLabel.bitmapCachingEnabled = YES;
+    cachedLabel.text = kTestLabelText;
+    cachedLabel.lineBreakMode = NSLineBreakByTruncatingTail;
+    [cachedLabel layoutIfNeeded];
+
+    cachedLabel.lineBreakMode = NSLineBreakByTruncatingHead;
+    [cachedLabel layoutIfNeeded];
+
+    expect(bitmapCache.missCount).to.equal(2);
+    expect(bitmapCache.hitCount).to.equal(0);
+
+    [bitmapCache removeAllObjects];
+}
+
 #pragma mark - TTTAttributedLabelLink
 
 - (void)testAddSingleLink {
@@ -1028,10 +2239,107 @@ static inline void TTTSimulateLongPressOnLabelAtPointWithDuration(TTTAttributedL
                                     [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(0, 1) URL:testURL]];
     
     [label addLink:link];
-    
+
     expect(label.links.count).to.equal(1);
 }
 
+- (void)testBatchLinkUpdates {
+    label.text = TTTAttributedTestString();
+    NSURL *otherURL = [NSURL URLWithString:@"http://mattt.me"];
+
+    [label performBatchLinkUpdates:^{
+        [label addLinkToURL:testURL withRange:NSMakeRange(0, 8)];
+        [label addLinkToURL:otherURL withRange:NSMakeRange(4, 2)];
+        expect(label.links.count).to.equal(0);
+    }];
+
+    expect(label.links.count).to.equal(2);
+    expect([label.attributedText attribute:(NSString *)kCTUnderlineStyleAttributeName atIndex:0 effectiveRange:NULL]).to.beTruthy();
+
+    // Links added later take precedence where links overlap
+    TTTSizeAttributedLabel(label);
+    expect([label linkAtPoint:CGPointMake(5, 5)].result.URL).to.equal(testURL);
+}
+
+- (void)testAppendTextDetectsLinksInNewText {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = [NSString stringWithFormat:@"Go to %@ now", [testURL absoluteString]];
+    expect([label.links count]).will.equal(1);
+    NSRange linkRange = ((NSTextCheckingResult *)label.links[0]).range;
+
+    [label appendText:@"\nOr http://mattt.me"];
+
+    expect(label.attributedText.string).to.equal([NSString stringWithFormat:@"Go to %@ now\nOr http://mattt.me", [testURL absoluteString]]);
+    expect([label.links count]).will.equal(2);
+    expect(NSEqualRanges(((NSTextCheckingResult *)label.links[0]).range, linkRange)).to.beTruthy();
+}
+
+- (void)testAppendTextSearchesOnlyChangedParagraphs {
+    [[TTTAttributedLabel sharedDataDetectionCache] removeAllObjects];
+
+    NSString *paragraph = [@"" stringByPaddingToLength:100 withString:@"Lorem ipsum dolor sit amet " startingAtIndex:0];
+    TTTRecordingDataDetector *dataDetector = [[TTTRecordingDataDetector alloc] init];
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.dataDetector = dataDetector;
+    label.text = [NSString stringWithFormat:@"%@ %@\n%@\n", paragraph, [testURL absoluteString], paragraph];
+    expect([label.links count]).will.equal(1);
+
+    [label appendText:@"Or http://mattt.me"];
+
+    expect([label.links count]).will.equal(2);
+    expect(dataDetector.searchedStrings.lastObject).to.equal([NSString stringWithFormat:@"%@\nOr http://mattt.me", paragraph]);
+}
+
+- (void)testReplaceTextMovesLinksAfterChangedParagraphs {
+    NSString *paragraph = [@"" stringByPaddingToLength:100 withString:@"Lorem ipsum dolor sit amet " startingAtIndex:0];
+    label.text = [NSString stringWithFormat:@"Intro\n%@\n%@\nLink", paragraph, paragraph];
+    NSUInteger linkLocation = [label.attributedText length] - 4;
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange(linkLocation, 4)];
+
+    [label replaceTextInRange:NSMakeRange(0, 5) withText:@"Hi"];
+
+    expect([label.links count]).to.equal(1);
+    expect(link.result.range.location).to.equal(linkLocation - 3);
+    expect([label.attributedText attribute:(NSString *)kCTUnderlineStyleAttributeName atIndex:linkLocation - 3 effectiveRange:NULL]).to.beTruthy();
+}
+
+- (void)testReplaceTextRemovesLinksInChangedText {
+    label.text = @"Visit helios";
+    [label addLinkToURL:testURL withRange:NSMakeRange(6, 6)];
+
+    [label replaceTextInRange:NSMakeRange(6, 3) withText:@"Hel"];
+
+    expect(label.attributedText.string).to.equal(@"Visit Helios");
+    expect([label.links count]).to.equal(0);
+    expect([label.attributedText attribute:(NSString *)kCTUnderlineStyleAttributeName atIndex:10 effectiveRange:NULL]).to.beNil();
+}
+
+- (void)testReplaceTextKeepsAddedLinksNextToChangedText {
+    label.enabledTextCheckingTypes = NSTextCheckingTypeLink;
+    label.text = [NSString stringWithFormat:@"Visit %@ or helios", [testURL absoluteString]];
+    expect([label.links count]).will.equal(1);
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange([label.attributedText length] - 6, 6)];
+
+    [label replaceTextInRange:NSMakeRange(0, 5) withText:@"See"];
+
+    // The detected link is found again, and the added link is moved with its text
+    expect([label.links count]).will.equal(2);
+    expect([label valueForKey:@"linkModels"]).to.contain(link);
+    expect(link.result.range.location).to.equal([label.attributedText length] - 6);
+}
+
+- (void)testAppendTextAfterAddedLinkAtEnd {
+    label.text = @"Visit helios";
+    TTTAttributedLabelLink *link = [label addLinkToURL:testURL withRange:NSMakeRange(6, 6)];
+
+    [label appendText:@" today"];
+
+    expect(label.attributedText.string).to.equal(@"Visit helios today");
+    expect([label valueForKey:@"linkModels"]).to.contain(link);
+    expect(NSEqualRanges(link.result.range, NSMakeRange(6, 6))).to.beTruthy();
+    expect([label.attributedText attribute:(NSString *)kCTUnderlineStyleAttributeName atIndex:14 effectiveRange:NULL]).to.beNil();
+}
+
 - (void)testEncodingLink {
     TTTAttributedLabelLink *link = [[TTTAttributedLabelLink alloc] initWithAttributesFromLabel:label
                                                                             textCheckingResult:
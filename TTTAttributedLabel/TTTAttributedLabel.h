@@ -29,7 +29,11 @@ FOUNDATION_EXPORT double TTTAttributedLabelVersionNumber;
 //! Project version string for TTTAttributedLabel.
 FOUNDATION_EXPORT const unsigned char TTTAttributedLabelVersionString[];
 
+@class TTTAttributedLabel;
 @class TTTAttributedLabelLink;
+@class TTTAttributedLabelCache;
+@class TTTAttributedLabelLayout;
+@class TTTAttributedLabelStatistics;
 
 /**
  Vertical alignment for text in a label whose bounds are larger than its text bounds
@@ -40,6 +44,39 @@ typedef NS_ENUM(NSInteger, TTTAttributedLabelVerticalAlignment) {
     TTTAttributedLabelVerticalAlignmentBottom   = 2,
 };
 
+/**
+ Work done by labels that is counted and timed when instrumentation is enabled
+ */
+typedef NS_ENUM(NSInteger, TTTAttributedLabelTraceEvent) {
+    TTTAttributedLabelTraceEventFramesetterCreation     = 0,
+    TTTAttributedLabelTraceEventFrameCreation           = 1,
+    TTTAttributedLabelTraceEventSizeThatFits            = 2,
+    TTTAttributedLabelTraceEventTruncation              = 3,
+    TTTAttributedLabelTraceEventDataDetection           = 4,
+    TTTAttributedLabelTraceEventDataDetectionQueued     = 5,
+    TTTAttributedLabelTraceEventDataDetectionDiscarded  = 6,
+    TTTAttributedLabelTraceEventSizeCacheHit            = 7,
+    TTTAttributedLabelTraceEventSizeCacheMiss           = 8,
+    TTTAttributedLabelTraceEventDataDetectionCacheHit   = 9,
+    TTTAttributedLabelTraceEventDataDetectionCacheMiss  = 10,
+    TTTAttributedLabelTraceEventBitmapCacheHit          = 11,
+    TTTAttributedLabelTraceEventBitmapCacheMiss         = 12,
+};
+
+/**
+ Whether a trace block is called at the beginning or the end of timed work, or for an event that takes no time, such as a cache hit
+ */
+typedef NS_ENUM(NSInteger, TTTAttributedLabelTracePhase) {
+    TTTAttributedLabelTracePhaseBegin   = 0,
+    TTTAttributedLabelTracePhaseEnd     = 1,
+    TTTAttributedLabelTracePhaseInstant = 2,
+};
+
+/**
+ A block called for each traced event. `label` is `nil` for work not done on behalf of a label, such as creating a `TTTAttributedLabelLayout`, and for data detection that runs in the background.
+ */
+typedef void (^TTTAttributedLabelTraceBlock)(TTTAttributedLabelTraceEvent event, TTTAttributedLabelTracePhase phase, TTTAttributedLabel *label);
+
 /**
  Determines whether the text to which this attribute applies has a strikeout drawn through itself.
  */
@@ -70,7 +107,18 @@ extern NSString * const kTTTBackgroundLineWidthAttributeName;
  */
 extern NSString * const kTTTBackgroundCornerRadiusAttributeName;
 
+/**
+ A text checking type for `@mentions`, which `TTTAttributedLabelScanner` finds as `NSTextCheckingTypeLink` results. It is one of the custom types of `NSTextCheckingAllCustomTypes`, so it is not found by `NSDataDetector`.
+ */
+extern const NSTextCheckingTypes TTTTextCheckingTypeMention;
+
+/**
+ A text checking type for `#hashtags`, which `TTTAttributedLabelScanner` finds as `NSTextCheckingTypeLink` results. It is one of the custom types of `NSTextCheckingAllCustomTypes`, so it is not found by `NSDataDetector`.
+ */
+extern const NSTextCheckingTypes TTTTextCheckingTypeHashtag;
+
 @protocol TTTAttributedLabelDelegate;
+@protocol TTTAttributedLabelDataDetector;
 
 // Override UILabel @property to accept both NSString and NSAttributedString
 @protocol TTTAttributedLabel <NSObject>
@@ -91,7 +139,7 @@ IB_DESIGNABLE
  - `lineBreakMode` - This property displays only the first line when the value is `UILineBreakModeHeadTruncation`, `UILineBreakModeTailTruncation`, or `UILineBreakModeMiddleTruncation`
  - `adjustsFontsizeToFitWidth` - Supported in iOS 5 and greater, this property is effective for any value of `numberOfLines` greater than zero. In iOS 4, setting `numberOfLines` to a value greater than 1 with `adjustsFontSizeToFitWidth` set to `YES` may cause `sizeToFit` to execute indefinitely.
  - `baselineAdjustment` - This property has no affect.
- - `textAlignment` - This property does not support justified alignment.
+ - `textAlignment` - Justified alignment is supported, including for lines that show an active link.
  - `NSTextAttachment` - This string attribute is not supported.
  
  Any properties affecting text or paragraph styling, such as `firstLineIndent` will only apply when text is set with an `NSString`. If the text is set with an `NSAttributedString`, these properties will not apply.
@@ -130,10 +178,19 @@ IB_DESIGNABLE
 /**
  A bitmask of `NSTextCheckingType` which are used to automatically detect links in the label text.
 
+ @discussion Detection runs on a shared background queue with limited concurrency. Setting new text cancels detection that has not yet finished for the previous text. Including `TTTTextCheckingTypeMention` or `TTTTextCheckingTypeHashtag` sets `dataDetector` to a `TTTAttributedLabelScanner`, which finds all of the enabled types, rather than to an `NSDataDetector`.
+
  @warning You must specify `enabledTextCheckingTypes` before setting the `text`, with either `setText:` or `setText:afterInheritingLabelAttributesAndConfiguringWithBlock:`.
  */
 @property (nonatomic, assign) NSTextCheckingTypes enabledTextCheckingTypes;
 
+/**
+ The data detector used to find links in the label text. Setting `enabledTextCheckingTypes` sets this property to a shared `NSDataDetector` for those types, or to a `TTTAttributedLabelScanner` if they include mentions or hashtags.
+ 
+ @discussion To use another detector, such as a `TTTAttributedLabelScanner`, set this property after setting `enabledTextCheckingTypes` and before setting the `text`.
+ */
+@property (atomic, strong) id <TTTAttributedLabelDataDetector> dataDetector;
+
 /**
  An array of `NSTextCheckingResult` objects for links detected or manually added to the label text.
  */
@@ -163,8 +220,9 @@ IB_DESIGNABLE
 
 /**
  Indicates if links will be detected within an extended area around the touch
- to emulate the link detection behaviour of WKWebView. 
- Default value is NO. Enabling this may adversely impact performance.
+ to emulate the link detection behaviour of WKWebView. When enabled, a touch that
+ misses every link selects the nearest link within 15 points of it.
+ Default value is NO.
  */
 @property (nonatomic, assign) BOOL extendsLinkTouchArea;
 
@@ -247,12 +305,34 @@ IB_DESIGNABLE
  */
 @property (nonatomic, strong) IBInspectable NSAttributedString *attributedTruncationToken;
 
+///--------------------------
+/// @name Rendering Long Text
+///--------------------------
+
+/**
+ Whether the label draws its text in tiles, only where it is visible, rather than into a single backing store as large as the label. `NO` by default.
+
+ @discussion Enable this for labels much taller than the screen, such as a long article in a scroll view. Each tile spans the width of the label, and draws only the lines, backgrounds and strike-throughs that intersect it. Tiles are drawn on background threads as they scroll into view and released once they leave it, so memory is bounded by the visible area rather than the length of the text. Tiles that have just scrolled into view may be blank until they are drawn. Tiles draw the text as the label last laid it out on the main thread, so changes to the label reach them after its next layout pass.
+ */
+@property (nonatomic, assign, getter=isTiledRenderingEnabled) BOOL tiledRenderingEnabled;
+
+///----------------------------------
+/// @name Caching the Rendered Bitmap
+///----------------------------------
+
+/**
+ Whether the label shares its rendered contents through `sharedBitmapCache` with other labels showing the same text the same way. `NO` by default.
+ 
+ @discussion Enable this for small labels that repeat across many views, such as timestamps, user names, or badge counts. A label whose contents are in the cache shows the cached bitmap in a layer it keeps for its text, without typesetting or drawing its text. The bitmap is updated when the label is next laid out. This has no effect on labels with `tiledRenderingEnabled`.
+ */
+@property (nonatomic, assign, getter=isBitmapCachingEnabled) BOOL bitmapCachingEnabled;
+
 ///--------------------------
 /// @name Long press gestures
 ///--------------------------
 
 /**
- *  The long-press gesture recognizer used internally by the label.
+ *  The long-press gesture recognizer used internally by the label. It is added to the label once the label has links, or when this property is first accessed.
  */
 @property (nonatomic, strong, readonly) UILongPressGestureRecognizer *longPressGestureRecognizer;
 
@@ -273,6 +353,161 @@ IB_DESIGNABLE
                        withConstraints:(CGSize)size
                 limitedToNumberOfLines:(NSUInteger)numberOfLines;
 
+/**
+ Calculate and return the sizes that best fit many attributed strings, given the same constraints on size and number of lines. The strings are measured concurrently, in chunks, on all available cores.
+ 
+ @param attributedStrings An array of `NSAttributedString` objects.
+ @param size The maximum dimensions used to calculate size.
+ @param numberOfLines The maximum number of lines in the text to draw, if the constraining size cannot accomodate the full attributed string.
+ 
+ @return An array of `NSValue` objects containing the `CGSize` that fits each attributed string, in the order of `attributedStrings`.
+ 
+ @discussion This method blocks until all of the strings are measured. Use `calculateSizesThatFitAttributedStrings:withConstraints:limitedToNumberOfLines:completion:` to measure strings without blocking the calling thread.
+ */
++ (NSArray *)sizesThatFitAttributedStrings:(NSArray *)attributedStrings
+                           withConstraints:(CGSize)size
+                    limitedToNumberOfLines:(NSUInteger)numberOfLines;
+
+/**
+ Calculate the sizes that best fit many attributed strings in the background, given the same constraints on size and number of lines, and pass them to a completion block.
+ 
+ @param attributedStrings An array of `NSAttributedString` objects.
+ @param size The maximum dimensions used to calculate size.
+ @param numberOfLines The maximum number of lines in the text to draw, if the constraining size cannot accomodate the full attributed string.
+ @param completion A block called on the main queue with an array of `NSValue` objects containing the `CGSize` that fits each attributed string, in the order of `attributedStrings`, or `nil` if the calculation was cancelled.
+ 
+ @return A progress object whose `completedUnitCount` is the number of strings measured so far. Cancel it to stop measuring strings.
+ */
++ (NSProgress *)calculateSizesThatFitAttributedStrings:(NSArray *)attributedStrings
+                                       withConstraints:(CGSize)size
+                                limitedToNumberOfLines:(NSUInteger)numberOfLines
+                                            completion:(void (^)(NSArray *sizes))completion;
+
+/**
+ Provides a size calculated ahead of time, for example by a server that sends row heights with its content, so that measuring the attributed string with the same constraints returns that size instead of typesetting the string.
+ 
+ @param size The size that fits the attributed string, not including any text insets.
+ @param attributedString The attributed string. Strings set as `NSString` text are measured with the attributes inherited from the label, so precomputed sizes should be provided for the attributed strings that the label creates.
+ @param constraints The maximum dimensions the size was calculated for.
+ @param numberOfLines The maximum number of lines the size was calculated for.
+ 
+ @discussion Precomputed sizes are kept in `sharedSizeCache`, so they are subject to its `countLimit` and are discarded on memory warnings, after which strings are measured again. Labels measure their text as they draw it, so a label with an `attributedTruncationToken`, text colored by its `textColor`, or text scaled down to fit its width does not find sizes provided for its `attributedText`. Use `setPrecomputedSize:withConstraints:` for such labels.
+ */
++ (void)setPrecomputedSize:(CGSize)size
+        forAttributedString:(NSAttributedString *)attributedString
+            withConstraints:(CGSize)constraints
+     limitedToNumberOfLines:(NSUInteger)numberOfLines;
+
+/**
+ Provides a size calculated ahead of time for the label's current text, as the label draws it, so that `sizeThatFits:` with the same constraints returns that size plus the text insets instead of typesetting the text.
+
+ @param size The size that fits the text, not including any text insets.
+ @param constraints The maximum dimensions the size was calculated for, as passed to `sizeThatFits:`.
+
+ @discussion The size is provided for the text as drawn, including any truncation token, and for the label's current `numberOfLines`. It is kept in `sharedSizeCache`, so it is also found by other labels drawing the same text.
+ */
+- (void)setPrecomputedSize:(CGSize)size
+           withConstraints:(CGSize)constraints;
+
+/**
+ Writes the sizes in `sharedSizeCache` and the links in `sharedDataDetectionCache` to a file, so that they can be loaded with `loadCacheArchiveFromFile:error:` after the next launch.
+ 
+ @param path The path of the file to write. Any existing file is replaced atomically.
+ @param error On failure, the error that occurred.
+ 
+ @return `YES` if the file was written.
+ 
+ @discussion Entries are keyed by a hash of their content. Sizes of strings with attributes whose values can not be hashed consistently across launches, and data detection results other than links and phone numbers, are not written.
+ */
++ (BOOL)writeCacheArchiveToFile:(NSString *)path
+                          error:(NSError * __autoreleasing *)error;
+
+/**
+ Maps a file written by `writeCacheArchiveToFile:error:` into memory, so that sizes and links that are not in `sharedSizeCache` or `sharedDataDetectionCache` are looked up in it before they are calculated. Entries are read when they are looked up, rather than when the file is loaded.
+ 
+ @param path The path of the file to load.
+ @param error On failure, the error that occurred. Files that are truncated, have a corrupt header, or were written by a different version of the library or of the operating system fail with `NSFileReadCorruptFileError`.
+ 
+ @return `YES` if the file was loaded, replacing any previously loaded file.
+
+ @discussion Each entry is checked against its own checksum when it is looked up, and corrupt entries are calculated again as if they were not in the file.
+ */
++ (BOOL)loadCacheArchiveFromFile:(NSString *)path
+                           error:(NSError * __autoreleasing *)error;
+
+/**
+ Unmaps the file loaded by `loadCacheArchiveFromFile:error:`, if any, so that sizes and links are no longer looked up in it. Entries already copied into `sharedSizeCache` or `sharedDataDetectionCache` are kept.
+ */
++ (void)unloadCacheArchive;
+
+/**
+ The process-wide cache of sizes calculated by `sizeThatFitsAttributedString:withConstraints:limitedToNumberOfLines:` and `sizeThatFits:`. Entries are keyed by the attributed string, the constraining width, and the number of lines.
+ 
+ @discussion The cache is shared by all labels and is safe to use from any thread. Adjust its `countLimit` to trade memory for hit rate, and inspect its `hitCount` and `missCount` to measure its effectiveness.
+ */
++ (TTTAttributedLabelCache *)sharedSizeCache;
+
+/**
+ The process-wide cache of links found by data detection for `enabledTextCheckingTypes`. Entries are keyed by the string and the text checking types, so labels showing text that was already scanned, such as recycled table view cells, add their links without running a data detector.
+ */
++ (TTTAttributedLabelCache *)sharedDataDetectionCache;
+
+/**
+ The process-wide cache of fonts, and of the text attributes that labels apply to `NSString` text, keyed by font name and size, and by label configuration respectively. Labels configured alike, such as those in table view cells, share these objects instead of creating their own.
+ */
++ (TTTAttributedLabelCache *)sharedStyleCache;
+
+/**
+ The process-wide cache of the rendered contents of labels with `bitmapCachingEnabled`. Entries are keyed by the rendered text, the size and scale of the label, its line break mode, whether it is highlighted, its active link, and its shadows and other drawing settings.
+ 
+ @discussion Each entry costs the size of its bitmap in bytes, and `totalCostLimit`, 8 MB by default, is the byte budget past which the least recently used bitmaps are evicted. Bitmaps larger than the whole budget are drawn but not cached. Inspect `hitCount` and `missCount` to measure its effectiveness.
+ */
++ (TTTAttributedLabelCache *)sharedBitmapCache;
+
+///--------------------------------
+/// @name Instrumenting Performance
+///--------------------------------
+
+/**
+ Whether labels count and time their framesetter and frame creation, size calculations, truncation, data detection and cache lookups. `NO` by default.
+ 
+ @discussion When instrumentation is disabled, each instrumented call site only checks this flag. This property may be set from any thread.
+ */
++ (BOOL)isInstrumentationEnabled;
++ (void)setInstrumentationEnabled:(BOOL)instrumentationEnabled;
+
+/**
+ Sets a block that is called at the beginning and end of each instrumented event while instrumentation is enabled, for example to forward events to a tracer. The block may be called from any thread, and should return quickly.
+ 
+ @param traceBlock The block to call, or `nil` to stop tracing.
+ */
++ (void)setTraceBlock:(TTTAttributedLabelTraceBlock)traceBlock;
+
+/**
+ Returns a snapshot of the events recorded by all labels, and by work not done on behalf of a label, since instrumentation was enabled or the statistics were last reset.
+ */
++ (TTTAttributedLabelStatistics *)globalStatistics;
+
+/**
+ Resets the statistics returned by `globalStatistics`. The statistics of each label are not affected.
+ */
++ (void)resetGlobalStatistics;
+
+/**
+ Returns a snapshot of the events recorded by the label since instrumentation was enabled or its statistics were last reset. Detection discarded before it runs, or once its results reach the main thread, is recorded for the label. Data detection that runs in the background, and results discarded because detection was cancelled while it ran, are only recorded in `globalStatistics`.
+ */
+- (TTTAttributedLabelStatistics *)statistics;
+
+/**
+ Resets the statistics returned by `statistics`.
+ */
+- (void)resetStatistics;
+
+/**
+ Returns an estimate, in bytes, of the character data held by the attributed strings the label keeps for its text, such as the text as set, scaled to fit its width, or as drawn with its truncation token. Strings shared between these are counted once. Attributes, and the copy of the plain text kept by `UILabel`, are not included.
+ */
+- (NSUInteger)textMemoryFootprint;
+
 ///----------------------------------
 /// @name Setting the Text Attributes
 ///----------------------------------
@@ -297,6 +532,33 @@ IB_DESIGNABLE
 - (void)setText:(id)text
 afterInheritingLabelAttributesAndConfiguringWithBlock:(NSMutableAttributedString *(^)(NSMutableAttributedString *mutableAttributedString))block;
 
+/**
+ Appends text to the text displayed by the label.
+
+ @param text An `NSString` or `NSAttributedString` object to append. If the specified text is an `NSString`, it inherits the text styles of the label.
+
+ @discussion This is equivalent to calling `replaceTextInRange:withText:` with an empty range at the end of the text, and is suited to labels that grow in small chunks, such as chat transcripts or logs.
+ */
+- (void)appendText:(id)text;
+
+/**
+ Replaces a range of the text displayed by the label, searching only the paragraphs that changed for links.
+
+ @param range The range of the current text to replace.
+ @param text An `NSString` or `NSAttributedString` object to insert. If the specified text is an `NSString`, it inherits the text styles of the label.
+
+ @discussion Links are kept, and moved by the difference in length, unless they cover replaced text. Links that the label found itself in the changed paragraphs, either from `NSLinkAttributeName` attributes or by `dataDetector`, are replaced by the links found in the new text of those paragraphs. Links added with `addLinkToURL:withRange:` and similar methods are only removed if they cover replaced text. A margin of neighboring text is searched as well, so that links next to the change are found whole. If the label has no text, this is equivalent to calling `setText:`.
+ */
+- (void)replaceTextInRange:(NSRange)range
+                  withText:(id)text;
+
+/**
+ Prepares a label to be reused with new text, for example from `-prepareForReuse` of the table view cell that contains it.
+ 
+ @discussion This clears the text and links, and cancels any pending data detection, but keeps the label's configuration, such as its fonts and link attributes, and its gesture recognizer. The storage of the link hit testing index and of the accessibility elements is cleared and kept, so that the next text does not allocate it again. The layout and framesetter of the previous text are released, since they are specific to it.
+ */
+- (void)prepareForReuse;
+
 ///------------------------------------
 /// @name Accessing the Text Attributes
 ///------------------------------------
@@ -308,6 +570,13 @@ afterInheritingLabelAttributesAndConfiguringWithBlock:(NSMutableAttributedString
  */
 @property (readwrite, nonatomic, copy) NSAttributedString *attributedText;
 
+/**
+ The precomputed layout displayed by the label, or `nil` if the text was not set from a layout.
+
+ @discussion Setting this property sets the label's text, `numberOfLines` and `textInsets` from the layout. While the label's bounds are `width` wide and `size.height` tall, it draws and hit-tests its text with the lines typeset by the layout, rather than typesetting the text again. Setting the text by any other means resets this property to `nil`.
+ */
+@property (nonatomic, strong) TTTAttributedLabelLayout *textLayout;
+
 ///-------------------
 /// @name Adding Links
 ///-------------------
@@ -321,6 +590,13 @@ afterInheritingLabelAttributesAndConfiguringWithBlock:(NSMutableAttributedString
  */
 - (void)addLink:(TTTAttributedLabelLink *)link;
 
+/**
+ Adds all links added within a block at once, styling the text and invalidating its layout a single time. Use this when adding many links to the same label.
+
+ @param updates A block that adds links to the label. Links added within the block are not reported by `links` or matched by touches until the block returns. Calls may be nested; links are added when the outermost block returns.
+ */
+- (void)performBatchLinkUpdates:(void (^)(void))updates;
+
 /**
  Adds a link to an @c NSTextCheckingResult.
  
@@ -679,3 +955,230 @@ typedef void (^TTTAttributedLabelLinkBlock) (TTTAttributedLabel *, TTTAttributed
                          textCheckingResult:(NSTextCheckingResult *)result;
 
 @end
+
+/**
+ `TTTAttributedLabelCache` is a thread-safe key-value store that evicts its least recently used entries once it exceeds its count or cost limit. `TTTAttributedLabel` uses shared instances to reuse expensive results, such as size calculations, across labels.
+ */
+@interface TTTAttributedLabelCache : NSObject
+
+/**
+ The maximum number of entries the cache holds before evicting the least recently used ones. A value of 0 means no limit. The default value is 0.
+ */
+@property (nonatomic, assign) NSUInteger countLimit;
+
+/**
+ The maximum total cost the cache holds before evicting the least recently used entries. A value of 0 means no limit. The default value is 0.
+ */
+@property (nonatomic, assign) NSUInteger totalCostLimit;
+
+/**
+ The number of entries currently in the cache.
+ */
+@property (readonly, nonatomic, assign) NSUInteger count;
+
+/**
+ The sum of the costs of all entries currently in the cache.
+ */
+@property (readonly, nonatomic, assign) NSUInteger totalCost;
+
+/**
+ The number of lookups that found an entry since the cache was created or its statistics were last reset.
+ */
+@property (readonly, nonatomic, assign) NSUInteger hitCount;
+
+/**
+ The number of lookups that did not find an entry since the cache was created or its statistics were last reset.
+ */
+@property (readonly, nonatomic, assign) NSUInteger missCount;
+
+/**
+ Returns the value associated with a given key, marking it as the most recently used entry.
+ 
+ @param key The key for which to return the corresponding value.
+ 
+ @return The value associated with `key`, or `nil` if no value is associated with `key`.
+ */
+- (id)objectForKey:(id)key;
+
+/**
+ Sets the value of the specified key in the cache, with a cost of 0.
+ 
+ @param object The object to be stored in the cache.
+ @param key The key with which to associate the value. The key is copied.
+ */
+- (void)setObject:(id)object
+           forKey:(id <NSCopying>)key;
+
+/**
+ Sets the value of the specified key in the cache, and associates the key-value pair with the specified cost.
+ 
+ @param object The object to be stored in the cache.
+ @param key The key with which to associate the value. The key is copied.
+ @param cost The cost with which to associate the key-value pair.
+ */
+- (void)setObject:(id)object
+           forKey:(id <NSCopying>)key
+             cost:(NSUInteger)cost;
+
+/**
+ Removes the value of the specified key in the cache.
+ 
+ @param key The key identifying the value to be removed.
+ */
+- (void)removeObjectForKey:(id)key;
+
+/**
+ Empties the cache. Hit and miss counts are not affected.
+ */
+- (void)removeAllObjects;
+
+/**
+ Resets `hitCount` and `missCount` to 0.
+ */
+- (void)resetStatistics;
+
+@end
+
+/**
+ The `TTTAttributedLabelDataDetector` protocol is adopted by objects that find links in the text of a `TTTAttributedLabel`. `NSDataDetector` conforms to this protocol.
+ */
+@protocol TTTAttributedLabelDataDetector <NSObject>
+
+/**
+ The types of results the detector finds.
+ */
+@property (readonly) NSTextCheckingTypes checkingTypes;
+
+/**
+ Returns the results found in a range of a string. This method may be called from any thread.
+ 
+ @param string The string to search.
+ @param options The matching options to use.
+ @param range The range of the string to search.
+ 
+ @return An array of `NSTextCheckingResult` objects, ordered by location.
+ */
+- (NSArray *)matchesInString:(NSString *)string
+                     options:(NSMatchingOptions)options
+                       range:(NSRange)range;
+
+@optional
+
+/**
+ A string that distinguishes detectors of the same class and types that find different results, for example because they link matches to different URL schemes. Results are cached separately for each identifier.
+ */
+@property (readonly) NSString *configurationIdentifier;
+
+@end
+
+/**
+ `TTTAttributedLabelScanner` is a lightweight alternative to `NSDataDetector` that finds URLs and email addresses (as `NSTextCheckingTypeLink` results) and phone numbers (as `NSTextCheckingTypePhoneNumber` results) in a single pass over the text. It can also find `@mentions` and `#hashtags`, as `NSTextCheckingTypeLink` results.
+ 
+ @discussion The scanner skips runs of text that contain none of the characters that can start a match, four UTF-16 code units at a time, and only examines the text around a `.`, `@`, `:` or digit, and a `#` when it finds hashtags. It matches URLs with a scheme, hosts with a `www.` prefix or a common top-level domain, email addresses, and phone numbers of 7 to 15 digits. Mentions are an `@` at the start of a word followed by ASCII letters, digits or underscores, and hashtags a `#` at the start of a word followed by letters, digits or underscores, not all of them digits. It does not detect addresses, dates or transit information, and may differ from `NSDataDetector` on ambiguous text.
+ */
+@interface TTTAttributedLabelScanner : NSObject <TTTAttributedLabelDataDetector>
+
+/**
+ The URL scheme of the links found for mentions, which link to `<scheme>:<name>`, without the `@`. `mention` by default.
+ */
+@property (readonly, nonatomic, copy) NSString *mentionURLScheme;
+
+/**
+ The URL scheme of the links found for hashtags, which link to `<scheme>:<tag>`, without the `#` and with any characters not allowed in a URL path percent-encoded. `hashtag` by default.
+ */
+@property (readonly, nonatomic, copy) NSString *hashtagURLScheme;
+
+/**
+ Creates a scanner for the specified types. Types other than `NSTextCheckingTypeLink`, `NSTextCheckingTypePhoneNumber`, `TTTTextCheckingTypeMention` and `TTTTextCheckingTypeHashtag` are ignored.
+ 
+ @param checkingTypes The types of results to find.
+ 
+ @return A scanner for the specified types.
+ */
++ (instancetype)scannerWithTypes:(NSTextCheckingTypes)checkingTypes;
+
+/**
+ Initializes a scanner for the specified types, linking mentions and hashtags to the default URL schemes. Types other than `NSTextCheckingTypeLink`, `NSTextCheckingTypePhoneNumber`, `TTTTextCheckingTypeMention` and `TTTTextCheckingTypeHashtag` are ignored.
+ 
+ @param checkingTypes The types of results to find.
+ */
+- (instancetype)initWithTypes:(NSTextCheckingTypes)checkingTypes;
+
+/**
+ Initializes a scanner for the specified types, linking mentions and hashtags to the specified URL schemes.
+
+ @param checkingTypes The types of results to find.
+ @param mentionURLScheme The URL scheme of the links found for mentions. This must not be `nil`.
+ @param hashtagURLScheme The URL scheme of the links found for hashtags. This must not be `nil`.
+ */
+- (instancetype)initWithTypes:(NSTextCheckingTypes)checkingTypes
+             mentionURLScheme:(NSString *)mentionURLScheme
+             hashtagURLScheme:(NSString *)hashtagURLScheme;
+
+@end
+
+/**
+ `TTTAttributedLabelLayout` is an immutable, precomputed layout of an attributed string for a given width, number of lines and text insets. Layouts can be created on any thread, for example to measure the height of table view cells in the background, and then handed to a label with `textLayout` so that drawing and hit-testing reuse the typeset lines.
+ */
+@interface TTTAttributedLabelLayout : NSObject
+
+/**
+ The attributed string that was laid out.
+ */
+@property (readonly, nonatomic, copy) NSAttributedString *attributedString;
+
+/**
+ The width, including text insets, that the string was laid out in.
+ */
+@property (readonly, nonatomic, assign) CGFloat width;
+
+/**
+ The maximum number of lines that were laid out, or `0` for no limit.
+ */
+@property (readonly, nonatomic, assign) NSUInteger numberOfLines;
+
+/**
+ The insets around the laid out text.
+ */
+@property (readonly, nonatomic, assign) UIEdgeInsets textInsets;
+
+/**
+ The size that fits the laid out text, including text insets. The height is the height a label needs to display the layout.
+ */
+@property (readonly, nonatomic, assign) CGSize size;
+
+/**
+ Initializes a layout of an attributed string. This method may be called from any thread.
+
+ @param attributedString The attributed string to lay out. The string should have the attributes that a label would inherit, such as its font and paragraph style, already applied.
+ @param width The width to lay out the string in, including text insets.
+ @param numberOfLines The maximum number of lines to lay out, or `0` for no limit.
+ @param textInsets The insets around the text.
+ */
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                                   width:(CGFloat)width
+                           numberOfLines:(NSUInteger)numberOfLines
+                              textInsets:(UIEdgeInsets)textInsets;
+
+@end
+
+/**
+ `TTTAttributedLabelStatistics` is an immutable snapshot of the events recorded by labels while instrumentation is enabled.
+ */
+@interface TTTAttributedLabelStatistics : NSObject
+
+/**
+ Returns the number of times an event was recorded.
+ 
+ @param event The event.
+ */
+- (NSUInteger)countForEvent:(TTTAttributedLabelTraceEvent)event;
+
+/**
+ Returns the total time spent in an event, in seconds. Events that take no time, such as cache hits, have a duration of `0`.
+ 
+ @param event The event.
+ */
+- (NSTimeInterval)durationForEvent:(TTTAttributedLabelTraceEvent)event;
+
+@end
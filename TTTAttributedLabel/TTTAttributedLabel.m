@@ -25,10 +25,16 @@
 #import <QuartzCore/QuartzCore.h>
 #import <Availability.h>
 #import <objc/runtime.h>
-
-#define kTTTLineBreakWordWrapTextWidthScalingFactor (M_PI / M_E)
+#import <stdatomic.h>
 
 static CGFloat const TTTFLOAT_MAX = 100000;
+static NSUInteger const TTTFontScaleSearchIterations = 6;
+static NSUInteger const TTTBatchMeasurementChunkSize = 16;
+static NSUInteger const TTTIncrementalDetectionMargin = 64;
+static CGFloat const TTTTiledRenderingTileHeight = 512;
+static NSUInteger const TTTBitmapCacheDefaultTotalCostLimit = 8 * 1024 * 1024;
+
+#define kTTTTraceEventCount (TTTAttributedLabelTraceEventBitmapCacheMiss + 1)
 
 NSString * const kTTTStrikeOutAttributeName = @"TTTStrikeOutAttribute";
 NSString * const kTTTBackgroundFillColorAttributeName = @"TTTBackgroundFillColor";
@@ -37,6 +43,9 @@ NSString * const kTTTBackgroundStrokeColorAttributeName = @"TTTBackgroundStrokeC
 NSString * const kTTTBackgroundLineWidthAttributeName = @"TTTBackgroundLineWidth";
 NSString * const kTTTBackgroundCornerRadiusAttributeName = @"TTTBackgroundCornerRadius";
 
+const NSTextCheckingTypes TTTTextCheckingTypeMention = 1ULL << 32;
+const NSTextCheckingTypes TTTTextCheckingTypeHashtag = 1ULL << 33;
+
 const NSTextAlignment TTTTextAlignmentLeft = NSTextAlignmentLeft;
 const NSTextAlignment TTTTextAlignmentCenter = NSTextAlignmentCenter;
 const NSTextAlignment TTTTextAlignmentRight = NSTextAlignmentRight;
@@ -98,30 +107,34 @@ static inline CGFloat TTTFlushFactorForTextAlignment(NSTextAlignment textAlignme
     }
 }
 
+static id TTTInternedStyleObject(NSArray *components, id (^createObject)(void));
+static inline id TTTFontWithName(NSString *fontName, CGFloat pointSize);
+
 static inline NSDictionary * NSAttributedStringAttributesFromLabel(TTTAttributedLabel *label) {
-    NSMutableDictionary *mutableAttributes = [NSMutableDictionary dictionary];
+    NSLineBreakMode lineBreakMode = label.numberOfLines == 1 ? label.lineBreakMode : NSLineBreakByWordWrapping;
+    NSArray *components = @[@"attributes", label.font, label.textColor, @(label.kern), @(label.textAlignment), @(label.lineSpacing), @(label.minimumLineHeight), @(label.maximumLineHeight), @(label.lineHeightMultiple), @(label.firstLineIndent), @(lineBreakMode)];
 
-    [mutableAttributes setObject:label.font forKey:(NSString *)kCTFontAttributeName];
-    [mutableAttributes setObject:label.textColor forKey:(NSString *)kCTForegroundColorAttributeName];
-    [mutableAttributes setObject:@(label.kern) forKey:(NSString *)kCTKernAttributeName];
+    // Labels configured alike share the same attributes and paragraph style
+    return TTTInternedStyleObject(components, ^id{
+        NSMutableDictionary *mutableAttributes = [NSMutableDictionary dictionary];
 
-    NSMutableParagraphStyle *paragraphStyle = [[NSMutableParagraphStyle alloc] init];
-    paragraphStyle.alignment = label.textAlignment;
-    paragraphStyle.lineSpacing = label.lineSpacing;
-    paragraphStyle.minimumLineHeight = label.minimumLineHeight > 0 ? label.minimumLineHeight : label.font.lineHeight * label.lineHeightMultiple;
-    paragraphStyle.maximumLineHeight = label.maximumLineHeight > 0 ? label.maximumLineHeight : label.font.lineHeight * label.lineHeightMultiple;
-    paragraphStyle.lineHeightMultiple = label.lineHeightMultiple;
-    paragraphStyle.firstLineHeadIndent = label.firstLineIndent;
+        [mutableAttributes setObject:label.font forKey:(NSString *)kCTFontAttributeName];
+        [mutableAttributes setObject:label.textColor forKey:(NSString *)kCTForegroundColorAttributeName];
+        [mutableAttributes setObject:@(label.kern) forKey:(NSString *)kCTKernAttributeName];
 
-    if (label.numberOfLines == 1) {
-        paragraphStyle.lineBreakMode = label.lineBreakMode;
-    } else {
-        paragraphStyle.lineBreakMode = NSLineBreakByWordWrapping;
-    }
+        NSMutableParagraphStyle *paragraphStyle = [[NSMutableParagraphStyle alloc] init];
+        paragraphStyle.alignment = label.textAlignment;
+        paragraphStyle.lineSpacing = label.lineSpacing;
+        paragraphStyle.minimumLineHeight = label.minimumLineHeight > 0 ? label.minimumLineHeight : label.font.lineHeight * label.lineHeightMultiple;
+        paragraphStyle.maximumLineHeight = label.maximumLineHeight > 0 ? label.maximumLineHeight : label.font.lineHeight * label.lineHeightMultiple;
+        paragraphStyle.lineHeightMultiple = label.lineHeightMultiple;
+        paragraphStyle.firstLineHeadIndent = label.firstLineIndent;
+        paragraphStyle.lineBreakMode = lineBreakMode;
 
-    [mutableAttributes setObject:paragraphStyle forKey:(NSString *)kCTParagraphStyleAttributeName];
+        [mutableAttributes setObject:[paragraphStyle copy] forKey:(NSString *)kCTParagraphStyleAttributeName];
 
-    return [NSDictionary dictionaryWithDictionary:mutableAttributes];
+        return [NSDictionary dictionaryWithDictionary:mutableAttributes];
+    });
 }
 
 static inline CGColorRef CGColorRefFromColor(id color);
@@ -144,9 +157,7 @@ static inline NSAttributedString * NSAttributedStringByScalingFontSize(NSAttribu
             }
 
             [mutableAttributedString removeAttribute:(NSString *)kCTFontAttributeName range:range];
-            CTFontRef fontRef = CTFontCreateWithName((__bridge CFStringRef)fontName, CGFloat_floor(pointSize * scale), NULL);
-            [mutableAttributedString addAttribute:(NSString *)kCTFontAttributeName value:(__bridge id)fontRef range:range];
-            CFRelease(fontRef);
+            [mutableAttributedString addAttribute:(NSString *)kCTFontAttributeName value:TTTFontWithName(fontName, MAX(CGFloat_floor(pointSize * scale), 1.0f)) range:range];
         }
     }];
 
@@ -158,16 +169,131 @@ static inline NSAttributedString * NSAttributedStringBySettingColorFromContext(N
         return attributedString;
     }
 
-    NSMutableAttributedString *mutableAttributedString = [attributedString mutableCopy];
-    [mutableAttributedString enumerateAttribute:(NSString *)kCTForegroundColorFromContextAttributeName inRange:NSMakeRange(0, [mutableAttributedString length]) options:0 usingBlock:^(id value, NSRange range, __unused BOOL *stop) {
+    // Only copy the string if some of its text takes its color from the context
+    __block NSMutableAttributedString *mutableAttributedString = nil;
+    [attributedString enumerateAttribute:(NSString *)kCTForegroundColorFromContextAttributeName inRange:NSMakeRange(0, [attributedString length]) options:0 usingBlock:^(id value, NSRange range, __unused BOOL *stop) {
         BOOL usesColorFromContext = (BOOL)value;
         if (usesColorFromContext) {
+            if (!mutableAttributedString) {
+                mutableAttributedString = [attributedString mutableCopy];
+            }
+
             [mutableAttributedString setAttributes:[NSDictionary dictionaryWithObject:color forKey:(NSString *)kCTForegroundColorAttributeName] range:range];
             [mutableAttributedString removeAttribute:(NSString *)kCTForegroundColorFromContextAttributeName range:range];
         }
     }];
 
-    return mutableAttributedString;
+    return mutableAttributedString ?: attributedString;
+}
+
+static inline CGFloat TTTLineHeadIndentAtIndex(NSAttributedString *attributedString, CFIndex idx, CGFloat width, CGFloat *lineWidth) {
+    *lineWidth = width;
+
+    id paragraphStyle = idx < (CFIndex)[attributedString length] ? [attributedString attribute:(NSString *)kCTParagraphStyleAttributeName atIndex:(NSUInteger)idx effectiveRange:NULL] : nil;
+    if (!paragraphStyle) {
+        return 0.0f;
+    }
+
+    BOOL isFirstLineOfParagraph = idx == 0 || [[NSCharacterSet newlineCharacterSet] characterIsMember:[[attributedString string] characterAtIndex:(NSUInteger)(idx - 1)]];
+    CGFloat headIndent = 0.0f;
+    CGFloat tailIndent = 0.0f;
+    if ([paragraphStyle isKindOfClass:[NSParagraphStyle class]]) {
+        headIndent = isFirstLineOfParagraph ? [(NSParagraphStyle *)paragraphStyle firstLineHeadIndent] : [(NSParagraphStyle *)paragraphStyle headIndent];
+        tailIndent = [(NSParagraphStyle *)paragraphStyle tailIndent];
+    } else {
+        CTParagraphStyleGetValueForSpecifier((__bridge CTParagraphStyleRef)paragraphStyle, isFirstLineOfParagraph ? kCTParagraphStyleSpecifierFirstLineHeadIndent : kCTParagraphStyleSpecifierHeadIndent, sizeof(CGFloat), &headIndent);
+        CTParagraphStyleGetValueForSpecifier((__bridge CTParagraphStyleRef)paragraphStyle, kCTParagraphStyleSpecifierTailIndent, sizeof(CGFloat), &tailIndent);
+    }
+
+    // A positive tail indent is measured from the leading margin, any other from the trailing margin
+    *lineWidth = MAX((tailIndent > 0.0f ? tailIndent : width + tailIndent) - headIndent, 0.0f);
+
+    return headIndent;
+}
+
+static inline CTTextAlignment TTTTextAlignmentAtIndex(NSAttributedString *attributedString, CFIndex idx) {
+    id paragraphStyle = idx < (CFIndex)[attributedString length] ? [attributedString attribute:(NSString *)kCTParagraphStyleAttributeName atIndex:(NSUInteger)idx effectiveRange:NULL] : nil;
+    if (!paragraphStyle) {
+        return kCTTextAlignmentNatural;
+    }
+
+    if ([paragraphStyle isKindOfClass:[NSParagraphStyle class]]) {
+        return NSTextAlignmentToCTTextAlignment([(NSParagraphStyle *)paragraphStyle alignment]);
+    }
+
+    CTTextAlignment alignment = kCTTextAlignmentNatural;
+    CTParagraphStyleGetValueForSpecifier((__bridge CTParagraphStyleRef)paragraphStyle, kCTParagraphStyleSpecifierAlignment, sizeof(CTTextAlignment), &alignment);
+
+    return alignment;
+}
+
+static inline CFRange TTTTypesetterSuggestRangeForLines(CTTypesetterRef typesetter, NSAttributedString *attributedString, CFRange textRange, CGFloat width, NSUInteger numberOfLines) {
+    CFIndex location = textRange.location;
+    CFIndex end = textRange.location + textRange.length;
+
+    // Break lines one at a time, so that text past the last line is never typeset
+    for (NSUInteger lineCount = 0; lineCount < numberOfLines && location < end; lineCount++) {
+        // Each line is broken at the width left by the indents of its paragraph, as the framesetter does
+        CGFloat lineWidth = width;
+        CGFloat headIndent = TTTLineHeadIndentAtIndex(attributedString, location, width, &lineWidth);
+        CFIndex lineLength = CTTypesetterSuggestLineBreakWithOffset(typesetter, location, lineWidth, headIndent);
+        if (lineLength <= 0) {
+            break;
+        }
+
+        location += lineLength;
+    }
+
+    return CFRangeMake(textRange.location, MIN(location, end) - textRange.location);
+}
+
+static inline CFRange CTFramesetterGetBoundedTextRange(CTFramesetterRef framesetter, NSAttributedString *attributedString, CFRange textRange, CGFloat width, NSInteger numberOfLines) {
+    // A single line may be truncated at its head or in its middle, which needs the whole line
+    if (!framesetter || numberOfLines <= 1) {
+        return textRange;
+    }
+
+    // One line more than is visible is laid out, so that truncation can tell whether any text follows the last visible line
+    return TTTTypesetterSuggestRangeForLines(CTFramesetterGetTypesetter(framesetter), attributedString, textRange, width, (NSUInteger)numberOfLines + 1);
+}
+
+static inline BOOL TTTAttributedStringFitsWidth(NSAttributedString *attributedString, CGFloat width, NSUInteger numberOfLines) {
+    CTTypesetterRef typesetter = CTTypesetterCreateWithAttributedString((__bridge CFAttributedStringRef)attributedString);
+    if (!typesetter) {
+        return YES;
+    }
+
+    // Lines that do not fit the width, including unbreakable words, are broken and so count against the number of lines
+    CFRange textRange = CFRangeMake(0, (CFIndex)[attributedString length]);
+    CFRange rangeOfLines = TTTTypesetterSuggestRangeForLines(typesetter, attributedString, textRange, width, numberOfLines);
+    CFRelease(typesetter);
+
+    return rangeOfLines.length >= textRange.length;
+}
+
+static CGFloat TTTScaleFactorThatFitsAttributedString(NSAttributedString *attributedString, CGFloat width, NSUInteger numberOfLines, CGFloat minimumScaleFactor) {
+    if (TTTAttributedStringFitsWidth(attributedString, width, numberOfLines)) {
+        return 1.0f;
+    }
+
+    minimumScaleFactor = MAX(MIN(minimumScaleFactor, 1.0f), 0.0f);
+    if (minimumScaleFactor >= 1.0f || !TTTAttributedStringFitsWidth(NSAttributedStringByScalingFontSize(attributedString, minimumScaleFactor), width, numberOfLines)) {
+        return minimumScaleFactor;
+    }
+
+    // Binary search for the largest scale that fits, keeping the lower bound fitting
+    CGFloat lowerScaleFactor = minimumScaleFactor;
+    CGFloat upperScaleFactor = 1.0f;
+    for (NSUInteger iteration = 0; iteration < TTTFontScaleSearchIterations; iteration++) {
+        CGFloat scaleFactor = (lowerScaleFactor + upperScaleFactor) / 2.0f;
+        if (TTTAttributedStringFitsWidth(NSAttributedStringByScalingFontSize(attributedString, scaleFactor), width, numberOfLines)) {
+            lowerScaleFactor = scaleFactor;
+        } else {
+            upperScaleFactor = scaleFactor;
+        }
+    }
+
+    return lowerScaleFactor;
 }
 
 static inline CGSize CTFramesetterSuggestFrameSizeForAttributedStringWithConstraints(CTFramesetterRef framesetter, NSAttributedString *attributedString, CGSize size, NSUInteger numberOfLines) {
@@ -178,22 +304,11 @@ static inline CGSize CTFramesetterSuggestFrameSizeForAttributedStringWithConstra
         // If there is one line, the size that fits is the full width of the line
         constraints = CGSizeMake(TTTFLOAT_MAX, TTTFLOAT_MAX);
     } else if (numberOfLines > 0) {
-        // If the line count of the label more than 1, limit the range to size to the number of lines that have been set
-        CGMutablePathRef path = CGPathCreateMutable();
-        CGPathAddRect(path, NULL, CGRectMake(0.0f, 0.0f, constraints.width, TTTFLOAT_MAX));
-        CTFrameRef frame = CTFramesetterCreateFrame(framesetter, CFRangeMake(0, 0), path, NULL);
-        CFArrayRef lines = CTFrameGetLines(frame);
-
-        if (CFArrayGetCount(lines) > 0) {
-            NSInteger lastVisibleLineIndex = MIN((CFIndex)numberOfLines, CFArrayGetCount(lines)) - 1;
-            CTLineRef lastVisibleLine = CFArrayGetValueAtIndex(lines, lastVisibleLineIndex);
-
-            CFRange rangeToLayout = CTLineGetStringRange(lastVisibleLine);
-            rangeToSize = CFRangeMake(0, rangeToLayout.location + rangeToLayout.length);
+        // If the line count of the label more than 1, limit the range to size to the number of lines that have been set, without typesetting the rest of the text
+        CFRange rangeOfLines = TTTTypesetterSuggestRangeForLines(CTFramesetterGetTypesetter(framesetter), attributedString, rangeToSize, constraints.width, numberOfLines);
+        if (rangeOfLines.length > 0) {
+            rangeToSize = rangeOfLines;
         }
-
-        CFRelease(frame);
-        CGPathRelease(path);
     }
 
     CGSize suggestedSize = CTFramesetterSuggestFrameSizeWithConstraints(framesetter, rangeToSize, NULL, constraints, NULL);
@@ -201,487 +316,541 @@ static inline CGSize CTFramesetterSuggestFrameSizeForAttributedStringWithConstra
     return CGSizeMake(CGFloat_ceil(suggestedSize.width), CGFloat_ceil(suggestedSize.height));
 }
 
-@interface TTTAccessibilityElement : UIAccessibilityElement
-@property (nonatomic, weak) UIView *superview;
-@property (nonatomic, assign) CGRect boundingRect;
-@end
+static inline BOOL TTTAttributesAffectLayout(NSDictionary *attributes) {
+    static NSSet *_layoutNeutralAttributeNames = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _layoutNeutralAttributeNames = [NSSet setWithObjects:(NSString *)kCTForegroundColorAttributeName, NSForegroundColorAttributeName, (NSString *)kCTForegroundColorFromContextAttributeName, (NSString *)kCTUnderlineStyleAttributeName, NSUnderlineStyleAttributeName, (NSString *)kCTUnderlineColorAttributeName, NSUnderlineColorAttributeName, (NSString *)kCTStrokeColorAttributeName, NSStrokeColorAttributeName, NSBackgroundColorAttributeName, kTTTStrikeOutAttributeName, kTTTBackgroundFillColorAttributeName, kTTTBackgroundFillPaddingAttributeName, kTTTBackgroundStrokeColorAttributeName, kTTTBackgroundLineWidthAttributeName, kTTTBackgroundCornerRadiusAttributeName, nil];
+    });
 
-@implementation TTTAccessibilityElement
+    for (NSString *attributeName in attributes) {
+        if (![_layoutNeutralAttributeNames containsObject:attributeName]) {
+            return YES;
+        }
+    }
 
-- (CGRect)accessibilityFrame {
-    return UIAccessibilityConvertFrameToScreenCoordinates(self.boundingRect, self.superview);
+    return NO;
 }
 
-@end
+typedef struct {
+    NSUInteger counts[kTTTTraceEventCount];
+    CFTimeInterval durations[kTTTTraceEventCount];
+} TTTAttributedLabelCounters;
 
-@interface TTTAttributedLabel ()
-@property (readwrite, nonatomic, copy) NSAttributedString *inactiveAttributedText;
-@property (readwrite, nonatomic, copy) NSAttributedString *renderedAttributedText;
-@property (readwrite, atomic, strong) NSDataDetector *dataDetector;
-@property (readwrite, nonatomic, strong) NSArray *linkModels;
-@property (readwrite, nonatomic, strong) TTTAttributedLabelLink *activeLink;
-@property (readwrite, nonatomic, strong) NSArray *accessibilityElements;
+static volatile BOOL _instrumentationEnabled = NO;
+static TTTAttributedLabelCounters _globalCounters;
+static TTTAttributedLabelTraceBlock _traceBlock = nil;
 
-- (void) longPressGestureDidFire:(UILongPressGestureRecognizer *)sender;
+@interface TTTAttributedLabel (TTTAttributedLabelInstrumentation)
+- (TTTAttributedLabelCounters *)instrumentationCounters;
 @end
 
-@implementation TTTAttributedLabel {
-@private
-    BOOL _needsFramesetter;
-    CTFramesetterRef _framesetter;
-    CTFramesetterRef _highlightFramesetter;
-}
-
-@dynamic text;
-@synthesize attributedText = _attributedText;
+@interface TTTAttributedLabelStatistics ()
+- (instancetype)initWithCounters:(TTTAttributedLabelCounters)counters;
+@end
 
-#ifndef kCFCoreFoundationVersionNumber_iOS_7_0
-#define kCFCoreFoundationVersionNumber_iOS_7_0 847.2
-#endif
+// Statistics and the trace block are guarded by the statistics class, and are only touched while instrumentation is enabled
+static CFTimeInterval TTTInstrumentationRecordEvent(TTTAttributedLabelTraceEvent event, TTTAttributedLabelTracePhase phase, TTTAttributedLabel *label, CFTimeInterval beginTime) {
+    CFTimeInterval time = CACurrentMediaTime();
+    TTTAttributedLabelTraceBlock traceBlock = nil;
+
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        if (phase != TTTAttributedLabelTracePhaseBegin) {
+            CFTimeInterval duration = (phase == TTTAttributedLabelTracePhaseEnd) ? time - beginTime : 0;
+            _globalCounters.counts[event]++;
+            _globalCounters.durations[event] += duration;
+
+            TTTAttributedLabelCounters *counters = [label instrumentationCounters];
+            if (counters) {
+                counters->counts[event]++;
+                counters->durations[event] += duration;
+            }
+        }
 
-+ (void)load {
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        if (kCFCoreFoundationVersionNumber < kCFCoreFoundationVersionNumber_iOS_7_0) {
-            Class class = [self class];
-            Class superclass = class_getSuperclass(class);
+        traceBlock = _traceBlock;
+    }
 
-            NSArray *strings = @[
-                                 NSStringFromSelector(@selector(isAccessibilityElement)),
-                                 NSStringFromSelector(@selector(accessibilityElementCount)),
-                                 NSStringFromSelector(@selector(accessibilityElementAtIndex:)),
-                                 NSStringFromSelector(@selector(indexOfAccessibilityElement:)),
-                                 ];
+    if (traceBlock) {
+        traceBlock(event, phase, label);
+    }
 
-            for (NSString *string in strings) {
-                SEL selector = NSSelectorFromString(string);
-                IMP superImplementation = class_getMethodImplementation(superclass, selector);
-                Method method = class_getInstanceMethod(class, selector);
-                const char *types = method_getTypeEncoding(method);
-                class_replaceMethod(class, selector, superImplementation, types);
-            }
-        }
-    });
+    // Exclude the time spent in the trace block from the duration of the event
+    return (phase == TTTAttributedLabelTracePhaseBegin && traceBlock) ? CACurrentMediaTime() : time;
 }
 
-- (instancetype)initWithFrame:(CGRect)frame {
-    self = [super initWithFrame:frame];
-    if (!self) {
-        return nil;
+static inline CFTimeInterval TTTInstrumentationBegin(TTTAttributedLabelTraceEvent event, TTTAttributedLabel *label) {
+    if (!_instrumentationEnabled) {
+        return 0;
     }
 
-    [self commonInit];
+    return TTTInstrumentationRecordEvent(event, TTTAttributedLabelTracePhaseBegin, label, 0);
+}
 
-    return self;
+static inline void TTTInstrumentationEnd(TTTAttributedLabelTraceEvent event, TTTAttributedLabel *label, CFTimeInterval beginTime) {
+    if (!_instrumentationEnabled || beginTime == 0) {
+        return;
+    }
+
+    TTTInstrumentationRecordEvent(event, TTTAttributedLabelTracePhaseEnd, label, beginTime);
 }
 
-- (void)commonInit {
-    self.userInteractionEnabled = YES;
-#if !TARGET_OS_TV
-    self.multipleTouchEnabled = NO;
-#endif
+static inline void TTTInstrumentationMark(TTTAttributedLabelTraceEvent event, TTTAttributedLabel *label) {
+    if (!_instrumentationEnabled) {
+        return;
+    }
 
-    self.textInsets = UIEdgeInsetsZero;
-    self.lineHeightMultiple = 1.0f;
+    TTTInstrumentationRecordEvent(event, TTTAttributedLabelTracePhaseInstant, label, 0);
+}
 
-    self.linkModels = [NSArray array];
+@interface TTTAttributedLabel (TTTAccessibilityElement)
+- (NSArray *)accessibilityRectsForLink:(TTTAttributedLabelLink *)link;
+@end
 
-    self.linkBackgroundEdgeInset = UIEdgeInsetsMake(0.0f, -1.0f, 0.0f, -1.0f);
+@interface TTTAccessibilityElement : UIAccessibilityElement
+@property (nonatomic, weak) UIView *superview;
+@property (nonatomic, assign) CGRect boundingRect;
+@property (nonatomic, strong) TTTAttributedLabelLink *link;
+@end
 
-    NSMutableDictionary *mutableLinkAttributes = [NSMutableDictionary dictionary];
-    [mutableLinkAttributes setObject:[NSNumber numberWithBool:YES] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+@implementation TTTAccessibilityElement
 
-    NSMutableDictionary *mutableActiveLinkAttributes = [NSMutableDictionary dictionary];
-    [mutableActiveLinkAttributes setObject:[NSNumber numberWithBool:NO] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+- (NSArray *)linkRects {
+    return [(TTTAttributedLabel *)self.superview accessibilityRectsForLink:self.link];
+}
 
-    NSMutableDictionary *mutableInactiveLinkAttributes = [NSMutableDictionary dictionary];
-    [mutableInactiveLinkAttributes setObject:[NSNumber numberWithBool:NO] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+- (BOOL)isAccessibilityElement {
+    // Links that are not laid out, such as those past the last visible line, have nothing to show
+    return !self.link || [[self linkRects] count] > 0;
+}
 
-    if ([NSMutableParagraphStyle class]) {
-        [mutableLinkAttributes setObject:[UIColor blueColor] forKey:(NSString *)kCTForegroundColorAttributeName];
-        [mutableActiveLinkAttributes setObject:[UIColor redColor] forKey:(NSString *)kCTForegroundColorAttributeName];
-        [mutableInactiveLinkAttributes setObject:[UIColor grayColor] forKey:(NSString *)kCTForegroundColorAttributeName];
-    } else {
-        [mutableLinkAttributes setObject:(__bridge id)[[UIColor blueColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
-        [mutableActiveLinkAttributes setObject:(__bridge id)[[UIColor redColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
-        [mutableInactiveLinkAttributes setObject:(__bridge id)[[UIColor grayColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+- (CGRect)accessibilityFrame {
+    if (!self.link) {
+        return UIAccessibilityConvertFrameToScreenCoordinates(self.boundingRect, self.superview);
     }
 
-    self.linkAttributes = [NSDictionary dictionaryWithDictionary:mutableLinkAttributes];
-    self.activeLinkAttributes = [NSDictionary dictionaryWithDictionary:mutableActiveLinkAttributes];
-    self.inactiveLinkAttributes = [NSDictionary dictionaryWithDictionary:mutableInactiveLinkAttributes];
-    _extendsLinkTouchArea = NO;
-    _longPressGestureRecognizer = [[UILongPressGestureRecognizer alloc] initWithTarget:self
-                                                                                action:@selector(longPressGestureDidFire:)];
-    self.longPressGestureRecognizer.delegate = self;
-    [self addGestureRecognizer:self.longPressGestureRecognizer];
+    CGRect boundingRect = CGRectNull;
+    for (NSValue *rectValue in [self linkRects]) {
+        boundingRect = CGRectUnion(boundingRect, [rectValue CGRectValue]);
+    }
+
+    return CGRectIsNull(boundingRect) ? CGRectZero : UIAccessibilityConvertFrameToScreenCoordinates(boundingRect, self.superview);
 }
 
-- (void)dealloc {
-    if (_framesetter) {
-        CFRelease(_framesetter);
+- (UIBezierPath *)accessibilityPath {
+    NSArray *linkRects = self.link ? [self linkRects] : nil;
+    if ([linkRects count] < 2) {
+        return [super accessibilityPath];
     }
 
-    if (_highlightFramesetter) {
-        CFRelease(_highlightFramesetter);
-    }
-    
-    if (_longPressGestureRecognizer) {
-        [self removeGestureRecognizer:_longPressGestureRecognizer];
+    // Links that wrap across lines are outlined one line at a time
+    UIBezierPath *path = [UIBezierPath bezierPath];
+    for (NSValue *rectValue in linkRects) {
+        [path appendPath:[UIBezierPath bezierPathWithRect:[rectValue CGRectValue]]];
     }
+
+    return UIAccessibilityConvertPathToScreenCoordinates(path, self.superview);
 }
 
-#pragma mark -
+@end
 
-+ (CGSize)sizeThatFitsAttributedString:(NSAttributedString *)attributedString
-                       withConstraints:(CGSize)size
-                limitedToNumberOfLines:(NSUInteger)numberOfLines
-{
-    if (!attributedString || attributedString.length == 0) {
-        return CGSizeZero;
+typedef struct {
+    CGPoint origin;
+    CGFloat ascent;
+    CGFloat descent;
+    CGFloat leading;
+    CGFloat width;
+    CGFloat penOffset;
+} TTTAttributedLabelLineMetrics;
+
+typedef struct {
+    CGPathRef path;
+    CGColorRef fillColor;
+    CGColorRef strokeColor;
+    BOOL strikeOut;
+} TTTAttributedLabelDecoration;
+
+static void TTTAttributedLabelDecorationsAddPath(TTTAttributedLabelDecoration **decorations, NSUInteger *count, NSUInteger *capacity, CGPathRef path, CGColorRef fillColor, CGColorRef strokeColor, BOOL strikeOut) {
+    // Decorations of the same kind and colors are batched into a single path
+    for (NSUInteger idx = 0; idx < *count; idx++) {
+        TTTAttributedLabelDecoration *decoration = &(*decorations)[idx];
+        if (decoration->strikeOut == strikeOut && (decoration->fillColor == fillColor || (decoration->fillColor && fillColor && CGColorEqualToColor(decoration->fillColor, fillColor))) && (decoration->strokeColor == strokeColor || (decoration->strokeColor && strokeColor && CGColorEqualToColor(decoration->strokeColor, strokeColor)))) {
+            CGPathAddPath((CGMutablePathRef)decoration->path, NULL, path);
+            return;
+        }
+    }
+
+    if (*count == *capacity) {
+        *capacity = MAX(*capacity * 2, (NSUInteger)4);
+        *decorations = realloc(*decorations, *capacity * sizeof(TTTAttributedLabelDecoration));
     }
 
-    CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)attributedString);
+    CGMutablePathRef mutablePath = CGPathCreateMutable();
+    CGPathAddPath(mutablePath, NULL, path);
 
-    CGSize calculatedSize = CTFramesetterSuggestFrameSizeForAttributedStringWithConstraints(framesetter, attributedString, size, numberOfLines);
+    (*decorations)[*count] = (TTTAttributedLabelDecoration){ mutablePath, CGColorRetain(fillColor), CGColorRetain(strokeColor), strikeOut };
+    (*count)++;
+}
 
-    CFRelease(framesetter);
+/**
+ An immutable snapshot of the lines typeset for a label's text in a given rect, along with their origins, typographic bounds and pen offsets.
+ */
+@interface TTTAttributedLabelFrame : NSObject
+@property (readonly, nonatomic, assign) CTFrameRef frame;
+@property (readonly, nonatomic, assign) CGRect bounds;
+@property (readonly, nonatomic, assign) CGRect textRect;
+@property (readonly, nonatomic, assign) NSInteger numberOfLines;
+@property (readonly, nonatomic, assign) CFIndex lineCount;
+@property (readonly, nonatomic, assign) CFIndex visibleLineCount;
+@property (nonatomic, assign) CTLineRef truncatedLine;
+@property (nonatomic, assign) CGFloat truncatedLinePenOffset;
+@property (nonatomic, assign) NSRange truncationTokenLinkRange;
+
+- (instancetype)initWithFramesetter:(CTFramesetterRef)framesetter
+                          textRange:(CFRange)textRange
+                             bounds:(CGRect)bounds
+                           textRect:(CGRect)textRect
+                      numberOfLines:(NSInteger)numberOfLines
+                        flushFactor:(CGFloat)flushFactor;
+
+- (instancetype)initWithCTFrame:(CTFrameRef)frame
+                         bounds:(CGRect)bounds
+                       textRect:(CGRect)textRect
+                  numberOfLines:(NSInteger)numberOfLines
+                    flushFactor:(CGFloat)flushFactor;
+
+- (TTTAttributedLabelFrame *)frameByAddingAttributes:(NSDictionary *)attributes
+                                               range:(NSRange)range
+                                  ofAttributedString:(NSAttributedString *)attributedString;
+
+- (const TTTAttributedLabelDecoration *)decorationsWithBackgroundEdgeInset:(UIEdgeInsets)backgroundEdgeInset
+                                                                    count:(NSUInteger *)count;
+
+- (CTLineRef)lineAtIndex:(CFIndex)lineIndex;
+- (TTTAttributedLabelLineMetrics)metricsForLineAtIndex:(CFIndex)lineIndex;
+- (CFRange)visibleLineRangeIntersectingRect:(CGRect)rect;
+- (CFIndex)characterIndexAtPoint:(CGPoint)p;
+@end
 
-    return calculatedSize;
+@implementation TTTAttributedLabelFrame {
+@private
+    CFArrayRef _lines;
+    TTTAttributedLabelLineMetrics *_lineMetrics;
+    TTTAttributedLabelDecoration *_decorations;
+    NSUInteger _decorationCount;
+    BOOL _hasDecorations;
+    UIEdgeInsets _decorationBackgroundEdgeInset;
 }
 
-#pragma mark -
+- (instancetype)initWithFramesetter:(CTFramesetterRef)framesetter
+                          textRange:(CFRange)textRange
+                             bounds:(CGRect)bounds
+                           textRect:(CGRect)textRect
+                      numberOfLines:(NSInteger)numberOfLines
+                        flushFactor:(CGFloat)flushFactor
+{
+    if (!framesetter) {
+        return nil;
+    }
 
-- (void)setAttributedText:(NSAttributedString *)text {
-    if ([text isEqualToAttributedString:_attributedText]) {
-        return;
+    CGMutablePathRef path = CGPathCreateMutable();
+    CGPathAddRect(path, NULL, textRect);
+    CTFrameRef frame = CTFramesetterCreateFrame(framesetter, textRange, path, NULL);
+    CGPathRelease(path);
+
+    if (!frame) {
+        return nil;
     }
 
-    _attributedText = [text copy];
+    self = [self initWithCTFrame:frame bounds:bounds textRect:textRect numberOfLines:numberOfLines flushFactor:flushFactor];
+    CFRelease(frame);
 
-    [self setNeedsFramesetter];
-    [self setNeedsDisplay];
+    return self;
+}
 
-    if ([self respondsToSelector:@selector(invalidateIntrinsicContentSize)]) {
-        [self invalidateIntrinsicContentSize];
+- (instancetype)initWithCTFrame:(CTFrameRef)frame
+                         bounds:(CGRect)bounds
+                       textRect:(CGRect)textRect
+                  numberOfLines:(NSInteger)numberOfLines
+                    flushFactor:(CGFloat)flushFactor
+{
+    self = [super init];
+    if (!self) {
+        return nil;
     }
 
-    [super setText:[self.attributedText string]];
-}
+    _frame = CFRetain(frame);
+    _bounds = bounds;
+    _textRect = textRect;
+    _numberOfLines = numberOfLines;
 
-- (NSAttributedString *)renderedAttributedText {
-    if (!_renderedAttributedText) {
-        NSMutableAttributedString *fullString = [[NSMutableAttributedString alloc] initWithAttributedString:self.attributedText];
-        
-        if (self.attributedTruncationToken) {
-            [fullString appendAttributedString:self.attributedTruncationToken];
+    _lines = CFRetain(CTFrameGetLines(_frame));
+    _lineCount = CFArrayGetCount(_lines);
+    _visibleLineCount = numberOfLines > 0 ? MIN(numberOfLines, _lineCount) : _lineCount;
+
+    if (_lineCount > 0) {
+        _lineMetrics = calloc((size_t)_lineCount, sizeof(TTTAttributedLabelLineMetrics));
+
+        CGPoint lineOrigins[_lineCount];
+        CTFrameGetLineOrigins(_frame, CFRangeMake(0, 0), lineOrigins);
+
+        for (CFIndex lineIndex = 0; lineIndex < _lineCount; lineIndex++) {
+            CTLineRef line = CFArrayGetValueAtIndex(_lines, lineIndex);
+            TTTAttributedLabelLineMetrics *metrics = &_lineMetrics[lineIndex];
+
+            metrics->origin = lineOrigins[lineIndex];
+            metrics->width = (CGFloat)CTLineGetTypographicBounds(line, &metrics->ascent, &metrics->descent, &metrics->leading);
+            metrics->penOffset = (CGFloat)CTLineGetPenOffsetForFlush(line, flushFactor, textRect.size.width);
         }
-        
-        NSAttributedString *string = [[NSAttributedString alloc] initWithAttributedString:fullString];
-        self.renderedAttributedText = NSAttributedStringBySettingColorFromContext(string, self.textColor);
     }
 
-    return _renderedAttributedText;
+    return self;
 }
 
-- (NSArray *) links {
-    return [_linkModels valueForKey:@"result"];
-}
+- (TTTAttributedLabelFrame *)frameByAddingAttributes:(NSDictionary *)attributes
+                                               range:(NSRange)range
+                                  ofAttributedString:(NSAttributedString *)attributedString
+{
+    CFMutableArrayRef lines = NULL;
+    CTTypesetterRef typesetter = NULL;
+
+    // Only the lines containing the range are typeset again
+    for (CFIndex lineIndex = 0; lineIndex < _visibleLineCount; lineIndex++) {
+        CFRange lineRange = CTLineGetStringRange([self lineAtIndex:lineIndex]);
+        NSRange lineStringRange = NSMakeRange((NSUInteger)lineRange.location, (NSUInteger)lineRange.length);
+        NSRange intersection = NSIntersectionRange(lineStringRange, range);
+        if (intersection.length == 0 || NSMaxRange(lineStringRange) > [attributedString length]) {
+            continue;
+        }
 
-- (void)setLinkModels:(NSArray *)linkModels {
-    _linkModels = linkModels;
-    
-    self.accessibilityElements = nil;
-}
+        if (!lines) {
+            lines = CFArrayCreateMutableCopy(kCFAllocatorDefault, _lineCount, _lines);
 
-- (void)setNeedsFramesetter {
-    // Reset the rendered attributed text so it has a chance to regenerate
-    self.renderedAttributedText = nil;
+            // Lines are typeset from the whole text, so that they keep their string ranges and the bidi context of their paragraph
+            NSMutableAttributedString *mutableAttributedString = [attributedString mutableCopy];
+            [mutableAttributedString addAttributes:attributes range:NSIntersectionRange(range, NSMakeRange(0, [attributedString length]))];
+            typesetter = CTTypesetterCreateWithAttributedString((__bridge CFAttributedStringRef)mutableAttributedString);
+        }
 
-    _needsFramesetter = YES;
-}
+        CTLineRef line = CTTypesetterCreateLine(typesetter, lineRange);
 
-- (CTFramesetterRef)framesetter {
-    if (_needsFramesetter) {
-        @synchronized(self) {
-            CTFramesetterRef framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)self.renderedAttributedText);
-            [self setFramesetter:framesetter];
-            [self setHighlightFramesetter:nil];
-            _needsFramesetter = NO;
-
-            if (framesetter) {
-                CFRelease(framesetter);
+        // Justified lines are stretched again to the width they were laid out at
+        CGFloat width = (CGFloat)CTLineGetTypographicBounds(line, NULL, NULL, NULL);
+        if (TTTTextAlignmentAtIndex(attributedString, lineRange.location) == kCTTextAlignmentJustified && _lineMetrics[lineIndex].width - width > 0.5f) {
+            CTLineRef justifiedLine = CTLineCreateJustifiedLine(line, 1.0f, _lineMetrics[lineIndex].width);
+            if (justifiedLine) {
+                CFRelease(line);
+                line = justifiedLine;
             }
         }
-    }
 
-    return _framesetter;
-}
+        CFArraySetValueAtIndex(lines, lineIndex, line);
+        CFRelease(line);
+    }
 
-- (void)setFramesetter:(CTFramesetterRef)framesetter {
-    if (framesetter) {
-        CFRetain(framesetter);
+    if (typesetter) {
+        CFRelease(typesetter);
     }
 
-    if (_framesetter) {
-        CFRelease(_framesetter);
+    if (!lines) {
+        return self;
     }
 
-    _framesetter = framesetter;
-}
+    TTTAttributedLabelFrame *textFrame = [[TTTAttributedLabelFrame alloc] init];
+    textFrame->_frame = CFRetain(_frame);
+    textFrame->_bounds = _bounds;
+    textFrame->_textRect = _textRect;
+    textFrame->_numberOfLines = _numberOfLines;
+    textFrame->_lineCount = _lineCount;
+    textFrame->_visibleLineCount = _visibleLineCount;
+    textFrame->_lines = lines;
+
+    // Attributes that do not affect layout leave the line metrics unchanged
+    if (_lineCount > 0) {
+        textFrame->_lineMetrics = calloc((size_t)_lineCount, sizeof(TTTAttributedLabelLineMetrics));
+        memcpy(textFrame->_lineMetrics, _lineMetrics, (size_t)_lineCount * sizeof(TTTAttributedLabelLineMetrics));
+    }
 
-- (CTFramesetterRef)highlightFramesetter {
-    return _highlightFramesetter;
+    return textFrame;
 }
 
-- (void)setHighlightFramesetter:(CTFramesetterRef)highlightFramesetter {
-    if (highlightFramesetter) {
-        CFRetain(highlightFramesetter);
+- (void)setTruncatedLine:(CTLineRef)truncatedLine {
+    if (truncatedLine) {
+        CFRetain(truncatedLine);
     }
 
-    if (_highlightFramesetter) {
-        CFRelease(_highlightFramesetter);
+    if (_truncatedLine) {
+        CFRelease(_truncatedLine);
     }
 
-    _highlightFramesetter = highlightFramesetter;
+    _truncatedLine = truncatedLine;
 }
 
-#pragma mark -
-
-- (void)setEnabledTextCheckingTypes:(NSTextCheckingTypes)enabledTextCheckingTypes {
-    if (self.enabledTextCheckingTypes == enabledTextCheckingTypes) {
-        return;
+- (void)removeDecorations {
+    for (NSUInteger idx = 0; idx < _decorationCount; idx++) {
+        CGPathRelease(_decorations[idx].path);
+        CGColorRelease(_decorations[idx].fillColor);
+        CGColorRelease(_decorations[idx].strokeColor);
     }
-    
-    _enabledTextCheckingTypes = enabledTextCheckingTypes;
-
-    // one detector instance per type (combination), fast reuse e.g. in cells
-    static NSMutableDictionary *dataDetectorsByType = nil;
 
-    if (!dataDetectorsByType) {
-        dataDetectorsByType = [NSMutableDictionary dictionary];
-    }
-    
-    if (enabledTextCheckingTypes) {
-        if (![dataDetectorsByType objectForKey:@(enabledTextCheckingTypes)]) {
-            NSDataDetector *detector = [NSDataDetector dataDetectorWithTypes:enabledTextCheckingTypes
-                                                                       error:nil];
-            if (detector) {
-                [dataDetectorsByType setObject:detector forKey:@(enabledTextCheckingTypes)];
-            }
-        }
-        self.dataDetector = [dataDetectorsByType objectForKey:@(enabledTextCheckingTypes)];
-    } else {
-        self.dataDetector = nil;
-    }
+    free(_decorations);
+    _decorations = NULL;
+    _decorationCount = 0;
 }
 
-- (void)addLink:(TTTAttributedLabelLink *)link {
-    [self addLinks:@[link]];
-}
+- (const TTTAttributedLabelDecoration *)decorationsWithBackgroundEdgeInset:(UIEdgeInsets)backgroundEdgeInset
+                                                                    count:(NSUInteger *)count
+{
+    if (_hasDecorations && UIEdgeInsetsEqualToEdgeInsets(backgroundEdgeInset, _decorationBackgroundEdgeInset)) {
+        *count = _decorationCount;
+        return _decorations;
+    }
 
-- (void)addLinks:(NSArray *)links {
-    NSMutableArray *mutableLinkModels = [NSMutableArray arrayWithArray:self.linkModels];
-    
-    NSMutableAttributedString *mutableAttributedString = [self.attributedText mutableCopy];
+    [self removeDecorations];
 
-    for (TTTAttributedLabelLink *link in links) {
-        if (link.attributes) {
-            [mutableAttributedString addAttributes:link.attributes range:link.result.range];
-        }
-    }
+    NSUInteger capacity = 0;
+    for (CFIndex lineIndex = 0; lineIndex < _visibleLineCount; lineIndex++) {
+        CTLineRef line = [self lineAtIndex:lineIndex];
+        TTTAttributedLabelLineMetrics metrics = _lineMetrics[lineIndex];
 
-    self.attributedText = mutableAttributedString;
-    [self setNeedsDisplay];
-
-    [mutableLinkModels addObjectsFromArray:links];
-    
-    self.linkModels = [NSArray arrayWithArray:mutableLinkModels];
-}
-
-- (TTTAttributedLabelLink *)addLinkWithTextCheckingResult:(NSTextCheckingResult *)result
-                                               attributes:(NSDictionary *)attributes
-{
-    return [self addLinksWithTextCheckingResults:@[result] attributes:attributes].firstObject;
-}
+        for (id glyphRun in (__bridge NSArray *)CTLineGetGlyphRuns(line)) {
+            NSDictionary *attributes = (__bridge NSDictionary *)CTRunGetAttributes((__bridge CTRunRef)glyphRun);
+            CGColorRef strokeColor = CGColorRefFromColor([attributes objectForKey:kTTTBackgroundStrokeColorAttributeName]);
+            CGColorRef fillColor = CGColorRefFromColor([attributes objectForKey:kTTTBackgroundFillColorAttributeName]);
+            BOOL strikeOut = [[attributes objectForKey:kTTTStrikeOutAttributeName] boolValue];
 
-- (NSArray *)addLinksWithTextCheckingResults:(NSArray *)results
-                                  attributes:(NSDictionary *)attributes
-{
-    NSMutableArray *links = [NSMutableArray array];
-    
-    for (NSTextCheckingResult *result in results) {
-        NSDictionary *activeAttributes = attributes ? self.activeLinkAttributes : nil;
-        NSDictionary *inactiveAttributes = attributes ? self.inactiveLinkAttributes : nil;
-        
-        TTTAttributedLabelLink *link = [[TTTAttributedLabelLink alloc] initWithAttributes:attributes
-                                                                         activeAttributes:activeAttributes
-                                                                       inactiveAttributes:inactiveAttributes
-                                                                       textCheckingResult:result];
-        
-        [links addObject:link];
-    }
-    
-    [self addLinks:links];
-    
-    return links;
-}
+            if (!strokeColor && !fillColor && !strikeOut) {
+                continue;
+            }
 
-- (TTTAttributedLabelLink *)addLinkWithTextCheckingResult:(NSTextCheckingResult *)result {
-    return [self addLinkWithTextCheckingResult:result attributes:self.linkAttributes];
-}
+            CGFloat runAscent = 0.0f;
+            CGFloat runDescent = 0.0f;
+            CGFloat runWidth = (CGFloat)CTRunGetTypographicBounds((__bridge CTRunRef)glyphRun, CFRangeMake(0, 0), &runAscent, &runDescent, NULL);
+
+            CGFloat xOffset = 0.0f;
+            CFRange glyphRange = CTRunGetStringRange((__bridge CTRunRef)glyphRun);
+            switch (CTRunGetStatus((__bridge CTRunRef)glyphRun)) {
+                case kCTRunStatusRightToLeft:
+                    xOffset = CTLineGetOffsetForStringIndex(line, glyphRange.location + glyphRange.length, NULL);
+                    break;
+                default:
+                    xOffset = CTLineGetOffsetForStringIndex(line, glyphRange.location, NULL);
+                    break;
+            }
 
-- (TTTAttributedLabelLink *)addLinkToURL:(NSURL *)url
-                               withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult linkCheckingResultWithRange:range URL:url]];
-}
+            if (strokeColor || fillColor) {
+                UIEdgeInsets fillPadding = [[attributes objectForKey:kTTTBackgroundFillPaddingAttributeName] UIEdgeInsetsValue];
+                CGFloat cornerRadius = [[attributes objectForKey:kTTTBackgroundCornerRadiusAttributeName] floatValue];
+                CGFloat lineWidth = [[attributes objectForKey:kTTTBackgroundLineWidthAttributeName] floatValue];
 
-- (TTTAttributedLabelLink *)addLinkToAddress:(NSDictionary *)addressComponents
-                                   withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult addressCheckingResultWithRange:range components:addressComponents]];
-}
+                CGRect runBounds = CGRectMake(metrics.origin.x + xOffset - fillPadding.left, metrics.origin.y - fillPadding.bottom - runDescent, runWidth + fillPadding.left + fillPadding.right, runAscent + runDescent + fillPadding.top + fillPadding.bottom);
 
-- (TTTAttributedLabelLink *)addLinkToPhoneNumber:(NSString *)phoneNumber
-                                       withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult phoneNumberCheckingResultWithRange:range phoneNumber:phoneNumber]];
-}
+                // Don't draw higlightedLinkBackground too far to the right
+                if (CGRectGetWidth(runBounds) > metrics.width) {
+                    runBounds.size.width = metrics.width;
+                }
 
-- (TTTAttributedLabelLink *)addLinkToDate:(NSDate *)date
-            withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult dateCheckingResultWithRange:range date:date]];
-}
+                CGPathRef path = [[UIBezierPath bezierPathWithRoundedRect:CGRectInset(UIEdgeInsetsInsetRect(runBounds, backgroundEdgeInset), lineWidth, lineWidth) cornerRadius:cornerRadius] CGPath];
+                TTTAttributedLabelDecorationsAddPath(&_decorations, &_decorationCount, &capacity, path, fillColor, strokeColor, NO);
+            }
 
-- (TTTAttributedLabelLink *)addLinkToDate:(NSDate *)date
-                                 timeZone:(NSTimeZone *)timeZone
-                                 duration:(NSTimeInterval)duration
-                                withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult dateCheckingResultWithRange:range date:date timeZone:timeZone duration:duration]];
-}
+            if (strikeOut) {
+                CGRect runBounds = CGRectMake(metrics.origin.x + xOffset, metrics.origin.y - runDescent, runWidth, runAscent + runDescent);
 
-- (TTTAttributedLabelLink *)addLinkToTransitInformation:(NSDictionary *)components
-                                              withRange:(NSRange)range
-{
-    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult transitInformationCheckingResultWithRange:range components:components]];
-}
+                switch ([[attributes objectForKey:(id)kCTSuperscriptAttributeName] integerValue]) {
+                    case 1:
+                        runBounds.origin.y -= runAscent * 0.47f;
+                        break;
+                    case -1:
+                        runBounds.origin.y += runAscent * 0.25f;
+                        break;
+                    default:
+                        break;
+                }
 
-#pragma mark -
+                // Don't draw strikeout too far to the right
+                if (CGRectGetWidth(runBounds) > metrics.width) {
+                    runBounds.size.width = metrics.width;
+                }
 
-- (BOOL)containslinkAtPoint:(CGPoint)point {
-    return [self linkAtPoint:point] != nil;
-}
+                CGFloat y = CGFloat_round(runBounds.origin.y + runBounds.size.height / 2.0f);
+                CGMutablePathRef path = CGPathCreateMutable();
+                CGPathMoveToPoint(path, NULL, runBounds.origin.x, y);
+                CGPathAddLineToPoint(path, NULL, runBounds.origin.x + runBounds.size.width, y);
 
-- (TTTAttributedLabelLink *)linkAtPoint:(CGPoint)point {
-    
-    // Stop quickly if none of the points to be tested are in the bounds.
-    if (!CGRectContainsPoint(CGRectInset(self.bounds, -15.f, -15.f), point) || self.links.count == 0) {
-        return nil;
-    }
-    
-    TTTAttributedLabelLink *result = [self linkAtCharacterIndex:[self characterIndexAtPoint:point]];
-    
-    if (!result && self.extendsLinkTouchArea) {
-        result = [self linkAtRadius:2.5f aroundPoint:point]
-              ?: [self linkAtRadius:5.f aroundPoint:point]
-              ?: [self linkAtRadius:7.5f aroundPoint:point]
-              ?: [self linkAtRadius:12.5f aroundPoint:point]
-              ?: [self linkAtRadius:15.f aroundPoint:point];
+                // Use text color, or default to black
+                TTTAttributedLabelDecorationsAddPath(&_decorations, &_decorationCount, &capacity, path, NULL, CGColorRefFromColor([attributes objectForKey:(id)kCTForegroundColorAttributeName]), YES);
+                CGPathRelease(path);
+            }
+        }
     }
-    
-    return result;
-}
 
-- (TTTAttributedLabelLink *)linkAtRadius:(const CGFloat)radius aroundPoint:(CGPoint)point {
-    const CGFloat diagonal = CGFloat_sqrt(2 * radius * radius);
-    const CGPoint deltas[] = {
-        CGPointMake(0, -radius), CGPointMake(0, radius), // Above and below
-        CGPointMake(-radius, 0), CGPointMake(radius, 0), // Beside
-        CGPointMake(-diagonal, -diagonal), CGPointMake(-diagonal, diagonal),
-        CGPointMake(diagonal, diagonal), CGPointMake(diagonal, -diagonal) // Diagonal
-    };
-    const size_t count = sizeof(deltas) / sizeof(CGPoint);
-    
-    TTTAttributedLabelLink *link = nil;
-    
-    for (NSUInteger i = 0; i < count && link.result == nil; i ++) {
-        CGPoint currentPoint = CGPointMake(point.x + deltas[i].x, point.y + deltas[i].y);
-        link = [self linkAtCharacterIndex:[self characterIndexAtPoint:currentPoint]];
-    }
-    
-    return link;
+    _hasDecorations = YES;
+    _decorationBackgroundEdgeInset = backgroundEdgeInset;
+
+    *count = _decorationCount;
+    return _decorations;
 }
 
-- (TTTAttributedLabelLink *)linkAtCharacterIndex:(CFIndex)idx {
-    // Do not enumerate if the index is outside of the bounds of the text.
-    if (!NSLocationInRange((NSUInteger)idx, NSMakeRange(0, self.attributedText.length))) {
-        return nil;
-    }
-    
-    NSEnumerator *enumerator = [self.linkModels reverseObjectEnumerator];
-    TTTAttributedLabelLink *link = nil;
-    while ((link = [enumerator nextObject])) {
-        if (NSLocationInRange((NSUInteger)idx, link.result.range)) {
-            return link;
-        }
+- (void)dealloc {
+    if (_lineMetrics) {
+        free(_lineMetrics);
     }
 
-    return nil;
-}
+    [self removeDecorations];
 
-- (CFIndex)characterIndexAtPoint:(CGPoint)p {
-    if (!CGRectContainsPoint(self.bounds, p)) {
-        return NSNotFound;
+    if (_truncatedLine) {
+        CFRelease(_truncatedLine);
     }
 
-    CGRect textRect = [self textRectForBounds:self.bounds limitedToNumberOfLines:self.numberOfLines];
-    if (!CGRectContainsPoint(textRect, p)) {
-        return NSNotFound;
+    if (_lines) {
+        CFRelease(_lines);
     }
 
-    // Offset tap coordinates by textRect origin to make them relative to the origin of frame
-    p = CGPointMake(p.x - textRect.origin.x, p.y - textRect.origin.y);
-    // Convert tap coordinates (start at top left) to CT coordinates (start at bottom left)
-    p = CGPointMake(p.x, textRect.size.height - p.y);
-
-    CGMutablePathRef path = CGPathCreateMutable();
-    CGPathAddRect(path, NULL, textRect);
-    CTFrameRef frame = CTFramesetterCreateFrame([self framesetter], CFRangeMake(0, (CFIndex)[self.attributedText length]), path, NULL);
-    if (frame == NULL) {
-        CGPathRelease(path);
-        return NSNotFound;
+    if (_frame) {
+        CFRelease(_frame);
     }
+}
 
-    CFArrayRef lines = CTFrameGetLines(frame);
-    NSInteger numberOfLines = self.numberOfLines > 0 ? MIN(self.numberOfLines, CFArrayGetCount(lines)) : CFArrayGetCount(lines);
-    if (numberOfLines == 0) {
-        CFRelease(frame);
-        CGPathRelease(path);
-        return NSNotFound;
-    }
+- (CTLineRef)lineAtIndex:(CFIndex)lineIndex {
+    return CFArrayGetValueAtIndex(_lines, lineIndex);
+}
 
-    CFIndex idx = NSNotFound;
+- (TTTAttributedLabelLineMetrics)metricsForLineAtIndex:(CFIndex)lineIndex {
+    return _lineMetrics[lineIndex];
+}
 
-    CGPoint lineOrigins[numberOfLines];
-    CTFrameGetLineOrigins(frame, CFRangeMake(0, numberOfLines), lineOrigins);
+- (CFRange)visibleLineRangeIntersectingRect:(CGRect)rect {
+    // Lines are ordered from top to bottom, that is by decreasing y, so both ends of the range are found by binary search
+    CFIndex low = 0;
+    CFIndex high = _visibleLineCount;
+    while (low < high) {
+        CFIndex mid = low + (high - low) / 2;
+        if (_lineMetrics[mid].origin.y - _lineMetrics[mid].descent > CGRectGetMaxY(rect)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
 
-    for (CFIndex lineIndex = 0; lineIndex < numberOfLines; lineIndex++) {
-        CGPoint lineOrigin = lineOrigins[lineIndex];
-        CTLineRef line = CFArrayGetValueAtIndex(lines, lineIndex);
+    CFIndex firstLineIndex = low;
+    high = _visibleLineCount;
+    while (low < high) {
+        CFIndex mid = low + (high - low) / 2;
+        if (_lineMetrics[mid].origin.y + _lineMetrics[mid].ascent >= CGRectGetMinY(rect)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
 
-        // Get bounding information of line
-        CGFloat ascent = 0.0f, descent = 0.0f, leading = 0.0f;
-        CGFloat width = (CGFloat)CTLineGetTypographicBounds(line, &ascent, &descent, &leading);
-        CGFloat yMin = (CGFloat)floor(lineOrigin.y - descent);
-        CGFloat yMax = (CGFloat)ceil(lineOrigin.y + ascent);
+    return CFRangeMake(firstLineIndex, low - firstLineIndex);
+}
 
-        // Apply penOffset using flushFactor for horizontal alignment to set lineOrigin since this is the horizontal offset from drawFramesetter
-        CGFloat flushFactor = TTTFlushFactorForTextAlignment(self.textAlignment);
-        CGFloat penOffset = (CGFloat)CTLineGetPenOffsetForFlush(line, flushFactor, textRect.size.width);
-        lineOrigin.x = penOffset;
+- (CFIndex)characterIndexAtPoint:(CGPoint)p {
+    for (CFIndex lineIndex = 0; lineIndex < _visibleLineCount; lineIndex++) {
+        TTTAttributedLabelLineMetrics metrics = _lineMetrics[lineIndex];
+        CGFloat yMin = (CGFloat)floor(metrics.origin.y - metrics.descent);
+        CGFloat yMax = (CGFloat)ceil(metrics.origin.y + metrics.ascent);
 
         // Check if we've already passed the line
         if (p.y > yMax) {
@@ -689,1099 +858,4336 @@ static inline CGSize CTFramesetterSuggestFrameSizeForAttributedStringWithConstra
         }
         // Check if the point is within this line vertically
         if (p.y >= yMin) {
-            // Check if the point is within this line horizontally
-            if (p.x >= lineOrigin.x && p.x <= lineOrigin.x + width) {
+            // Check if the point is within this line horizontally, using the pen offset from drawing as the line origin
+            if (p.x >= metrics.penOffset && p.x <= metrics.penOffset + metrics.width) {
                 // Convert CT coordinates to line-relative coordinates
-                CGPoint relativePoint = CGPointMake(p.x - lineOrigin.x, p.y - lineOrigin.y);
-                idx = CTLineGetStringIndexForPosition(line, relativePoint);
-                break;
+                CGPoint relativePoint = CGPointMake(p.x - metrics.penOffset, p.y - metrics.origin.y);
+                return CTLineGetStringIndexForPosition([self lineAtIndex:lineIndex], relativePoint);
             }
         }
     }
 
-    CFRelease(frame);
-    CGPathRelease(path);
-
-    return idx;
+    return NSNotFound;
 }
 
-- (CGRect)boundingRectForCharacterRange:(NSRange)range {
-    NSMutableAttributedString *mutableAttributedString = [self.attributedText mutableCopy];
+@end
 
-    NSTextStorage *textStorage = [[NSTextStorage alloc] initWithAttributedString:mutableAttributedString];
+typedef struct {
+    CGRect rect;
+    NSUInteger linkIndex;
+} TTTAttributedLabelLinkFragment;
 
-    NSLayoutManager *layoutManager = [[NSLayoutManager alloc] init];
-    [textStorage addLayoutManager:layoutManager];
+typedef struct {
+    CGFloat minY;
+    CGFloat maxY;
+    NSUInteger location;
+    NSUInteger length;
+} TTTAttributedLabelLinkFragmentLine;
 
-    NSTextContainer *textContainer = [[NSTextContainer alloc] initWithSize:self.bounds.size];
-    [layoutManager addTextContainer:textContainer];
+/**
+ A spatial index of the rects covered by links in a text frame, split into one fragment per link per line, in label coordinates.
+ */
+@interface TTTAttributedLabelLinkIndex : NSObject
+@property (readonly, nonatomic, strong) TTTAttributedLabelFrame *textFrame;
 
-    NSRange glyphRange;
-    [layoutManager characterRangeForGlyphRange:range actualGlyphRange:&glyphRange];
+- (instancetype)initWithTextFrame:(TTTAttributedLabelFrame *)textFrame
+                            links:(NSArray *)links;
 
-    return [layoutManager boundingRectForGlyphRange:glyphRange inTextContainer:textContainer];
-}
+- (void)resetWithTextFrame:(TTTAttributedLabelFrame *)textFrame
+                     links:(NSArray *)links;
 
-- (void)drawFramesetter:(CTFramesetterRef)framesetter
-       attributedString:(NSAttributedString *)attributedString
-              textRange:(CFRange)textRange
-                 inRect:(CGRect)rect
-                context:(CGContextRef)c
-{
-    CGMutablePathRef path = CGPathCreateMutable();
-    CGPathAddRect(path, NULL, rect);
-    CTFrameRef frame = CTFramesetterCreateFrame(framesetter, textRange, path, NULL);
+- (void)removeAllFragments;
 
-    [self drawBackground:frame inRect:rect context:c];
+- (TTTAttributedLabelLink *)linkNearestToPoint:(CGPoint)point
+                                  withinRadius:(CGFloat)radius;
 
-    CFArrayRef lines = CTFrameGetLines(frame);
-    NSInteger numberOfLines = self.numberOfLines > 0 ? MIN(self.numberOfLines, CFArrayGetCount(lines)) : CFArrayGetCount(lines);
-    BOOL truncateLastLine = (self.lineBreakMode == TTTLineBreakByTruncatingHead || self.lineBreakMode == TTTLineBreakByTruncatingMiddle || self.lineBreakMode == TTTLineBreakByTruncatingTail);
+- (NSArray *)rectsForLink:(TTTAttributedLabelLink *)link;
+@end
 
-    CGPoint lineOrigins[numberOfLines];
-    CTFrameGetLineOrigins(frame, CFRangeMake(0, numberOfLines), lineOrigins);
+@implementation TTTAttributedLabelLinkIndex {
+@private
+    NSArray *_links;
+    TTTAttributedLabelLinkFragment *_fragments;
+    NSUInteger _fragmentCapacity;
+    TTTAttributedLabelLinkFragmentLine *_lines;
+    NSUInteger _lineCapacity;
+    NSUInteger _lineCount;
+}
 
-    for (CFIndex lineIndex = 0; lineIndex < numberOfLines; lineIndex++) {
-        CGPoint lineOrigin = lineOrigins[lineIndex];
-        CGContextSetTextPosition(c, lineOrigin.x, lineOrigin.y);
-        CTLineRef line = CFArrayGetValueAtIndex(lines, lineIndex);
+- (instancetype)initWithTextFrame:(TTTAttributedLabelFrame *)textFrame
+                            links:(NSArray *)links
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
 
-        CGFloat descent = 0.0f;
-        CTLineGetTypographicBounds((CTLineRef)line, NULL, &descent, NULL);
+    [self resetWithTextFrame:textFrame links:links];
 
-        // Adjust pen offset for flush depending on text alignment
-        CGFloat flushFactor = TTTFlushFactorForTextAlignment(self.textAlignment);
+    return self;
+}
 
-        if (lineIndex == numberOfLines - 1 && truncateLastLine) {
-            // Check if the range of text in the last line reaches the end of the full attributed string
-            CFRange lastLineRange = CTLineGetStringRange(line);
+- (void)resetWithTextFrame:(TTTAttributedLabelFrame *)textFrame
+                     links:(NSArray *)links
+{
+    // Fragments are written over those of the previous layout, so the buffers only grow
+    _textFrame = textFrame;
+    _links = [links copy];
+    _lineCount = 0;
 
-            if (!(lastLineRange.length == 0 && lastLineRange.location == 0) && lastLineRange.location + lastLineRange.length < textRange.location + textRange.length) {
-                // Get correct truncationType and attribute position
-                CTLineTruncationType truncationType;
-                CFIndex truncationAttributePosition = lastLineRange.location;
-                TTTLineBreakMode lineBreakMode = self.lineBreakMode;
+    CFIndex visibleLineCount = textFrame.visibleLineCount;
+    if (visibleLineCount == 0 || [_links count] == 0) {
+        return;
+    }
 
-                // Multiple lines, only use UILineBreakModeTailTruncation
-                if (numberOfLines != 1) {
-                    lineBreakMode = TTTLineBreakByTruncatingTail;
-                }
+    CGRect textRect = textFrame.textRect;
+    NSUInteger linkCount = [_links count];
+    NSUInteger fragmentCount = 0;
 
-                switch (lineBreakMode) {
-                    case TTTLineBreakByTruncatingHead:
-                        truncationType = kCTLineTruncationStart;
-                        break;
-                    case TTTLineBreakByTruncatingMiddle:
-                        truncationType = kCTLineTruncationMiddle;
-                        truncationAttributePosition += (lastLineRange.length / 2);
-                        break;
-                    case TTTLineBreakByTruncatingTail:
-                    default:
-                        truncationType = kCTLineTruncationEnd;
-                        truncationAttributePosition += (lastLineRange.length - 1);
-                        break;
-                }
+    if (_fragmentCapacity < MAX(linkCount, (NSUInteger)visibleLineCount)) {
+        _fragmentCapacity = MAX(linkCount, (NSUInteger)visibleLineCount);
+        _fragments = realloc(_fragments, _fragmentCapacity * sizeof(TTTAttributedLabelLinkFragment));
+    }
 
-                NSAttributedString *attributedTruncationString = self.attributedTruncationToken;
-                if (!attributedTruncationString) {
-                    NSString *truncationTokenString = @"\u2026"; // Unicode Character 'HORIZONTAL ELLIPSIS' (U+2026)
-                    
-                    NSDictionary *truncationTokenStringAttributes = truncationTokenStringAttributes = [attributedString attributesAtIndex:(NSUInteger)truncationAttributePosition effectiveRange:NULL];
-                    
-                    attributedTruncationString = [[NSAttributedString alloc] initWithString:truncationTokenString attributes:truncationTokenStringAttributes];
-                }
-                CTLineRef truncationToken = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)attributedTruncationString);
-
-                // Append truncationToken to the string
-                // because if string isn't too long, CT won't add the truncationToken on its own.
-                // There is no chance of a double truncationToken because CT only adds the
-                // token if it removes characters (and the one we add will go first)
-                NSMutableAttributedString *truncationString = [[NSMutableAttributedString alloc] initWithAttributedString:
-                                                               [attributedString attributedSubstringFromRange:
-                                                                NSMakeRange((NSUInteger)lastLineRange.location,
-                                                                            (NSUInteger)lastLineRange.length)]];
-                if (lastLineRange.length > 0) {
-                    // Remove any newline at the end (we don't want newline space between the text and the truncation token). There can only be one, because the second would be on the next line.
-                    unichar lastCharacter = [[truncationString string] characterAtIndex:(NSUInteger)(lastLineRange.length - 1)];
-                    if ([[NSCharacterSet newlineCharacterSet] characterIsMember:lastCharacter]) {
-                        [truncationString deleteCharactersInRange:NSMakeRange((NSUInteger)(lastLineRange.length - 1), 1)];
-                    }
-                }
-                [truncationString appendAttributedString:attributedTruncationString];
-                CTLineRef truncationLine = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)truncationString);
-
-                // Truncate the line in case it is too long.
-                CTLineRef truncatedLine = CTLineCreateTruncatedLine(truncationLine, rect.size.width, truncationType, truncationToken);
-                if (!truncatedLine) {
-                    // If the line is not as wide as the truncationToken, truncatedLine is NULL
-                    truncatedLine = CFRetain(truncationToken);
-                }
+    if (_lineCapacity < (NSUInteger)visibleLineCount) {
+        _lineCapacity = (NSUInteger)visibleLineCount;
+        _lines = realloc(_lines, _lineCapacity * sizeof(TTTAttributedLabelLinkFragmentLine));
+    }
 
-                CGFloat penOffset = (CGFloat)CTLineGetPenOffsetForFlush(truncatedLine, flushFactor, rect.size.width);
-                CGContextSetTextPosition(c, penOffset, lineOrigin.y - descent - self.font.descender);
+    for (CFIndex lineIndex = 0; lineIndex < visibleLineCount; lineIndex++) {
+        CTLineRef line = [textFrame lineAtIndex:lineIndex];
+        TTTAttributedLabelLineMetrics metrics = [textFrame metricsForLineAtIndex:lineIndex];
+        CFRange lineRange = CTLineGetStringRange(line);
+
+        // Match the vertical extent used for hit testing, converted from CT coordinates (bottom left) to label coordinates (top left)
+        CGFloat yMin = (CGFloat)floor(metrics.origin.y - metrics.descent);
+        CGFloat yMax = (CGFloat)ceil(metrics.origin.y + metrics.ascent);
+        CGFloat minY = textRect.origin.y + textRect.size.height - yMax;
+
+        TTTAttributedLabelLinkFragmentLine *fragmentLine = &_lines[_lineCount++];
+        fragmentLine->minY = minY;
+        fragmentLine->maxY = minY + (yMax - yMin);
+        fragmentLine->location = fragmentCount;
+
+        for (NSUInteger linkIndex = 0; linkIndex < linkCount; linkIndex++) {
+            TTTAttributedLabelLink *link = [_links objectAtIndex:linkIndex];
+            NSRange range = NSIntersectionRange(link.result.range, NSMakeRange((NSUInteger)lineRange.location, (NSUInteger)lineRange.length));
+            if (range.length == 0) {
+                continue;
+            }
 
-                CTLineDraw(truncatedLine, c);
-                
-                NSRange linkRange;
-                if ([attributedTruncationString attribute:NSLinkAttributeName atIndex:0 effectiveRange:&linkRange]) {
-                    NSRange tokenRange = [truncationString.string rangeOfString:attributedTruncationString.string];
-                    NSRange tokenLinkRange = NSMakeRange((NSUInteger)(lastLineRange.location+lastLineRange.length)-tokenRange.length, (NSUInteger)tokenRange.length);
-                    
-                    [self addLinkToURL:[attributedTruncationString attribute:NSLinkAttributeName atIndex:0 effectiveRange:&linkRange] withRange:tokenLinkRange];
-                }
+            CGFloat startOffset = (CGFloat)CTLineGetOffsetForStringIndex(line, (CFIndex)range.location, NULL);
+            CGFloat endOffset = (CGFloat)CTLineGetOffsetForStringIndex(line, (CFIndex)NSMaxRange(range), NULL);
 
-                CFRelease(truncatedLine);
-                CFRelease(truncationLine);
-                CFRelease(truncationToken);
-            } else {
-                CGFloat penOffset = (CGFloat)CTLineGetPenOffsetForFlush(line, flushFactor, rect.size.width);
-                CGContextSetTextPosition(c, penOffset, lineOrigin.y - descent - self.font.descender);
-                CTLineDraw(line, c);
+            if (fragmentCount == _fragmentCapacity) {
+                _fragmentCapacity *= 2;
+                _fragments = realloc(_fragments, _fragmentCapacity * sizeof(TTTAttributedLabelLinkFragment));
             }
-        } else {
-            CGFloat penOffset = (CGFloat)CTLineGetPenOffsetForFlush(line, flushFactor, rect.size.width);
-            CGContextSetTextPosition(c, penOffset, lineOrigin.y - descent - self.font.descender);
-            CTLineDraw(line, c);
+
+            TTTAttributedLabelLinkFragment *fragment = &_fragments[fragmentCount++];
+            fragment->rect = CGRectMake(textRect.origin.x + metrics.penOffset + MIN(startOffset, endOffset), fragmentLine->minY, (CGFloat)fabs(endOffset - startOffset), fragmentLine->maxY - fragmentLine->minY);
+            fragment->linkIndex = linkIndex;
         }
+
+        fragmentLine->length = fragmentCount - fragmentLine->location;
     }
+}
 
-    [self drawStrike:frame inRect:rect context:c];
+- (void)removeAllFragments {
+    [self resetWithTextFrame:nil links:nil];
+}
 
-    CFRelease(frame);
-    CGPathRelease(path);
+- (void)dealloc {
+    if (_fragments) {
+        free(_fragments);
+    }
+
+    if (_lines) {
+        free(_lines);
+    }
 }
 
-- (void)drawBackground:(CTFrameRef)frame
-                inRect:(CGRect)rect
-               context:(CGContextRef)c
+- (TTTAttributedLabelLink *)linkNearestToPoint:(CGPoint)point
+                                  withinRadius:(CGFloat)radius
 {
-    NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
-    CGPoint origins[[lines count]];
-    CTFrameGetLineOrigins(frame, CFRangeMake(0, 0), origins);
-
-    CFIndex lineIndex = 0;
-    for (id line in lines) {
-        CGFloat ascent = 0.0f, descent = 0.0f, leading = 0.0f;
-        CGFloat width = (CGFloat)CTLineGetTypographicBounds((__bridge CTLineRef)line, &ascent, &descent, &leading) ;
+    if (_lineCount == 0) {
+        return nil;
+    }
 
-        for (id glyphRun in (__bridge NSArray *)CTLineGetGlyphRuns((__bridge CTLineRef)line)) {
-            NSDictionary *attributes = (__bridge NSDictionary *)CTRunGetAttributes((__bridge CTRunRef) glyphRun);
-            CGColorRef strokeColor = CGColorRefFromColor([attributes objectForKey:kTTTBackgroundStrokeColorAttributeName]);
-            CGColorRef fillColor = CGColorRefFromColor([attributes objectForKey:kTTTBackgroundFillColorAttributeName]);
-            UIEdgeInsets fillPadding = [[attributes objectForKey:kTTTBackgroundFillPaddingAttributeName] UIEdgeInsetsValue];
-            CGFloat cornerRadius = [[attributes objectForKey:kTTTBackgroundCornerRadiusAttributeName] floatValue];
-            CGFloat lineWidth = [[attributes objectForKey:kTTTBackgroundLineWidthAttributeName] floatValue];
+    // Lines are laid out top to bottom, so binary search for the first one that reaches down to the radius around the point
+    NSUInteger low = 0, high = _lineCount;
+    while (low < high) {
+        NSUInteger mid = low + (high - low) / 2;
+        if (_lines[mid].maxY < point.y - radius) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
 
-            if (strokeColor || fillColor) {
-                CGRect runBounds = CGRectZero;
-                CGFloat runAscent = 0.0f;
-                CGFloat runDescent = 0.0f;
-
-                runBounds.size.width = (CGFloat)CTRunGetTypographicBounds((__bridge CTRunRef)glyphRun, CFRangeMake(0, 0), &runAscent, &runDescent, NULL) + fillPadding.left + fillPadding.right;
-                runBounds.size.height = runAscent + runDescent + fillPadding.top + fillPadding.bottom;
-
-                CGFloat xOffset = 0.0f;
-                CFRange glyphRange = CTRunGetStringRange((__bridge CTRunRef)glyphRun);
-                switch (CTRunGetStatus((__bridge CTRunRef)glyphRun)) {
-                    case kCTRunStatusRightToLeft:
-                        xOffset = CTLineGetOffsetForStringIndex((__bridge CTLineRef)line, glyphRange.location + glyphRange.length, NULL);
-                        break;
-                    default:
-                        xOffset = CTLineGetOffsetForStringIndex((__bridge CTLineRef)line, glyphRange.location, NULL);
-                        break;
-                }
+    CGFloat nearestDistance = radius * radius;
+    NSUInteger nearestLinkIndex = NSNotFound;
+
+    for (NSUInteger lineIndex = low; lineIndex < _lineCount && _lines[lineIndex].minY <= point.y + radius; lineIndex++) {
+        TTTAttributedLabelLinkFragmentLine fragmentLine = _lines[lineIndex];
+        for (NSUInteger fragmentIndex = fragmentLine.location; fragmentIndex < fragmentLine.location + fragmentLine.length; fragmentIndex++) {
+            TTTAttributedLabelLinkFragment fragment = _fragments[fragmentIndex];
+            CGFloat dx = MAX(MAX(CGRectGetMinX(fragment.rect) - point.x, point.x - CGRectGetMaxX(fragment.rect)), 0.0f);
+            CGFloat dy = MAX(MAX(CGRectGetMinY(fragment.rect) - point.y, point.y - CGRectGetMaxY(fragment.rect)), 0.0f);
+            CGFloat distance = dx * dx + dy * dy;
+
+            // Links added later take precedence, as they do for character index lookups
+            if (distance < nearestDistance || (distance == nearestDistance && (nearestLinkIndex == NSNotFound || fragment.linkIndex > nearestLinkIndex))) {
+                nearestDistance = distance;
+                nearestLinkIndex = fragment.linkIndex;
+            }
+        }
+    }
 
-                runBounds.origin.x = origins[lineIndex].x + rect.origin.x + xOffset - fillPadding.left - rect.origin.x;
-                runBounds.origin.y = origins[lineIndex].y + rect.origin.y - fillPadding.bottom - rect.origin.y;
-                runBounds.origin.y -= runDescent;
+    return nearestLinkIndex != NSNotFound ? [_links objectAtIndex:nearestLinkIndex] : nil;
+}
 
-                // Don't draw higlightedLinkBackground too far to the right
-                if (CGRectGetWidth(runBounds) > width) {
-                    runBounds.size.width = width;
-                }
+- (NSArray *)rectsForLink:(TTTAttributedLabelLink *)link {
+    NSUInteger linkIndex = [_links indexOfObjectIdenticalTo:link];
+    if (linkIndex == NSNotFound || _lineCount == 0) {
+        return [NSArray array];
+    }
 
-                CGPathRef path = [[UIBezierPath bezierPathWithRoundedRect:CGRectInset(UIEdgeInsetsInsetRect(runBounds, self.linkBackgroundEdgeInset), lineWidth, lineWidth) cornerRadius:cornerRadius] CGPath];
+    // Fragments are ordered by line, so a link wrapping across lines has one rect per line, top to bottom
+    NSUInteger fragmentCount = _lines[_lineCount - 1].location + _lines[_lineCount - 1].length;
+    NSMutableArray *mutableRects = [NSMutableArray array];
+    for (NSUInteger fragmentIndex = 0; fragmentIndex < fragmentCount; fragmentIndex++) {
+        if (_fragments[fragmentIndex].linkIndex == linkIndex) {
+            [mutableRects addObject:[NSValue valueWithCGRect:_fragments[fragmentIndex].rect]];
+        }
+    }
 
-                CGContextSetLineJoin(c, kCGLineJoinRound);
+    return mutableRects;
+}
 
-                if (fillColor) {
-                    CGContextSetFillColorWithColor(c, fillColor);
-                    CGContextAddPath(c, path);
-                    CGContextFillPath(c);
-                }
+@end
 
-                if (strokeColor) {
-                    CGContextSetStrokeColorWithColor(c, strokeColor);
-                    CGContextAddPath(c, path);
-                    CGContextStrokePath(c);
-                }
-            }
-        }
+typedef struct {
+    NSRange range;
+    NSUInteger linkIndex;
+} TTTAttributedLabelLinkInterval;
 
-        lineIndex++;
+static int TTTAttributedLabelLinkIntervalCompare(const void *a, const void *b) {
+    const TTTAttributedLabelLinkInterval *lhs = a, *rhs = b;
+    if (lhs->range.location != rhs->range.location) {
+        return lhs->range.location < rhs->range.location ? -1 : 1;
     }
-}
 
-- (void)drawStrike:(CTFrameRef)frame
-            inRect:(__unused CGRect)rect
-           context:(CGContextRef)c
-{
-    NSArray *lines = (__bridge NSArray *)CTFrameGetLines(frame);
-    CGPoint origins[[lines count]];
-    CTFrameGetLineOrigins(frame, CFRangeMake(0, 0), origins);
+    return lhs->linkIndex < rhs->linkIndex ? -1 : (lhs->linkIndex > rhs->linkIndex ? 1 : 0);
+}
 
-    CFIndex lineIndex = 0;
-    for (id line in lines) {
-        CGFloat ascent = 0.0f, descent = 0.0f, leading = 0.0f;
-        CGFloat width = (CGFloat)CTLineGetTypographicBounds((__bridge CTLineRef)line, &ascent, &descent, &leading) ;
+/**
+ The character ranges of links sorted by location, along with the furthest range end seen so far, so that the links containing a character index can be found without scanning every link.
+ */
+@interface TTTAttributedLabelLinkIntervals : NSObject
+- (instancetype)initWithLinks:(NSArray *)links;
+- (TTTAttributedLabelLink *)linkAtCharacterIndex:(NSUInteger)idx;
+@end
 
-        for (id glyphRun in (__bridge NSArray *)CTLineGetGlyphRuns((__bridge CTLineRef)line)) {
-            NSDictionary *attributes = (__bridge NSDictionary *)CTRunGetAttributes((__bridge CTRunRef) glyphRun);
-            BOOL strikeOut = [[attributes objectForKey:kTTTStrikeOutAttributeName] boolValue];
-            NSInteger superscriptStyle = [[attributes objectForKey:(id)kCTSuperscriptAttributeName] integerValue];
+@implementation TTTAttributedLabelLinkIntervals {
+@private
+    NSArray *_links;
+    NSUInteger _count;
+    TTTAttributedLabelLinkInterval *_intervals;
+    NSUInteger *_maximumEnds;
+}
 
-            if (strikeOut) {
-                CGRect runBounds = CGRectZero;
-                CGFloat runAscent = 0.0f;
-                CGFloat runDescent = 0.0f;
-
-                runBounds.size.width = (CGFloat)CTRunGetTypographicBounds((__bridge CTRunRef)glyphRun, CFRangeMake(0, 0), &runAscent, &runDescent, NULL);
-                runBounds.size.height = runAscent + runDescent;
-
-                CGFloat xOffset = 0.0f;
-                CFRange glyphRange = CTRunGetStringRange((__bridge CTRunRef)glyphRun);
-                switch (CTRunGetStatus((__bridge CTRunRef)glyphRun)) {
-                    case kCTRunStatusRightToLeft:
-                        xOffset = CTLineGetOffsetForStringIndex((__bridge CTLineRef)line, glyphRange.location + glyphRange.length, NULL);
-                        break;
-                    default:
-                        xOffset = CTLineGetOffsetForStringIndex((__bridge CTLineRef)line, glyphRange.location, NULL);
-                        break;
-                }
-                runBounds.origin.x = origins[lineIndex].x + xOffset;
-                runBounds.origin.y = origins[lineIndex].y;
-                runBounds.origin.y -= runDescent;
+- (instancetype)initWithLinks:(NSArray *)links {
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
 
-                // Don't draw strikeout too far to the right
-                if (CGRectGetWidth(runBounds) > width) {
-                    runBounds.size.width = width;
-                }
+    _links = [links copy];
+    _count = [_links count];
 
-				switch (superscriptStyle) {
-					case 1:
-						runBounds.origin.y -= runAscent * 0.47f;
-						break;
-					case -1:
-						runBounds.origin.y += runAscent * 0.25f;
-						break;
-					default:
-						break;
-				}
+    if (_count == 0) {
+        return self;
+    }
 
-                // Use text color, or default to black
-                id color = [attributes objectForKey:(id)kCTForegroundColorAttributeName];
-                if (color) {
-                    CGContextSetStrokeColorWithColor(c, CGColorRefFromColor(color));
-                } else {
-                    CGContextSetGrayStrokeColor(c, 0.0f, 1.0);
-                }
+    _intervals = malloc(_count * sizeof(TTTAttributedLabelLinkInterval));
+    _maximumEnds = malloc(_count * sizeof(NSUInteger));
 
-                CTFontRef font = CTFontCreateWithName((__bridge CFStringRef)self.font.fontName, self.font.pointSize, NULL);
-                CGContextSetLineWidth(c, CTFontGetUnderlineThickness(font));
-                CFRelease(font);
+    for (NSUInteger linkIndex = 0; linkIndex < _count; linkIndex++) {
+        TTTAttributedLabelLink *link = [_links objectAtIndex:linkIndex];
+        _intervals[linkIndex].range = link.result.range;
+        _intervals[linkIndex].linkIndex = linkIndex;
+    }
 
-                CGFloat y = CGFloat_round(runBounds.origin.y + runBounds.size.height / 2.0f);
-                CGContextMoveToPoint(c, runBounds.origin.x, y);
-                CGContextAddLineToPoint(c, runBounds.origin.x + runBounds.size.width, y);
+    qsort(_intervals, _count, sizeof(TTTAttributedLabelLinkInterval), TTTAttributedLabelLinkIntervalCompare);
 
-                CGContextStrokePath(c);
-            }
+    NSUInteger maximumEnd = 0;
+    for (NSUInteger intervalIndex = 0; intervalIndex < _count; intervalIndex++) {
+        NSRange range = _intervals[intervalIndex].range;
+        if (range.location != NSNotFound) {
+            maximumEnd = MAX(maximumEnd, NSMaxRange(range));
         }
-
-        lineIndex++;
+        _maximumEnds[intervalIndex] = maximumEnd;
     }
+
+    return self;
 }
 
-#pragma mark - TTTAttributedLabel
-
-- (void)setText:(id)text {
-    NSParameterAssert(!text || [text isKindOfClass:[NSAttributedString class]] || [text isKindOfClass:[NSString class]]);
-
-    if ([text isKindOfClass:[NSString class]]) {
-        [self setText:text afterInheritingLabelAttributesAndConfiguringWithBlock:nil];
-        return;
+- (void)dealloc {
+    if (_intervals) {
+        free(_intervals);
     }
 
-    self.attributedText = text;
-    self.activeLink = nil;
-
-    self.linkModels = [NSArray array];
-    if (text && self.attributedText && self.enabledTextCheckingTypes) {
-        __weak __typeof(self)weakSelf = self;
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            __strong __typeof(weakSelf)strongSelf = weakSelf;
-
-            NSDataDetector *dataDetector = strongSelf.dataDetector;
-            if (dataDetector && [dataDetector respondsToSelector:@selector(matchesInString:options:range:)]) {
-                NSArray *results = [dataDetector matchesInString:[(NSAttributedString *)text string] options:0 range:NSMakeRange(0, [(NSAttributedString *)text length])];
-                if ([results count] > 0) {
-                    dispatch_async(dispatch_get_main_queue(), ^{
-                        if ([[strongSelf.attributedText string] isEqualToString:[(NSAttributedString *)text string]]) {
-                            [strongSelf addLinksWithTextCheckingResults:results attributes:strongSelf.linkAttributes];
-                        }
-                    });
-                }
-            }
-        });
+    if (_maximumEnds) {
+        free(_maximumEnds);
     }
-
-    [self.attributedText enumerateAttribute:NSLinkAttributeName inRange:NSMakeRange(0, self.attributedText.length) options:0 usingBlock:^(id value, __unused NSRange range, __unused BOOL *stop) {
-        if (value) {
-            NSURL *URL = [value isKindOfClass:[NSString class]] ? [NSURL URLWithString:value] : value;
-            [self addLinkToURL:URL withRange:range];
-        }
-    }];
 }
 
-- (void)setText:(id)text
-afterInheritingLabelAttributesAndConfiguringWithBlock:(NSMutableAttributedString * (^)(NSMutableAttributedString *mutableAttributedString))block
-{
-    NSMutableAttributedString *mutableAttributedString = nil;
-    if ([text isKindOfClass:[NSString class]]) {
-        mutableAttributedString = [[NSMutableAttributedString alloc] initWithString:text attributes:NSAttributedStringAttributesFromLabel(self)];
-    } else {
-        mutableAttributedString = [[NSMutableAttributedString alloc] initWithAttributedString:text];
-        [mutableAttributedString addAttributes:NSAttributedStringAttributesFromLabel(self) range:NSMakeRange(0, [mutableAttributedString length])];
+- (TTTAttributedLabelLink *)linkAtCharacterIndex:(NSUInteger)idx {
+    // Find the first interval starting after the index; only intervals before it can contain the index
+    NSUInteger low = 0, high = _count;
+    while (low < high) {
+        NSUInteger mid = low + (high - low) / 2;
+        if (_intervals[mid].range.location <= idx) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
     }
 
-    if (block) {
-        mutableAttributedString = block(mutableAttributedString);
+    // Walk back until no earlier interval reaches the index, preferring links added later
+    NSUInteger linkIndex = NSNotFound;
+    for (NSUInteger intervalIndex = low; intervalIndex > 0 && _maximumEnds[intervalIndex - 1] > idx; intervalIndex--) {
+        TTTAttributedLabelLinkInterval interval = _intervals[intervalIndex - 1];
+        if (NSLocationInRange(idx, interval.range) && (linkIndex == NSNotFound || interval.linkIndex > linkIndex)) {
+            linkIndex = interval.linkIndex;
+        }
     }
 
-    [self setText:mutableAttributedString];
+    return linkIndex != NSNotFound ? [_links objectAtIndex:linkIndex] : nil;
 }
 
-- (void)setActiveLink:(TTTAttributedLabelLink *)activeLink {
-    _activeLink = activeLink;
-    
-    NSDictionary *activeAttributes = activeLink.activeAttributes ?: self.activeLinkAttributes;
+@end
 
-    if (_activeLink && activeAttributes.count > 0) {
-        if (!self.inactiveAttributedText) {
-            self.inactiveAttributedText = [self.attributedText copy];
-        }
+@interface TTTAttributedLabel (TTTAttributedLabelDrawing)
+- (TTTAttributedLabelFrame *)textFrameForBounds:(CGRect)bounds;
+- (TTTAttributedLabelFrame *)activeLinkTextFrameForTextFrame:(TTTAttributedLabelFrame *)textFrame;
+@end
 
-        NSMutableAttributedString *mutableAttributedString = [self.inactiveAttributedText mutableCopy];
-        if (self.activeLink.result.range.length > 0 && NSLocationInRange(NSMaxRange(self.activeLink.result.range) - 1, NSMakeRange(0, [self.inactiveAttributedText length]))) {
-            [mutableAttributedString addAttributes:activeAttributes range:self.activeLink.result.range];
-        }
+/**
+ The typeset lines of a label and the settings it draws them with, taken on the main thread, so that the text can then be drawn on any thread without reading the label.
+ */
+@interface TTTAttributedLabelDrawing : NSObject
+- (instancetype)initWithLabel:(TTTAttributedLabel *)label
+                         rect:(CGRect)rect;
 
-        self.attributedText = mutableAttributedString;
-        [self setNeedsDisplay];
+- (void)drawInContext:(CGContextRef)c;
+@end
 
-        [CATransaction flush];
-    } else if (self.inactiveAttributedText) {
-        self.attributedText = self.inactiveAttributedText;
-        self.inactiveAttributedText = nil;
+@implementation TTTAttributedLabelDrawing {
+@private
+    TTTAttributedLabelFrame *_textFrame;
+    CGRect _insetRect;
+    CGRect _textRect;
+    UIColor *_shadowColor;
+    CGSize _shadowOffset;
+    CGFloat _shadowRadius;
+    UIColor *_highlightedTextColor;
+    UIFont *_font;
+    UIEdgeInsets _linkBackgroundEdgeInset;
+}
 
-        [self setNeedsDisplay];
+- (instancetype)initWithLabel:(TTTAttributedLabel *)label
+                         rect:(CGRect)rect
+{
+    self = [super init];
+    if (!self) {
+        return nil;
     }
-}
 
-- (void)setLinkAttributes:(NSDictionary *)linkAttributes {
-    _linkAttributes = convertNSAttributedStringAttributesToCTAttributes(linkAttributes);
-}
+    // First, get the typeset lines and the text rect (which takes vertical centering into account)
+    _insetRect = UIEdgeInsetsInsetRect(rect, label.textInsets);
+    _textFrame = label.attributedText ? [label activeLinkTextFrameForTextFrame:[label textFrameForBounds:rect]] : nil;
+    _textRect = [label textRectForBounds:rect limitedToNumberOfLines:label.numberOfLines];
+
+    if (label.shadowColor && !label.highlighted) {
+        _shadowColor = label.shadowColor;
+        _shadowOffset = label.shadowOffset;
+        _shadowRadius = label.shadowRadius;
+    } else if (label.highlightedShadowColor) {
+        _shadowColor = label.highlightedShadowColor;
+        _shadowOffset = label.highlightedShadowOffset;
+        _shadowRadius = label.highlightedShadowRadius;
+    }
 
-- (void)setActiveLinkAttributes:(NSDictionary *)activeLinkAttributes {
-    _activeLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(activeLinkAttributes);
-}
+    _highlightedTextColor = label.highlighted ? label.highlightedTextColor : nil;
+    _font = label.font;
+    _linkBackgroundEdgeInset = label.linkBackgroundEdgeInset;
 
-- (void)setInactiveLinkAttributes:(NSDictionary *)inactiveLinkAttributes {
-    _inactiveLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(inactiveLinkAttributes);
+    // The frame builds its decorations on first use, which is done here rather than by each thread drawing it
+    NSUInteger decorationCount = 0;
+    [_textFrame decorationsWithBackgroundEdgeInset:_linkBackgroundEdgeInset count:&decorationCount];
+
+    return self;
 }
 
-#pragma mark - UILabel
+- (void)drawInContext:(CGContextRef)c {
+    if (!_textFrame) {
+        return;
+    }
 
-- (void)setHighlighted:(BOOL)highlighted {
-    [super setHighlighted:highlighted];
-    [self setNeedsDisplay];
-}
+    CGContextSaveGState(c);
+    {
+        CGContextSetTextMatrix(c, CGAffineTransformIdentity);
 
-// Fixes crash when loading from a UIStoryboard
-- (UIColor *)textColor {
-	UIColor *color = [super textColor];
-	if (!color) {
-		color = [UIColor blackColor];
-	}
+        // Inverts the CTM to match iOS coordinates (otherwise text draws upside-down; Mac OS's system is different)
+        CGContextTranslateCTM(c, 0.0f, _insetRect.size.height);
+        CGContextScaleCTM(c, 1.0f, -1.0f);
 
-	return color;
-}
+        // CoreText draws its text aligned to the bottom, so we move the CTM here to take our vertical offsets into account
+        CGContextTranslateCTM(c, _insetRect.origin.x, _insetRect.size.height - _textRect.origin.y - _textRect.size.height);
 
-- (void)setTextColor:(UIColor *)textColor {
-    UIColor *oldTextColor = self.textColor;
-    [super setTextColor:textColor];
+        // Second, trace the shadow before the actual text, if we have one
+        if (_shadowColor) {
+            CGContextSetShadowWithColor(c, _shadowOffset, _shadowRadius, [_shadowColor CGColor]);
+        }
 
-    // Redraw to allow any ColorFromContext attributes a chance to update
-    if (textColor != oldTextColor) {
-        [self setNeedsFramesetter];
-        [self setNeedsDisplay];
+        // Finally, draw the text or highlighted text itself (on top of the shadow, if there is one)
+        [self drawTextFrame:_textFrame context:c];
     }
+    CGContextRestoreGState(c);
 }
 
-- (CGRect)textRectForBounds:(CGRect)bounds
-     limitedToNumberOfLines:(NSInteger)numberOfLines
+- (void)drawTextFrame:(TTTAttributedLabelFrame *)textFrame
+              context:(CGContextRef)c
 {
-    bounds = UIEdgeInsetsInsetRect(bounds, self.textInsets);
-    if (!self.attributedText) {
-        return [super textRectForBounds:bounds limitedToNumberOfLines:numberOfLines];
+    CGRect rect = textFrame.textRect;
+
+    [self drawBackground:textFrame inRect:rect context:c];
+
+    // Highlighted text is drawn with its own colors into a layer, which is then filled with the highlighted color
+    if (_highlightedTextColor) {
+        CGContextBeginTransparencyLayer(c, NULL);
     }
 
-    CGRect textRect = bounds;
+    NSInteger numberOfLines = textFrame.visibleLineCount;
 
-    // Calculate height with a minimum of double the font pointSize, to ensure that CTFramesetterSuggestFrameSizeWithConstraints doesn't return CGSizeZero, as it would if textRect height is insufficient.
-    textRect.size.height = MAX(self.font.lineHeight * MAX(2, numberOfLines), bounds.size.height);
+    // Only the lines that intersect the clip, such as a tile of a tiled label, are drawn
+    CFRange lineRange = [textFrame visibleLineRangeIntersectingRect:[self drawingRectForClipOfContext:c]];
 
-    // Adjust the text to be in the center vertically, if the text size is smaller than bounds
-    CGSize textSize = CTFramesetterSuggestFrameSizeWithConstraints([self framesetter], CFRangeMake(0, (CFIndex)[self.attributedText length]), NULL, textRect.size, NULL);
-    textSize = CGSizeMake(CGFloat_ceil(textSize.width), CGFloat_ceil(textSize.height)); // Fix for iOS 4, CTFramesetterSuggestFrameSizeWithConstraints sometimes returns fractional sizes
+    for (CFIndex lineIndex = lineRange.location; lineIndex < lineRange.location + lineRange.length; lineIndex++) {
+        TTTAttributedLabelLineMetrics metrics = [textFrame metricsForLineAtIndex:lineIndex];
+        CGFloat y = metrics.origin.y - metrics.descent - _font.descender;
 
-    if (textSize.height < bounds.size.height) {
-        CGFloat yOffset = 0.0f;
-        switch (self.verticalAlignment) {
-            case TTTAttributedLabelVerticalAlignmentCenter:
-                yOffset = CGFloat_floor((bounds.size.height - textSize.height) / 2.0f);
-                break;
-            case TTTAttributedLabelVerticalAlignmentBottom:
-                yOffset = bounds.size.height - textSize.height;
-                break;
-            case TTTAttributedLabelVerticalAlignmentTop:
-            default:
-                break;
+        // The truncated last line is computed with the layout, so that redrawing does not build it again
+        if (lineIndex == numberOfLines - 1 && textFrame.truncatedLine) {
+            CGContextSetTextPosition(c, textFrame.truncatedLinePenOffset, y);
+            CTLineDraw(textFrame.truncatedLine, c);
+        } else {
+            CGContextSetTextPosition(c, metrics.penOffset, y);
+            CTLineDraw([textFrame lineAtIndex:lineIndex], c);
         }
-
-        textRect.origin.y += yOffset;
     }
 
-    return textRect;
-}
+    if (_highlightedTextColor) {
+        CGContextSaveGState(c);
+        CGContextSetBlendMode(c, kCGBlendModeSourceIn);
+        CGContextSetFillColorWithColor(c, [_highlightedTextColor CGColor]);
+        CGContextFillRect(c, CGContextGetClipBoundingBox(c));
+        CGContextRestoreGState(c);
 
-- (void)drawTextInRect:(CGRect)rect {
-    CGRect insetRect = UIEdgeInsetsInsetRect(rect, self.textInsets);
-    if (!self.attributedText) {
-        [super drawTextInRect:insetRect];
-        return;
+        CGContextEndTransparencyLayer(c);
     }
 
-    NSAttributedString *originalAttributedText = nil;
+    // Strikes are drawn outside the layer, in the highlighted color rather than through its fill
+    [self drawStrike:textFrame inRect:rect context:c];
+}
+
+- (CGRect)drawingRectForClipOfContext:(CGContextRef)c {
+    // Allow for shadows, and for glyphs and decorations that reach past the typographic bounds of their line
+    CGFloat overhang = (CGFloat)fabs(_shadowOffset.height) + _shadowRadius + _font.lineHeight;
 
-    // Adjust the font size to fit width, if necessarry
-    if (self.adjustsFontSizeToFitWidth && self.numberOfLines > 0) {
-        // Framesetter could still be working with a resized version of the text;
-        // need to reset so we start from the original font size.
-        // See #393.
-        [self setNeedsFramesetter];
-        [self setNeedsDisplay];
-        
-        if ([self respondsToSelector:@selector(invalidateIntrinsicContentSize)]) {
-            [self invalidateIntrinsicContentSize];
-        }
-        
-        // Use infinite width to find the max width, which will be compared to availableWidth if needed.
-        CGSize maxSize = (self.numberOfLines > 1) ? CGSizeMake(TTTFLOAT_MAX, TTTFLOAT_MAX) : CGSizeZero;
+    return CGRectInset(CGContextGetClipBoundingBox(c), -overhang, -overhang);
+}
 
-        CGFloat textWidth = [self sizeThatFits:maxSize].width;
-        CGFloat availableWidth = self.frame.size.width * self.numberOfLines;
-        if (self.numberOfLines > 1 && self.lineBreakMode == TTTLineBreakByWordWrapping) {
-            textWidth *= kTTTLineBreakWordWrapTextWidthScalingFactor;
+- (void)drawBackground:(TTTAttributedLabelFrame *)textFrame
+                inRect:(__unused CGRect)rect
+               context:(CGContextRef)c
+{
+    NSUInteger count = 0;
+    const TTTAttributedLabelDecoration *decorations = [textFrame decorationsWithBackgroundEdgeInset:_linkBackgroundEdgeInset count:&count];
+    CGRect drawingRect = [self drawingRectForClipOfContext:c];
+
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        TTTAttributedLabelDecoration decoration = decorations[idx];
+        if (decoration.strikeOut || !CGRectIntersectsRect(CGPathGetBoundingBox(decoration.path), drawingRect)) {
+            continue;
         }
 
-        if (textWidth > availableWidth && textWidth > 0.0f) {
-            originalAttributedText = [self.attributedText copy];
+        CGContextSetLineJoin(c, kCGLineJoinRound);
 
-            CGFloat scaleFactor = availableWidth / textWidth;
-            if ([self respondsToSelector:@selector(minimumScaleFactor)] && self.minimumScaleFactor > scaleFactor) {
-                scaleFactor = self.minimumScaleFactor;
-            }
+        if (decoration.fillColor) {
+            CGContextSetFillColorWithColor(c, decoration.fillColor);
+            CGContextAddPath(c, decoration.path);
+            CGContextFillPath(c);
+        }
 
-            self.attributedText = NSAttributedStringByScalingFontSize(self.attributedText, scaleFactor);
+        if (decoration.strokeColor) {
+            CGContextSetStrokeColorWithColor(c, decoration.strokeColor);
+            CGContextAddPath(c, decoration.path);
+            CGContextStrokePath(c);
         }
     }
+}
 
-    CGContextRef c = UIGraphicsGetCurrentContext();
-    CGContextSaveGState(c);
-    {
-        CGContextSetTextMatrix(c, CGAffineTransformIdentity);
-
-        // Inverts the CTM to match iOS coordinates (otherwise text draws upside-down; Mac OS's system is different)
-        CGContextTranslateCTM(c, 0.0f, insetRect.size.height);
-        CGContextScaleCTM(c, 1.0f, -1.0f);
-
-        CFRange textRange = CFRangeMake(0, (CFIndex)[self.attributedText length]);
-
-        // First, get the text rect (which takes vertical centering into account)
-        CGRect textRect = [self textRectForBounds:rect limitedToNumberOfLines:self.numberOfLines];
-
-        // CoreText draws its text aligned to the bottom, so we move the CTM here to take our vertical offsets into account
-        CGContextTranslateCTM(c, insetRect.origin.x, insetRect.size.height - textRect.origin.y - textRect.size.height);
-
-        // Second, trace the shadow before the actual text, if we have one
-        if (self.shadowColor && !self.highlighted) {
-            CGContextSetShadowWithColor(c, self.shadowOffset, self.shadowRadius, [self.shadowColor CGColor]);
-        } else if (self.highlightedShadowColor) {
-            CGContextSetShadowWithColor(c, self.highlightedShadowOffset, self.highlightedShadowRadius, [self.highlightedShadowColor CGColor]);
+- (void)drawStrike:(TTTAttributedLabelFrame *)textFrame
+            inRect:(__unused CGRect)rect
+           context:(CGContextRef)c
+{
+    NSUInteger count = 0;
+    const TTTAttributedLabelDecoration *decorations = [textFrame decorationsWithBackgroundEdgeInset:_linkBackgroundEdgeInset count:&count];
+    CGRect drawingRect = [self drawingRectForClipOfContext:c];
+
+    id font = nil;
+    for (NSUInteger idx = 0; idx < count; idx++) {
+        TTTAttributedLabelDecoration decoration = decorations[idx];
+        if (!decoration.strikeOut || !CGRectIntersectsRect(CGPathGetBoundingBox(decoration.path), drawingRect)) {
+            continue;
         }
 
-        // Finally, draw the text or highlighted text itself (on top of the shadow, if there is one)
-        if (self.highlightedTextColor && self.highlighted) {
-            NSMutableAttributedString *highlightAttributedString = [self.renderedAttributedText mutableCopy];
-            [highlightAttributedString addAttribute:(__bridge NSString *)kCTForegroundColorAttributeName value:(id)[self.highlightedTextColor CGColor] range:NSMakeRange(0, highlightAttributedString.length)];
-
-            if (![self highlightFramesetter]) {
-                CTFramesetterRef highlightFramesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)highlightAttributedString);
-                [self setHighlightFramesetter:highlightFramesetter];
-                CFRelease(highlightFramesetter);
-            }
+        if (!font) {
+            font = TTTFontWithName(_font.fontName, _font.pointSize);
+            CGContextSetLineWidth(c, CTFontGetUnderlineThickness((__bridge CTFontRef)font));
+        }
 
-            [self drawFramesetter:[self highlightFramesetter] attributedString:highlightAttributedString textRange:textRange inRect:textRect context:c];
+        if (_highlightedTextColor) {
+            CGContextSetStrokeColorWithColor(c, [_highlightedTextColor CGColor]);
+        } else if (decoration.strokeColor) {
+            CGContextSetStrokeColorWithColor(c, decoration.strokeColor);
         } else {
-            [self drawFramesetter:[self framesetter] attributedString:self.renderedAttributedText textRange:textRange inRect:textRect context:c];
+            CGContextSetGrayStrokeColor(c, 0.0f, 1.0);
         }
 
-        // If we adjusted the font size, set it back to its original size
-        if (originalAttributedText) {
-            // Use ivar directly to avoid clearing out framesetter and renderedAttributedText
-            _attributedText = originalAttributedText;
-        }
+        CGContextAddPath(c, decoration.path);
+        CGContextStrokePath(c);
     }
-    CGContextRestoreGState(c);
 }
 
-#pragma mark - UIAccessibilityElement
+@end
 
-- (BOOL)isAccessibilityElement {
-    return NO;
+/**
+ The delegate of the layer that shows the text of a tiled label, or of a label caching its bitmap. Tiles are drawn by `CATiledLayer` on background threads as they become visible, and released once they are not.
+ */
+@interface TTTAttributedLabelContentLayerDelegate : NSObject
+@property (atomic, strong) TTTAttributedLabelDrawing *drawing;
+@end
+
+@implementation TTTAttributedLabelContentLayerDelegate
+
+- (void)drawLayer:(__unused CALayer *)layer
+        inContext:(CGContextRef)ctx
+{
+    // The tile being drawn is already the context's clip
+    [self.drawing drawInContext:ctx];
 }
 
-- (NSInteger)accessibilityElementCount {
-    return (NSInteger)[[self accessibilityElements] count];
+- (id<CAAction>)actionForLayer:(__unused CALayer *)layer
+                        forKey:(__unused NSString *)event
+{
+    // The layer follows the label without animating
+    return (id<CAAction>)[NSNull null];
 }
 
-- (id)accessibilityElementAtIndex:(NSInteger)index {
-    return [[self accessibilityElements] objectAtIndex:(NSUInteger)index];
+@end
+
+static inline NSUInteger TTTHashFromCGFloat(CGFloat value) {
+    if (value == 0.0f) {
+        return 0;
+    }
+
+    NSUInteger hash = 0;
+    memcpy(&hash, &value, MIN(sizeof(hash), sizeof(value)));
+
+    return hash;
 }
 
-- (NSInteger)indexOfAccessibilityElement:(id)element {
-    return (NSInteger)[[self accessibilityElements] indexOfObject:element];
+@interface TTTAttributedLabelSizeCacheKey : NSObject <NSCopying>
+@property (readonly, nonatomic, strong) NSAttributedString *attributedString;
+@property (readonly, nonatomic, assign) CGFloat width;
+@property (readonly, nonatomic, assign) NSUInteger numberOfLines;
+
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                                   width:(CGFloat)width
+                           numberOfLines:(NSUInteger)numberOfLines;
+@end
+
+@implementation TTTAttributedLabelSizeCacheKey {
+@private
+    NSUInteger _hash;
 }
 
-- (NSArray *)accessibilityElements {
-    if (!_accessibilityElements) {
-        @synchronized(self) {
-            NSMutableArray *mutableAccessibilityItems = [NSMutableArray array];
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                                   width:(CGFloat)width
+                           numberOfLines:(NSUInteger)numberOfLines
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
 
-            for (TTTAttributedLabelLink *link in self.linkModels) {
-                
-                if (link.result.range.location == NSNotFound) {
-                    continue;
-                }
-                
-                NSString *sourceText = [self.text isKindOfClass:[NSString class]] ? self.text : [(NSAttributedString *)self.text string];
+    _attributedString = attributedString;
+    // A single line is sized without a width constraint, so the width must not split the cache
+    _width = numberOfLines == 1 ? 0.0f : width;
+    _numberOfLines = numberOfLines;
+    _hash = ([[attributedString string] hash] * 31 + [attributedString length]) ^ TTTHashFromCGFloat(_width) ^ (numberOfLines * 2654435761u);
 
-                NSString *accessibilityLabel = [sourceText substringWithRange:link.result.range];
-                NSString *accessibilityValue = link.accessibilityValue;
+    return self;
+}
 
-                if (accessibilityLabel) {
-                    TTTAccessibilityElement *linkElement = [[TTTAccessibilityElement alloc] initWithAccessibilityContainer:self];
-                    linkElement.accessibilityTraits = UIAccessibilityTraitLink;
-                    linkElement.boundingRect = [self boundingRectForCharacterRange:link.result.range];
-                    linkElement.superview = self;
-                    linkElement.accessibilityLabel = accessibilityLabel;
+- (NSUInteger)hash {
+    return _hash;
+}
 
-                    if (![accessibilityLabel isEqualToString:accessibilityValue]) {
-                        linkElement.accessibilityValue = accessibilityValue;
-                    }
+- (BOOL)isEqual:(id)object {
+    if (self == object) {
+        return YES;
+    }
 
-                    [mutableAccessibilityItems addObject:linkElement];
-                }
-            }
+    if (![object isKindOfClass:[TTTAttributedLabelSizeCacheKey class]]) {
+        return NO;
+    }
 
-            TTTAccessibilityElement *baseElement = [[TTTAccessibilityElement alloc] initWithAccessibilityContainer:self];
-            baseElement.accessibilityLabel = [super accessibilityLabel];
-            baseElement.accessibilityHint = [super accessibilityHint];
-            baseElement.accessibilityValue = [super accessibilityValue];
-            baseElement.boundingRect = self.bounds;
-            baseElement.superview = self;
-            baseElement.accessibilityTraits = [super accessibilityTraits];
+    TTTAttributedLabelSizeCacheKey *key = (TTTAttributedLabelSizeCacheKey *)object;
 
-            [mutableAccessibilityItems addObject:baseElement];
+    return _hash == key->_hash && _width == key->_width && _numberOfLines == key->_numberOfLines && (_attributedString == key->_attributedString || [_attributedString isEqualToAttributedString:key->_attributedString]);
+}
 
-            self.accessibilityElements = [NSArray arrayWithArray:mutableAccessibilityItems];
-        }
+- (id)copyWithZone:(NSZone *)zone {
+    // Keys used for lookups may reference a mutable string, which must not leak into the cache
+    if (![_attributedString isKindOfClass:[NSMutableAttributedString class]]) {
+        return self;
     }
 
-    return _accessibilityElements;
+    return [[[self class] allocWithZone:zone] initWithAttributedString:[_attributedString copy] width:_width numberOfLines:_numberOfLines];
 }
 
-#pragma mark - UIView
+@end
 
-- (CGSize)sizeThatFits:(CGSize)size {
-    if (!self.attributedText) {
-        return [super sizeThatFits:size];
-    } else {
-        NSAttributedString *string = [self renderedAttributedText];
-        
-        CGSize labelSize = CTFramesetterSuggestFrameSizeForAttributedStringWithConstraints([self framesetter], string, size, (NSUInteger)self.numberOfLines);
-        labelSize.width += self.textInsets.left + self.textInsets.right;
-        labelSize.height += self.textInsets.top + self.textInsets.bottom;
+@interface TTTAttributedLabelDataDetectionCacheKey : NSObject <NSCopying>
+@property (readonly, nonatomic, copy) NSString *string;
+@property (readonly, nonatomic, assign) NSTextCheckingTypes checkingTypes;
+@property (readonly, nonatomic, strong) Class dataDetectorClass;
+@property (readonly, nonatomic, copy) NSString *configurationIdentifier;
 
-        return labelSize;
+- (instancetype)initWithString:(NSString *)string
+                  dataDetector:(id <TTTAttributedLabelDataDetector>)dataDetector;
+@end
+
+@implementation TTTAttributedLabelDataDetectionCacheKey {
+@private
+    NSUInteger _hash;
+}
+
+- (instancetype)initWithString:(NSString *)string
+                  dataDetector:(id <TTTAttributedLabelDataDetector>)dataDetector
+{
+    self = [super init];
+    if (!self) {
+        return nil;
     }
+
+    _string = [string copy];
+    // Detectors of different classes may find different results for the same types
+    _checkingTypes = [dataDetector checkingTypes];
+    _dataDetectorClass = [dataDetector class];
+    _configurationIdentifier = [dataDetector respondsToSelector:@selector(configurationIdentifier)] ? [[dataDetector configurationIdentifier] copy] : nil;
+    _hash = ([string hash] * 31 + [string length]) ^ (NSUInteger)_checkingTypes ^ [_dataDetectorClass hash] ^ [_configurationIdentifier hash];
+
+    return self;
 }
 
-- (CGSize)intrinsicContentSize {
-    // There's an implicit width from the original UILabel implementation
-    return [self sizeThatFits:[super intrinsicContentSize]];
+- (NSUInteger)hash {
+    return _hash;
 }
 
-- (void)tintColorDidChange {
-    if (!self.inactiveLinkAttributes || [self.inactiveLinkAttributes count] == 0) {
-        return;
+- (BOOL)isEqual:(id)object {
+    if (self == object) {
+        return YES;
     }
 
-    BOOL isInactive = (self.tintAdjustmentMode == UIViewTintAdjustmentModeDimmed);
+    if (![object isKindOfClass:[TTTAttributedLabelDataDetectionCacheKey class]]) {
+        return NO;
+    }
 
-    NSMutableAttributedString *mutableAttributedString = [self.attributedText mutableCopy];
-    for (TTTAttributedLabelLink *link in self.linkModels) {
-        NSDictionary *attributesToRemove = isInactive ? link.attributes : link.inactiveAttributes;
-        NSDictionary *attributesToAdd = isInactive ? link.inactiveAttributes : link.attributes;
-        
-        [attributesToRemove enumerateKeysAndObjectsUsingBlock:^(NSString *name, __unused id value, __unused BOOL *stop) {
-            if (NSMaxRange(link.result.range) <= mutableAttributedString.length) {
-                [mutableAttributedString removeAttribute:name range:link.result.range];
-            }
-        }];
+    TTTAttributedLabelDataDetectionCacheKey *key = (TTTAttributedLabelDataDetectionCacheKey *)object;
 
-        if (attributesToAdd) {
-            if (NSMaxRange(link.result.range) <= mutableAttributedString.length) {
-                [mutableAttributedString addAttributes:attributesToAdd range:link.result.range];
-            }
-        }
+    return _hash == key->_hash && _checkingTypes == key->_checkingTypes && _dataDetectorClass == key->_dataDetectorClass && (_configurationIdentifier == key->_configurationIdentifier || [_configurationIdentifier isEqualToString:key->_configurationIdentifier]) && (_string == key->_string || [_string isEqualToString:key->_string]);
+}
+
+- (id)copyWithZone:(__unused NSZone *)zone {
+    return self;
+}
+
+@end
+
+@interface TTTAttributedLabelStyleCacheKey : NSObject <NSCopying>
+- (instancetype)initWithComponents:(NSArray *)components;
+@end
+
+@implementation TTTAttributedLabelStyleCacheKey {
+@private
+    NSArray *_components;
+    NSUInteger _hash;
+}
+
+- (instancetype)initWithComponents:(NSArray *)components {
+    self = [super init];
+    if (!self) {
+        return nil;
     }
 
-    self.attributedText = mutableAttributedString;
+    _components = [components copy];
+    for (id component in _components) {
+        _hash = _hash * 31 + [component hash];
+    }
 
-    [self setNeedsDisplay];
+    return self;
 }
 
-- (UIView *)hitTest:(CGPoint)point
-          withEvent:(UIEvent *)event
-{
-    if (![self linkAtPoint:point] || !self.userInteractionEnabled || self.hidden || self.alpha < 0.01) {
-        return [super hitTest:point withEvent:event];
+- (NSUInteger)hash {
+    return _hash;
+}
+
+- (BOOL)isEqual:(id)object {
+    if (self == object) {
+        return YES;
+    }
+
+    if (![object isKindOfClass:[TTTAttributedLabelStyleCacheKey class]]) {
+        return NO;
     }
 
+    TTTAttributedLabelStyleCacheKey *key = (TTTAttributedLabelStyleCacheKey *)object;
+
+    return _hash == key->_hash && [_components isEqualToArray:key->_components];
+}
+
+- (id)copyWithZone:(__unused NSZone *)zone {
     return self;
 }
 
-#pragma mark - UIResponder
+@end
 
-- (BOOL)canBecomeFirstResponder {
-    return YES;
+static id TTTInternedStyleObject(NSArray *components, id (^createObject)(void)) {
+    TTTAttributedLabelCache *styleCache = [TTTAttributedLabel sharedStyleCache];
+    TTTAttributedLabelStyleCacheKey *key = [[TTTAttributedLabelStyleCacheKey alloc] initWithComponents:components];
+
+    id object = [styleCache objectForKey:key];
+    if (!object) {
+        object = createObject();
+        if (object) {
+            [styleCache setObject:object forKey:key];
+        }
+    }
+
+    return object;
 }
 
-- (BOOL)canPerformAction:(SEL)action
-              withSender:(__unused id)sender
-{
-#if !TARGET_OS_TV
-    return (action == @selector(copy:));
-#else
-    return NO;
-#endif
+static inline id TTTFontWithName(NSString *fontName, CGFloat pointSize) {
+    if (!fontName) {
+        return nil;
+    }
+
+    return TTTInternedStyleObject(@[@"font", fontName, @(pointSize)], ^id{
+        return CFBridgingRelease(CTFontCreateWithName((__bridge CFStringRef)fontName, pointSize, NULL));
+    });
 }
 
-- (void)touchesBegan:(NSSet *)touches
-           withEvent:(UIEvent *)event
-{
-    UITouch *touch = [touches anyObject];
+#pragma mark - TTTAttributedLabelCacheArchive
+
+static uint32_t const kTTTCacheArchiveMagic = 0x54545443;
+static uint32_t const kTTTCacheArchiveVersion = 2;
+static uint64_t const kTTTCacheArchiveHashSeed = 14695981039346656037ULL;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t environmentHash;
+    uint64_t checksum;
+    uint32_t sizeCount;
+    uint32_t detectionCount;
+    uint32_t resultCount;
+    uint32_t stringDataLength;
+} TTTCacheArchiveHeader;
+
+typedef struct {
+    uint64_t hash;
+    double width;
+    double fittingWidth;
+    double fittingHeight;
+    uint32_t numberOfLines;
+    uint32_t length;
+    uint64_t checksum;
+} TTTCacheArchiveSizeRecord;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t length;
+    uint32_t firstResult;
+    uint32_t resultCount;
+    uint32_t reserved;
+    uint64_t checksum;
+} TTTCacheArchiveDetectionRecord;
+
+typedef struct {
+    uint32_t location;
+    uint32_t length;
+    uint32_t resultType;
+    uint32_t stringOffset;
+    uint32_t stringLength;
+    uint32_t reserved;
+} TTTCacheArchiveResultRecord;
+
+// FNV-1a, which unlike -hash is stable across launches
+static inline uint64_t TTTCacheArchiveHashBytes(uint64_t hash, const void *bytes, size_t length) {
+    const uint8_t *byte = (const uint8_t *)bytes;
+    for (size_t idx = 0; idx < length; idx++) {
+        hash ^= byte[idx];
+        hash *= 1099511628211ULL;
+    }
 
-    self.activeLink = [self linkAtPoint:[touch locationInView:self]];
+    return hash;
+}
 
-    if (!self.activeLink) {
-        [super touchesBegan:touches withEvent:event];
+// Checksums are computed a word at a time, since they cover the records as written rather than keys that must hash alike across launches
+static inline uint64_t TTTCacheArchiveChecksum(uint64_t checksum, const void *bytes, size_t length) {
+    const uint8_t *byte = (const uint8_t *)bytes;
+    for (; length >= sizeof(uint64_t); byte += sizeof(uint64_t), length -= sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, byte, sizeof(word));
+        checksum = (checksum ^ word) * 1099511628211ULL;
+        checksum ^= checksum >> 32;
     }
+
+    return TTTCacheArchiveHashBytes(checksum, byte, length);
 }
 
-- (void)touchesMoved:(NSSet *)touches
-           withEvent:(UIEvent *)event
-{
-    if (self.activeLink) {
-        UITouch *touch = [touches anyObject];
+static inline uint64_t TTTCacheArchiveHeaderChecksum(const TTTCacheArchiveHeader *header) {
+    TTTCacheArchiveHeader uncheckedHeader = *header;
+    uncheckedHeader.checksum = 0;
 
-        if (self.activeLink != [self linkAtPoint:[touch locationInView:self]]) {
-            self.activeLink = nil;
+    return TTTCacheArchiveChecksum(kTTTCacheArchiveHashSeed, &uncheckedHeader, sizeof(uncheckedHeader));
+}
+
+static inline uint64_t TTTCacheArchiveSizeRecordChecksum(const TTTCacheArchiveSizeRecord *record) {
+    return TTTCacheArchiveChecksum(kTTTCacheArchiveHashSeed, record, offsetof(TTTCacheArchiveSizeRecord, checksum));
+}
+
+// Covers the record, its results, and their strings, which must all be within the archive
+static uint64_t TTTCacheArchiveDetectionRecordChecksum(const TTTCacheArchiveDetectionRecord *record, const TTTCacheArchiveResultRecord *resultRecords, const char *stringData) {
+    uint64_t checksum = TTTCacheArchiveChecksum(kTTTCacheArchiveHashSeed, record, offsetof(TTTCacheArchiveDetectionRecord, checksum));
+    checksum = TTTCacheArchiveChecksum(checksum, resultRecords, record->resultCount * sizeof(TTTCacheArchiveResultRecord));
+    for (uint32_t idx = 0; idx < record->resultCount; idx++) {
+        checksum = TTTCacheArchiveChecksum(checksum, stringData + resultRecords[idx].stringOffset, resultRecords[idx].stringLength);
+    }
+
+    return checksum;
+}
+
+static uint64_t TTTCacheArchiveHashString(uint64_t hash, NSString *string) {
+    unichar buffer[256];
+    NSUInteger length = [string length];
+    for (NSUInteger location = 0; location < length; location += 256) {
+        NSRange range = NSMakeRange(location, MIN((NSUInteger)256, length - location));
+        [string getCharacters:buffer range:range];
+        hash = TTTCacheArchiveHashBytes(hash, buffer, range.length * sizeof(unichar));
+    }
+
+    uint64_t stringLength = length;
+    return TTTCacheArchiveHashBytes(hash, &stringLength, sizeof(stringLength));
+}
+
+static BOOL TTTCacheArchiveHashAttributeValue(uint64_t *hash, id value) {
+    if ([value isKindOfClass:[NSString class]]) {
+        *hash = TTTCacheArchiveHashString(*hash, value);
+        return YES;
+    } else if ([value isKindOfClass:[NSURL class]]) {
+        *hash = TTTCacheArchiveHashString(*hash, [value absoluteString]);
+        return YES;
+    } else if ([value isKindOfClass:[NSParagraphStyle class]]) {
+        *hash = TTTCacheArchiveHashString(*hash, [value description]);
+        return YES;
+    } else if ([value isKindOfClass:[UIColor class]]) {
+        value = (__bridge id)[value CGColor];
+    } else if ([value isKindOfClass:[NSValue class]]) {
+        NSUInteger size = 0;
+        NSGetSizeAndAlignment([value objCType], &size, NULL);
+        if (size > 64) {
+            return NO;
         }
-    } else {
-        [super touchesMoved:touches withEvent:event];
+
+        uint8_t bytes[64] = {0};
+        [value getValue:bytes];
+        *hash = TTTCacheArchiveHashBytes(*hash, [value objCType], strlen([value objCType]));
+        *hash = TTTCacheArchiveHashBytes(*hash, bytes, size);
+        return YES;
+    }
+
+    if (!value) {
+        return NO;
+    }
+
+    CFTypeID typeID = CFGetTypeID((__bridge CFTypeRef)value);
+    if (typeID == CTFontGetTypeID()) {
+        double pointSize = CTFontGetSize((__bridge CTFontRef)value);
+        *hash = TTTCacheArchiveHashString(*hash, CFBridgingRelease(CTFontCopyPostScriptName((__bridge CTFontRef)value)));
+        *hash = TTTCacheArchiveHashBytes(*hash, &pointSize, sizeof(pointSize));
+        return YES;
+    } else if (typeID == CGColorGetTypeID()) {
+        CGColorRef color = (__bridge CGColorRef)value;
+        int32_t model = (int32_t)CGColorSpaceGetModel(CGColorGetColorSpace(color));
+        *hash = TTTCacheArchiveHashBytes(*hash, &model, sizeof(model));
+
+        const CGFloat *components = CGColorGetComponents(color);
+        for (size_t idx = 0; idx < CGColorGetNumberOfComponents(color); idx++) {
+            double component = components[idx];
+            *hash = TTTCacheArchiveHashBytes(*hash, &component, sizeof(component));
+        }
+
+        return YES;
     }
+
+    // Other values have no content that is known to be stable across launches
+    return NO;
 }
 
-- (void)touchesEnded:(NSSet *)touches
-           withEvent:(UIEvent *)event
+static BOOL TTTCacheArchiveHashAttributedString(NSAttributedString *attributedString, uint64_t *outHash) {
+    __block uint64_t hash = TTTCacheArchiveHashString(kTTTCacheArchiveHashSeed, [attributedString string]);
+    __block BOOL isHashable = YES;
+    [attributedString enumerateAttributesInRange:NSMakeRange(0, [attributedString length]) options:0 usingBlock:^(NSDictionary *attributes, NSRange range, BOOL *stop) {
+        uint64_t runRange[2] = { range.location, range.length };
+        hash = TTTCacheArchiveHashBytes(hash, runRange, sizeof(runRange));
+
+        for (NSString *attributeName in [[attributes allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+            hash = TTTCacheArchiveHashString(hash, attributeName);
+
+            uint64_t valueHash = hash;
+            if (!TTTCacheArchiveHashAttributeValue(&valueHash, [attributes objectForKey:attributeName])) {
+                isHashable = NO;
+                *stop = YES;
+                return;
+            }
+
+            hash = valueHash;
+        }
+    }];
+
+    *outHash = hash;
+
+    return isHashable;
+}
+
+static uint64_t TTTCacheArchiveHashDataDetectionKey(TTTAttributedLabelDataDetectionCacheKey *key) {
+    uint64_t checkingTypes = key.checkingTypes;
+    uint64_t hash = TTTCacheArchiveHashString(kTTTCacheArchiveHashSeed, key.string);
+    hash = TTTCacheArchiveHashBytes(hash, &checkingTypes, sizeof(checkingTypes));
+    hash = TTTCacheArchiveHashString(hash, key.configurationIdentifier ?: @"");
+
+    return TTTCacheArchiveHashString(hash, NSStringFromClass(key.dataDetectorClass));
+}
+
+static uint64_t TTTCacheArchiveEnvironmentHash(void) {
+    static uint64_t _environmentHash = 0;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        // Text is typeset differently across OS versions, so archives from other versions are not used
+        uint32_t version = kTTTCacheArchiveVersion;
+        uint64_t hash = TTTCacheArchiveHashBytes(kTTTCacheArchiveHashSeed, &version, sizeof(version));
+        _environmentHash = TTTCacheArchiveHashString(hash, [[UIDevice currentDevice] systemVersion]);
+    });
+
+    return _environmentHash;
+}
+
+static int TTTCacheArchiveCompareRecordHashes(const void *a, const void *b) {
+    uint64_t hashA = *(const uint64_t *)a;
+    uint64_t hashB = *(const uint64_t *)b;
+
+    return hashA < hashB ? -1 : (hashA > hashB ? 1 : 0);
+}
+
+// Returns the index of the first record with a hash, or the record count if there is none
+static inline uint32_t TTTCacheArchiveLowerBound(const void *records, size_t recordSize, uint32_t count, uint64_t hash) {
+    uint32_t low = 0, high = count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (*(const uint64_t *)((const uint8_t *)records + mid * recordSize) < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+@interface TTTAttributedLabelCache ()
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id object))block;
+@end
+
+/**
+ A read-only, memory-mapped archive of sizes and data detection results, whose records are sorted by a hash of their content so that they can be found without reading every entry.
+ */
+@interface TTTAttributedLabelCacheArchive : NSObject
++ (NSData *)dataWithSizeCache:(TTTAttributedLabelCache *)sizeCache
+           dataDetectionCache:(TTTAttributedLabelCache *)dataDetectionCache;
+
+- (instancetype)initWithContentsOfFile:(NSString *)path
+                                 error:(NSError * __autoreleasing *)error;
+
+- (BOOL)getSize:(CGSize *)size
+         forKey:(TTTAttributedLabelSizeCacheKey *)key;
+
+- (NSArray *)resultsForKey:(TTTAttributedLabelDataDetectionCacheKey *)key;
+@end
+
+@implementation TTTAttributedLabelCacheArchive {
+@private
+    NSData *_data;
+    const TTTCacheArchiveHeader *_header;
+    const TTTCacheArchiveSizeRecord *_sizeRecords;
+    const TTTCacheArchiveDetectionRecord *_detectionRecords;
+    const TTTCacheArchiveResultRecord *_resultRecords;
+    const char *_stringData;
+}
+
++ (NSData *)dataWithSizeCache:(TTTAttributedLabelCache *)sizeCache
+           dataDetectionCache:(TTTAttributedLabelCache *)dataDetectionCache
 {
-    if (self.activeLink) {
-        if (self.activeLink.linkTapBlock) {
-            self.activeLink.linkTapBlock(self, self.activeLink);
-            self.activeLink = nil;
+    NSMutableData *sizeRecords = [NSMutableData data];
+    [sizeCache enumerateKeysAndObjectsUsingBlock:^(TTTAttributedLabelSizeCacheKey *key, NSValue *value) {
+        uint64_t hash = 0;
+        if ([key.attributedString length] > UINT32_MAX || key.numberOfLines > UINT32_MAX || !TTTCacheArchiveHashAttributedString(key.attributedString, &hash)) {
             return;
         }
-        
-        NSTextCheckingResult *result = self.activeLink.result;
-        self.activeLink = nil;
 
-        switch (result.resultType) {
-            case NSTextCheckingTypeLink:
-                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithURL:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithURL:result.URL];
-                    return;
-                }
-                break;
-            case NSTextCheckingTypeAddress:
-                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithAddress:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithAddress:result.addressComponents];
-                    return;
-                }
-                break;
-            case NSTextCheckingTypePhoneNumber:
-                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithPhoneNumber:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithPhoneNumber:result.phoneNumber];
-                    return;
-                }
-                break;
-            case NSTextCheckingTypeDate:
-                if (result.timeZone && [self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithDate:timeZone:duration:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithDate:result.date timeZone:result.timeZone duration:result.duration];
-                    return;
-                } else if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithDate:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithDate:result.date];
-                    return;
-                }
-                break;
-            case NSTextCheckingTypeTransitInformation:
-                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithTransitInformation:)]) {
-                    [self.delegate attributedLabel:self didSelectLinkWithTransitInformation:result.components];
-                    return;
-                }
-            default:
-                break;
+        CGSize size = [value CGSizeValue];
+        TTTCacheArchiveSizeRecord record = { hash, key.width, size.width, size.height, (uint32_t)key.numberOfLines, (uint32_t)[key.attributedString length], 0 };
+        record.checksum = TTTCacheArchiveSizeRecordChecksum(&record);
+        [sizeRecords appendBytes:&record length:sizeof(record)];
+    }];
+
+    NSMutableData *detectionRecords = [NSMutableData data];
+    NSMutableData *resultRecords = [NSMutableData data];
+    NSMutableData *stringData = [NSMutableData data];
+    [dataDetectionCache enumerateKeysAndObjectsUsingBlock:^(TTTAttributedLabelDataDetectionCacheKey *key, NSArray *results) {
+        if ([key.string length] > UINT32_MAX) {
+            return;
         }
 
-        // Fallback to `attributedLabel:didSelectLinkWithTextCheckingResult:` if no other delegate method matched.
-        if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithTextCheckingResult:)]) {
-            [self.delegate attributedLabel:self didSelectLinkWithTextCheckingResult:result];
+        // Only links and phone numbers can be recreated from a range and a string
+        NSMutableData *entryResultRecords = [NSMutableData data];
+        NSMutableData *entryStringData = [NSMutableData data];
+        for (NSTextCheckingResult *result in results) {
+            NSString *resultString = nil;
+            if (result.resultType == NSTextCheckingTypeLink) {
+                resultString = [result.URL absoluteString];
+            } else if (result.resultType == NSTextCheckingTypePhoneNumber) {
+                resultString = result.phoneNumber;
+            }
+
+            NSData *resultStringData = [resultString dataUsingEncoding:NSUTF8StringEncoding];
+            if (!resultStringData || NSMaxRange(result.range) > [key.string length]) {
+                return;
+            }
+
+            TTTCacheArchiveResultRecord record = { (uint32_t)result.range.location, (uint32_t)result.range.length, (uint32_t)result.resultType, (uint32_t)([stringData length] + [entryStringData length]), (uint32_t)[resultStringData length], 0 };
+            [entryResultRecords appendBytes:&record length:sizeof(record)];
+            [entryStringData appendData:resultStringData];
         }
-    } else {
-        [super touchesEnded:touches withEvent:event];
+
+        TTTCacheArchiveDetectionRecord record = { TTTCacheArchiveHashDataDetectionKey(key), (uint32_t)[key.string length], (uint32_t)([resultRecords length] / sizeof(TTTCacheArchiveResultRecord)), (uint32_t)[results count], 0, 0 };
+        [stringData appendData:entryStringData];
+        record.checksum = TTTCacheArchiveDetectionRecordChecksum(&record, [entryResultRecords bytes], [stringData bytes]);
+        [detectionRecords appendBytes:&record length:sizeof(record)];
+        [resultRecords appendData:entryResultRecords];
+    }];
+
+    qsort([sizeRecords mutableBytes], [sizeRecords length] / sizeof(TTTCacheArchiveSizeRecord), sizeof(TTTCacheArchiveSizeRecord), TTTCacheArchiveCompareRecordHashes);
+    qsort([detectionRecords mutableBytes], [detectionRecords length] / sizeof(TTTCacheArchiveDetectionRecord), sizeof(TTTCacheArchiveDetectionRecord), TTTCacheArchiveCompareRecordHashes);
+
+    NSMutableData *body = [NSMutableData dataWithData:sizeRecords];
+    [body appendData:detectionRecords];
+    [body appendData:resultRecords];
+    [body appendData:stringData];
+
+    TTTCacheArchiveHeader header = {
+        kTTTCacheArchiveMagic,
+        kTTTCacheArchiveVersion,
+        TTTCacheArchiveEnvironmentHash(),
+        0,
+        (uint32_t)([sizeRecords length] / sizeof(TTTCacheArchiveSizeRecord)),
+        (uint32_t)([detectionRecords length] / sizeof(TTTCacheArchiveDetectionRecord)),
+        (uint32_t)([resultRecords length] / sizeof(TTTCacheArchiveResultRecord)),
+        (uint32_t)[stringData length]
+    };
+    header.checksum = TTTCacheArchiveHeaderChecksum(&header);
+
+    NSMutableData *data = [NSMutableData dataWithBytes:&header length:sizeof(header)];
+    [data appendData:body];
+
+    return data;
+}
+
+- (instancetype)initWithContentsOfFile:(NSString *)path
+                                 error:(NSError * __autoreleasing *)error
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:error];
+    if (!_data) {
+        return nil;
+    }
+
+    // Validate the header and the layout of the file up front, so that loading reads no records, and lookups only check the records they read
+    const TTTCacheArchiveHeader *header = (const TTTCacheArchiveHeader *)[_data bytes];
+    uint64_t bodyLength = (uint64_t)[_data length] - MIN((uint64_t)[_data length], (uint64_t)sizeof(TTTCacheArchiveHeader));
+    BOOL isValid = [_data length] >= sizeof(TTTCacheArchiveHeader) && header->magic == kTTTCacheArchiveMagic && header->version == kTTTCacheArchiveVersion;
+    isValid = isValid && header->environmentHash == TTTCacheArchiveEnvironmentHash();
+    isValid = isValid && bodyLength == (uint64_t)header->sizeCount * sizeof(TTTCacheArchiveSizeRecord) + (uint64_t)header->detectionCount * sizeof(TTTCacheArchiveDetectionRecord) + (uint64_t)header->resultCount * sizeof(TTTCacheArchiveResultRecord) + header->stringDataLength;
+    isValid = isValid && header->checksum == TTTCacheArchiveHeaderChecksum(header);
+
+    if (!isValid) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadCorruptFileError userInfo:@{ NSFilePathErrorKey: path ?: @"" }];
+        }
+
+        return nil;
     }
+
+    _header = header;
+    _sizeRecords = (const TTTCacheArchiveSizeRecord *)(header + 1);
+    _detectionRecords = (const TTTCacheArchiveDetectionRecord *)(_sizeRecords + header->sizeCount);
+    _resultRecords = (const TTTCacheArchiveResultRecord *)(_detectionRecords + header->detectionCount);
+    _stringData = (const char *)(_resultRecords + header->resultCount);
+
+    return self;
 }
 
-- (void)touchesCancelled:(NSSet *)touches
-               withEvent:(UIEvent *)event
+- (BOOL)getSize:(CGSize *)size
+         forKey:(TTTAttributedLabelSizeCacheKey *)key
 {
-    if (self.activeLink) {
-        self.activeLink = nil;
-    } else {
-        [super touchesCancelled:touches withEvent:event];
+    uint64_t hash = 0;
+    if (_header->sizeCount == 0 || !TTTCacheArchiveHashAttributedString(key.attributedString, &hash)) {
+        return NO;
     }
+
+    for (uint32_t idx = TTTCacheArchiveLowerBound(_sizeRecords, sizeof(TTTCacheArchiveSizeRecord), _header->sizeCount, hash); idx < _header->sizeCount && _sizeRecords[idx].hash == hash; idx++) {
+        const TTTCacheArchiveSizeRecord *record = &_sizeRecords[idx];
+        if (record->width == (double)key.width && record->numberOfLines == key.numberOfLines && record->length == [key.attributedString length] && record->checksum == TTTCacheArchiveSizeRecordChecksum(record)) {
+            *size = CGSizeMake((CGFloat)record->fittingWidth, (CGFloat)record->fittingHeight);
+            return YES;
+        }
+    }
+
+    return NO;
 }
 
-#pragma mark - UIGestureRecognizerDelegate
+- (NSArray *)resultsForKey:(TTTAttributedLabelDataDetectionCacheKey *)key {
+    if (_header->detectionCount == 0) {
+        return nil;
+    }
 
-- (BOOL)gestureRecognizer:(UIGestureRecognizer *)gestureRecognizer shouldReceiveTouch:(UITouch *)touch {
-    return [self containslinkAtPoint:[touch locationInView:self]];
+    uint64_t hash = TTTCacheArchiveHashDataDetectionKey(key);
+    NSUInteger length = [key.string length];
+    for (uint32_t idx = TTTCacheArchiveLowerBound(_detectionRecords, sizeof(TTTCacheArchiveDetectionRecord), _header->detectionCount, hash); idx < _header->detectionCount && _detectionRecords[idx].hash == hash; idx++) {
+        const TTTCacheArchiveDetectionRecord *record = &_detectionRecords[idx];
+        if (record->length != length || (uint64_t)record->firstResult + record->resultCount > _header->resultCount) {
+            continue;
+        }
+
+        for (uint32_t resultIndex = record->firstResult; resultIndex < record->firstResult + record->resultCount; resultIndex++) {
+            const TTTCacheArchiveResultRecord *resultRecord = &_resultRecords[resultIndex];
+            if ((uint64_t)resultRecord->location + resultRecord->length > length || (uint64_t)resultRecord->stringOffset + resultRecord->stringLength > _header->stringDataLength) {
+                return nil;
+            }
+        }
+
+        if (record->checksum != TTTCacheArchiveDetectionRecordChecksum(record, _resultRecords + record->firstResult, _stringData)) {
+            return nil;
+        }
+
+        NSMutableArray *mutableResults = [NSMutableArray arrayWithCapacity:record->resultCount];
+        for (uint32_t resultIndex = record->firstResult; resultIndex < record->firstResult + record->resultCount; resultIndex++) {
+            const TTTCacheArchiveResultRecord *resultRecord = &_resultRecords[resultIndex];
+
+            NSRange range = NSMakeRange(resultRecord->location, resultRecord->length);
+            NSString *resultString = [[NSString alloc] initWithBytes:_stringData + resultRecord->stringOffset length:resultRecord->stringLength encoding:NSUTF8StringEncoding];
+            NSTextCheckingResult *result = nil;
+            if (resultRecord->resultType == NSTextCheckingTypeLink) {
+                NSURL *URL = resultString ? [NSURL URLWithString:resultString] : nil;
+                result = URL ? [NSTextCheckingResult linkCheckingResultWithRange:range URL:URL] : nil;
+            } else if (resultRecord->resultType == NSTextCheckingTypePhoneNumber) {
+                result = resultString ? [NSTextCheckingResult phoneNumberCheckingResultWithRange:range phoneNumber:resultString] : nil;
+            }
+
+            if (!result) {
+                return nil;
+            }
+
+            [mutableResults addObject:result];
+        }
+
+        return mutableResults;
+    }
+
+    return nil;
 }
 
-#pragma mark - UILongPressGestureRecognizer
+@end
 
-- (void)longPressGestureDidFire:(UILongPressGestureRecognizer *)sender {
-    switch (sender.state) {
-        case UIGestureRecognizerStateBegan: {
-            CGPoint touchPoint = [sender locationInView:self];
-            TTTAttributedLabelLink *link = [self linkAtPoint:touchPoint];
-            
-            if (link) {
-                if (link.linkLongPressBlock) {
-                    link.linkLongPressBlock(self, link);
-                    return;
-                }
-                
-                NSTextCheckingResult *result = link.result;
-                
-                if (!result) {
-                    return;
-                }
-                
-                switch (result.resultType) {
-                    case NSTextCheckingTypeLink:
-                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithURL:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithURL:result.URL atPoint:touchPoint];
-                            return;
-                        }
-                        break;
-                    case NSTextCheckingTypeAddress:
-                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithAddress:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithAddress:result.addressComponents atPoint:touchPoint];
-                            return;
-                        }
-                        break;
-                    case NSTextCheckingTypePhoneNumber:
-                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithPhoneNumber:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithPhoneNumber:result.phoneNumber atPoint:touchPoint];
-                            return;
-                        }
-                        break;
-                    case NSTextCheckingTypeDate:
-                        if (result.timeZone && [self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithDate:timeZone:duration:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithDate:result.date timeZone:result.timeZone duration:result.duration atPoint:touchPoint];
-                            return;
-                        } else if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithDate:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithDate:result.date atPoint:touchPoint];
-                            return;
-                        }
-                        break;
-                    case NSTextCheckingTypeTransitInformation:
-                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithTransitInformation:atPoint:)]) {
-                            [self.delegate attributedLabel:self didLongPressLinkWithTransitInformation:result.components atPoint:touchPoint];
-                            return;
-                        }
-                    default:
-                        break;
-                }
-                
-                // Fallback to `attributedLabel:didLongPressLinkWithTextCheckingResult:atPoint:` if no other delegate method matched.
-                if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithTextCheckingResult:atPoint:)]) {
-                    [self.delegate attributedLabel:self didLongPressLinkWithTextCheckingResult:result atPoint:touchPoint];
-                }
+static TTTAttributedLabelCacheArchive *_loadedCacheArchive = nil;
+
+static inline TTTAttributedLabelCacheArchive * TTTLoadedCacheArchive(void) {
+    @synchronized([TTTAttributedLabelCacheArchive class]) {
+        return _loadedCacheArchive;
+    }
+}
+
+@interface NSDataDetector (TTTAttributedLabelDataDetector) <TTTAttributedLabelDataDetector>
+@end
+
+@implementation NSDataDetector (TTTAttributedLabelDataDetector)
+@end
+
+static NSDataDetector * TTTDataDetectorWithTypes(NSTextCheckingTypes checkingTypes) {
+    // one detector instance per type (combination), fast reuse e.g. in cells
+    static NSMutableDictionary *_dataDetectorsByType = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _dataDetectorsByType = [NSMutableDictionary dictionary];
+    });
+
+    @synchronized(_dataDetectorsByType) {
+        NSDataDetector *dataDetector = [_dataDetectorsByType objectForKey:@(checkingTypes)];
+        if (!dataDetector) {
+            dataDetector = [NSDataDetector dataDetectorWithTypes:checkingTypes error:nil];
+            if (dataDetector) {
+                [_dataDetectorsByType setObject:dataDetector forKey:@(checkingTypes)];
             }
-            break;
         }
-        default:
-            break;
+
+        return dataDetector;
+    }
+}
+
+static CGSize TTTSizeThatFitsAttributedStringWithFramesetter(NSAttributedString *attributedString, CTFramesetterRef framesetter, CGSize size, NSUInteger numberOfLines, TTTAttributedLabel *label) {
+    TTTAttributedLabelCache *sizeCache = [TTTAttributedLabel sharedSizeCache];
+    TTTAttributedLabelSizeCacheKey *key = [[TTTAttributedLabelSizeCacheKey alloc] initWithAttributedString:attributedString width:size.width numberOfLines:numberOfLines];
+
+    NSValue *cachedSize = [sizeCache objectForKey:key];
+    if (cachedSize) {
+        TTTInstrumentationMark(TTTAttributedLabelTraceEventSizeCacheHit, label);
+        return [cachedSize CGSizeValue];
+    }
+
+    TTTInstrumentationMark(TTTAttributedLabelTraceEventSizeCacheMiss, label);
+
+    CGSize archivedSize = CGSizeZero;
+    if ([TTTLoadedCacheArchive() getSize:&archivedSize forKey:key]) {
+        [sizeCache setObject:[NSValue valueWithCGSize:archivedSize] forKey:key];
+        return archivedSize;
+    }
+
+    CGSize calculatedSize = CGSizeZero;
+    if (framesetter) {
+        calculatedSize = CTFramesetterSuggestFrameSizeForAttributedStringWithConstraints(framesetter, attributedString, size, numberOfLines);
+    } else {
+        CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFramesetterCreation, label);
+        framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)attributedString);
+        TTTInstrumentationEnd(TTTAttributedLabelTraceEventFramesetterCreation, label, beginTime);
+        calculatedSize = CTFramesetterSuggestFrameSizeForAttributedStringWithConstraints(framesetter, attributedString, size, numberOfLines);
+        CFRelease(framesetter);
+    }
+
+    [sizeCache setObject:[NSValue valueWithCGSize:calculatedSize] forKey:key];
+
+    return calculatedSize;
+}
+
+/**
+ An immutable snapshot of the text a label draws, along with the number of lines and insets it is laid out with. The framesetter is created on first use and published with a compare-and-swap, so any thread holding a snapshot can measure its text without taking the label's lock or reading the label.
+ */
+@interface TTTAttributedLabelTextSnapshot : NSObject
+@property (readonly, nonatomic, strong) NSAttributedString *attributedString;
+@property (readonly, nonatomic, assign) NSInteger numberOfLines;
+@property (readonly, nonatomic, assign) UIEdgeInsets textInsets;
+
++ (instancetype)snapshotWithAttributedString:(NSAttributedString *)attributedString
+                                 framesetter:(CTFramesetterRef)framesetter
+                               numberOfLines:(NSInteger)numberOfLines
+                                  textInsets:(UIEdgeInsets)textInsets;
+
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                             framesetter:(CTFramesetterRef)framesetter
+                           numberOfLines:(NSInteger)numberOfLines
+                              textInsets:(UIEdgeInsets)textInsets;
+
+- (TTTAttributedLabelTextSnapshot *)snapshotWithNumberOfLines:(NSInteger)numberOfLines
+                                                   textInsets:(UIEdgeInsets)textInsets;
+
+- (CTFramesetterRef)framesetterForLabel:(TTTAttributedLabel *)label;
+@end
+
+@implementation TTTAttributedLabelTextSnapshot {
+@private
+    _Atomic(CTFramesetterRef) _framesetter;
+}
+
++ (instancetype)snapshotWithAttributedString:(NSAttributedString *)attributedString
+                                 framesetter:(CTFramesetterRef)framesetter
+                               numberOfLines:(NSInteger)numberOfLines
+                                  textInsets:(UIEdgeInsets)textInsets
+{
+    // Labels without text, such as those cleared for reuse, all publish the same snapshot, since there is nothing to lay out
+    static TTTAttributedLabelTextSnapshot *_emptySnapshot = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _emptySnapshot = [[self alloc] initWithAttributedString:nil framesetter:NULL numberOfLines:0 textInsets:UIEdgeInsetsZero];
+    });
+
+    if (!attributedString && !framesetter) {
+        return _emptySnapshot;
+    }
+
+    return [[self alloc] initWithAttributedString:attributedString framesetter:framesetter numberOfLines:numberOfLines textInsets:textInsets];
+}
+
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                             framesetter:(CTFramesetterRef)framesetter
+                           numberOfLines:(NSInteger)numberOfLines
+                              textInsets:(UIEdgeInsets)textInsets
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _attributedString = attributedString;
+    _numberOfLines = numberOfLines;
+    _textInsets = textInsets;
+
+    if (framesetter) {
+        CFRetain(framesetter);
+    }
+
+    atomic_init(&_framesetter, framesetter);
+
+    return self;
+}
+
+- (void)dealloc {
+    CTFramesetterRef framesetter = atomic_load(&_framesetter);
+    if (framesetter) {
+        CFRelease(framesetter);
+    }
+}
+
+- (TTTAttributedLabelTextSnapshot *)snapshotWithNumberOfLines:(NSInteger)numberOfLines
+                                                   textInsets:(UIEdgeInsets)textInsets
+{
+    // The text is unchanged, so its framesetter, if one was created, is shared
+    return [[self class] snapshotWithAttributedString:self.attributedString framesetter:atomic_load(&_framesetter) numberOfLines:numberOfLines textInsets:textInsets];
+}
+
+- (CTFramesetterRef)framesetterForLabel:(TTTAttributedLabel *)label {
+    CTFramesetterRef framesetter = atomic_load(&_framesetter);
+    if (!framesetter && self.attributedString) {
+        CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFramesetterCreation, label);
+        CTFramesetterRef newFramesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)self.attributedString);
+        TTTInstrumentationEnd(TTTAttributedLabelTraceEventFramesetterCreation, label, beginTime);
+
+        CTFramesetterRef expectedFramesetter = NULL;
+        if (atomic_compare_exchange_strong(&_framesetter, &expectedFramesetter, newFramesetter)) {
+            framesetter = newFramesetter;
+        } else {
+            // Another thread published its framesetter first
+            CFRelease(newFramesetter);
+            framesetter = expectedFramesetter;
+        }
+    }
+
+    return framesetter;
+}
+
+@end
+
+@interface TTTAttributedLabelLayout ()
+@property (readonly, nonatomic, assign) CTFramesetterRef framesetter;
+@property (readonly, nonatomic, assign) CTFrameRef frame;
+@property (readonly, nonatomic, assign) CGRect bounds;
+@property (readonly, nonatomic, assign) CGRect textRect;
+@end
+
+@interface TTTAttributedLabelLink ()
+@property (readwrite, nonatomic, strong) NSTextCheckingResult *result;
+@end
+
+static inline NSRange TTTRangeAdjustedForReplacement(NSRange range, NSRange replacedRange, NSUInteger replacementLength) {
+    // Ranges that overlap the replaced characters grow to cover their replacement, but text inserted at their end is not theirs
+    NSUInteger location = range.location;
+    if (location >= NSMaxRange(replacedRange)) {
+        location = location - replacedRange.length + replacementLength;
+    } else if (location > replacedRange.location) {
+        location = replacedRange.location;
+    }
+
+    NSUInteger end = NSMaxRange(range);
+    if (end > NSMaxRange(replacedRange) || (end == NSMaxRange(replacedRange) && replacedRange.length > 0)) {
+        end = end - replacedRange.length + replacementLength;
+    } else if (end > replacedRange.location) {
+        end = replacedRange.location + replacementLength;
+    }
+
+    return NSMakeRange(location, end - location);
+}
+
+static inline void TTTRestoreAttributesUnderLinkAttributes(NSMutableAttributedString *attributedString, NSDictionary *linkAttributes, NSDictionary *labelAttributes, NSRange range) {
+    if (range.length == 0) {
+        return;
+    }
+
+    for (id key in linkAttributes) {
+        [attributedString removeAttribute:key range:range];
+
+        if (labelAttributes[key]) {
+            [attributedString addAttribute:key value:labelAttributes[key] range:range];
+        }
+    }
+}
+
+static inline NSArray * TTTTextCheckingResultsByAdjustingRanges(NSArray *results, NSInteger offset) {
+    if (offset == 0) {
+        return results;
+    }
+
+    NSMutableArray *mutableResults = [NSMutableArray arrayWithCapacity:[results count]];
+    for (NSTextCheckingResult *result in results) {
+        [mutableResults addObject:[result resultByAdjustingRangesWithOffset:offset]];
+    }
+
+    return mutableResults;
+}
+
+@interface TTTAttributedLabel ()
+@property (readwrite, nonatomic, copy) NSAttributedString *inactiveAttributedText;
+@property (readonly, nonatomic, strong) NSAttributedString *renderedAttributedText;
+// Swapped as a whole on the main thread, and read from any thread
+@property (readwrite, atomic, strong) TTTAttributedLabelTextSnapshot *publishedTextSnapshot;
+@property (readwrite, nonatomic, strong) NSArray *linkModels;
+@property (readwrite, nonatomic, strong) TTTAttributedLabelLink *activeLink;
+
+- (void) longPressGestureDidFire:(UILongPressGestureRecognizer *)sender;
+@end
+
+@implementation TTTAttributedLabel {
+@private
+    TTTAttributedLabelFrame *_textFrame;
+    TTTAttributedLabelLinkIndex *_linkIndex;
+    TTTAttributedLabelLinkIntervals *_linkIntervals;
+    NSArray *_links;
+    NSUInteger _linkUpdateDepth;
+    NSMutableArray *_pendingLinkModels;
+    NSHashTable *_detectedLinkModels;
+    NSUInteger _dataDetectionGeneration;
+    NSOperation *_dataDetectionOperation;
+    NSRange _dataDetectionRange;
+    NSAttributedString *_fittedAttributedText;
+    CGSize _fittedTextSize;
+    NSDictionary *_activeLinkOverlayAttributes;
+    TTTAttributedLabelFrame *_activeLinkTextFrame;
+    TTTAttributedLabelLink *_truncationTokenLink;
+    NSMutableArray *_accessibilityElements;
+    NSMapTable *_linkAccessibilityElements;
+    TTTAttributedLabelCounters *_instrumentationCounters;
+    CALayer *_contentLayer;
+    TTTAttributedLabelContentLayerDelegate *_contentLayerDelegate;
+    BOOL _needsContentLayerUpdate;
+    BOOL _tiledRenderingEnabled;
+    BOOL _bitmapCachingEnabled;
+}
+
+@dynamic text;
+@synthesize attributedText = _attributedText;
+
+#ifndef kCFCoreFoundationVersionNumber_iOS_7_0
+#define kCFCoreFoundationVersionNumber_iOS_7_0 847.2
+#endif
+
++ (void)load {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        if (kCFCoreFoundationVersionNumber < kCFCoreFoundationVersionNumber_iOS_7_0) {
+            Class class = [self class];
+            Class superclass = class_getSuperclass(class);
+
+            NSArray *strings = @[
+                                 NSStringFromSelector(@selector(isAccessibilityElement)),
+                                 NSStringFromSelector(@selector(accessibilityElementCount)),
+                                 NSStringFromSelector(@selector(accessibilityElementAtIndex:)),
+                                 NSStringFromSelector(@selector(indexOfAccessibilityElement:)),
+                                 ];
+
+            for (NSString *string in strings) {
+                SEL selector = NSSelectorFromString(string);
+                IMP superImplementation = class_getMethodImplementation(superclass, selector);
+                Method method = class_getInstanceMethod(class, selector);
+                const char *types = method_getTypeEncoding(method);
+                class_replaceMethod(class, selector, superImplementation, types);
+            }
+        }
+    });
+}
+
+- (instancetype)initWithFrame:(CGRect)frame {
+    self = [super initWithFrame:frame];
+    if (!self) {
+        return nil;
+    }
+
+    [self commonInit];
+
+    return self;
+}
+
+- (void)commonInit {
+    self.publishedTextSnapshot = [TTTAttributedLabelTextSnapshot snapshotWithAttributedString:[self attributedStringForRendering] framesetter:NULL numberOfLines:self.numberOfLines textInsets:self.textInsets];
+
+    self.userInteractionEnabled = YES;
+#if !TARGET_OS_TV
+    self.multipleTouchEnabled = NO;
+#endif
+
+    self.textInsets = UIEdgeInsetsZero;
+    self.lineHeightMultiple = 1.0f;
+
+    self.linkModels = [NSArray array];
+
+    self.linkBackgroundEdgeInset = UIEdgeInsetsMake(0.0f, -1.0f, 0.0f, -1.0f);
+
+    // The default link attributes are immutable, so they are created once and shared by all labels
+    static NSDictionary *_defaultLinkAttributes = nil;
+    static NSDictionary *_defaultActiveLinkAttributes = nil;
+    static NSDictionary *_defaultInactiveLinkAttributes = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableDictionary *mutableLinkAttributes = [NSMutableDictionary dictionary];
+        [mutableLinkAttributes setObject:[NSNumber numberWithBool:YES] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+
+        NSMutableDictionary *mutableActiveLinkAttributes = [NSMutableDictionary dictionary];
+        [mutableActiveLinkAttributes setObject:[NSNumber numberWithBool:NO] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+
+        NSMutableDictionary *mutableInactiveLinkAttributes = [NSMutableDictionary dictionary];
+        [mutableInactiveLinkAttributes setObject:[NSNumber numberWithBool:NO] forKey:(NSString *)kCTUnderlineStyleAttributeName];
+
+        if ([NSMutableParagraphStyle class]) {
+            [mutableLinkAttributes setObject:[UIColor blueColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+            [mutableActiveLinkAttributes setObject:[UIColor redColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+            [mutableInactiveLinkAttributes setObject:[UIColor grayColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+        } else {
+            [mutableLinkAttributes setObject:(__bridge id)[[UIColor blueColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+            [mutableActiveLinkAttributes setObject:(__bridge id)[[UIColor redColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+            [mutableInactiveLinkAttributes setObject:(__bridge id)[[UIColor grayColor] CGColor] forKey:(NSString *)kCTForegroundColorAttributeName];
+        }
+
+        _defaultLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(mutableLinkAttributes);
+        _defaultActiveLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(mutableActiveLinkAttributes);
+        _defaultInactiveLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(mutableInactiveLinkAttributes);
+    });
+
+    _linkAttributes = _defaultLinkAttributes;
+    _activeLinkAttributes = _defaultActiveLinkAttributes;
+    _inactiveLinkAttributes = _defaultInactiveLinkAttributes;
+    _extendsLinkTouchArea = NO;
+}
+
+- (UILongPressGestureRecognizer *)longPressGestureRecognizer {
+    // Most labels never show a link, so the recognizer is only created once it is needed
+    if (!_longPressGestureRecognizer) {
+        _longPressGestureRecognizer = [[UILongPressGestureRecognizer alloc] initWithTarget:self
+                                                                                    action:@selector(longPressGestureDidFire:)];
+        _longPressGestureRecognizer.delegate = self;
+        [self addGestureRecognizer:_longPressGestureRecognizer];
+    }
+
+    return _longPressGestureRecognizer;
+}
+
+- (void)dealloc {
+    if (_longPressGestureRecognizer) {
+        [self removeGestureRecognizer:_longPressGestureRecognizer];
+    }
+
+    [_dataDetectionOperation cancel];
+
+    if (_instrumentationCounters) {
+        free(_instrumentationCounters);
+    }
+}
+
+#pragma mark -
+
++ (CGSize)sizeThatFitsAttributedString:(NSAttributedString *)attributedString
+                       withConstraints:(CGSize)size
+                limitedToNumberOfLines:(NSUInteger)numberOfLines
+{
+    if (!attributedString || attributedString.length == 0) {
+        return CGSizeZero;
+    }
+
+    return TTTSizeThatFitsAttributedStringWithFramesetter(attributedString, NULL, size, numberOfLines, nil);
+}
+
++ (void)setPrecomputedSize:(CGSize)size
+        forAttributedString:(NSAttributedString *)attributedString
+            withConstraints:(CGSize)constraints
+     limitedToNumberOfLines:(NSUInteger)numberOfLines
+{
+    if (!attributedString || attributedString.length == 0) {
+        return;
+    }
+
+    TTTAttributedLabelSizeCacheKey *key = [[TTTAttributedLabelSizeCacheKey alloc] initWithAttributedString:attributedString width:constraints.width numberOfLines:numberOfLines];
+    [[self sharedSizeCache] setObject:[NSValue valueWithCGSize:size] forKey:key];
+}
+
++ (BOOL)writeCacheArchiveToFile:(NSString *)path
+                          error:(NSError * __autoreleasing *)error
+{
+    NSData *data = [TTTAttributedLabelCacheArchive dataWithSizeCache:[self sharedSizeCache] dataDetectionCache:[self sharedDataDetectionCache]];
+
+    return [data writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
++ (BOOL)loadCacheArchiveFromFile:(NSString *)path
+                           error:(NSError * __autoreleasing *)error
+{
+    TTTAttributedLabelCacheArchive *archive = [[TTTAttributedLabelCacheArchive alloc] initWithContentsOfFile:path error:error];
+    if (!archive) {
+        return NO;
+    }
+
+    @synchronized([TTTAttributedLabelCacheArchive class]) {
+        _loadedCacheArchive = archive;
+    }
+
+    return YES;
+}
+
++ (void)unloadCacheArchive {
+    @synchronized([TTTAttributedLabelCacheArchive class]) {
+        _loadedCacheArchive = nil;
+    }
+}
+
++ (NSArray *)sizesThatFitAttributedStrings:(NSArray *)attributedStrings
+                           withConstraints:(CGSize)size
+                    limitedToNumberOfLines:(NSUInteger)numberOfLines
+{
+    return [self sizesThatFitAttributedStrings:attributedStrings withConstraints:size limitedToNumberOfLines:numberOfLines progress:nil];
+}
+
++ (NSProgress *)calculateSizesThatFitAttributedStrings:(NSArray *)attributedStrings
+                                       withConstraints:(CGSize)size
+                                limitedToNumberOfLines:(NSUInteger)numberOfLines
+                                            completion:(void (^)(NSArray *sizes))completion
+{
+    NSArray *strings = [attributedStrings copy];
+    NSProgress *progress = [[NSProgress alloc] initWithParent:nil userInfo:nil];
+    progress.totalUnitCount = (int64_t)[strings count];
+    progress.cancellable = YES;
+
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSArray *sizes = [self sizesThatFitAttributedStrings:strings withConstraints:size limitedToNumberOfLines:numberOfLines progress:progress];
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion(sizes);
+            });
+        }
+    });
+
+    return progress;
+}
+
++ (NSArray *)sizesThatFitAttributedStrings:(NSArray *)attributedStrings
+                           withConstraints:(CGSize)size
+                    limitedToNumberOfLines:(NSUInteger)numberOfLines
+                                  progress:(NSProgress *)progress
+{
+    NSUInteger count = [attributedStrings count];
+    if (count == 0) {
+        return [NSArray array];
+    }
+
+    // Each chunk writes the sizes of its own strings, so the results need no locking and stay in input order
+    CGSize *sizes = calloc(count, sizeof(CGSize));
+    size_t chunkCount = (count + TTTBatchMeasurementChunkSize - 1) / TTTBatchMeasurementChunkSize;
+    dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunkIndex) {
+        if ([progress isCancelled]) {
+            return;
+        }
+
+        NSUInteger location = chunkIndex * TTTBatchMeasurementChunkSize;
+        NSUInteger end = MIN(location + TTTBatchMeasurementChunkSize, count);
+        for (NSUInteger idx = location; idx < end; idx++) {
+            @autoreleasepool {
+                sizes[idx] = [self sizeThatFitsAttributedString:[attributedStrings objectAtIndex:idx] withConstraints:size limitedToNumberOfLines:numberOfLines];
+            }
+        }
+
+        if (progress) {
+            @synchronized(progress) {
+                progress.completedUnitCount += (int64_t)(end - location);
+            }
+        }
+    });
+
+    NSMutableArray *mutableSizes = nil;
+    if (![progress isCancelled]) {
+        mutableSizes = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger idx = 0; idx < count; idx++) {
+            [mutableSizes addObject:[NSValue valueWithCGSize:sizes[idx]]];
+        }
+    }
+
+    free(sizes);
+
+    return mutableSizes;
+}
+
++ (TTTAttributedLabelCache *)sharedSizeCache {
+    static TTTAttributedLabelCache *_sharedSizeCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedSizeCache = [[TTTAttributedLabelCache alloc] init];
+        _sharedSizeCache.countLimit = 512;
+
+        [[NSNotificationCenter defaultCenter] addObserver:_sharedSizeCache selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    });
+
+    return _sharedSizeCache;
+}
+
++ (TTTAttributedLabelCache *)sharedDataDetectionCache {
+    static TTTAttributedLabelCache *_sharedDataDetectionCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedDataDetectionCache = [[TTTAttributedLabelCache alloc] init];
+        _sharedDataDetectionCache.countLimit = 256;
+
+        [[NSNotificationCenter defaultCenter] addObserver:_sharedDataDetectionCache selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    });
+
+    return _sharedDataDetectionCache;
+}
+
++ (TTTAttributedLabelCache *)sharedStyleCache {
+    static TTTAttributedLabelCache *_sharedStyleCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedStyleCache = [[TTTAttributedLabelCache alloc] init];
+        _sharedStyleCache.countLimit = 256;
+
+        [[NSNotificationCenter defaultCenter] addObserver:_sharedStyleCache selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    });
+
+    return _sharedStyleCache;
+}
+
++ (TTTAttributedLabelCache *)sharedBitmapCache {
+    static TTTAttributedLabelCache *_sharedBitmapCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _sharedBitmapCache = [[TTTAttributedLabelCache alloc] init];
+        _sharedBitmapCache.totalCostLimit = TTTBitmapCacheDefaultTotalCostLimit;
+
+        [[NSNotificationCenter defaultCenter] addObserver:_sharedBitmapCache selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    });
+
+    return _sharedBitmapCache;
+}
+
++ (NSOperationQueue *)dataDetectionQueue {
+    static NSOperationQueue *_dataDetectionQueue = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _dataDetectionQueue = [[NSOperationQueue alloc] init];
+        _dataDetectionQueue.name = @"com.tttattributedlabel.data-detection";
+        _dataDetectionQueue.maxConcurrentOperationCount = 2;
+    });
+
+    return _dataDetectionQueue;
+}
+
+#pragma mark - Instrumentation
+
++ (BOOL)isInstrumentationEnabled {
+    return _instrumentationEnabled;
+}
+
++ (void)setInstrumentationEnabled:(BOOL)instrumentationEnabled {
+    _instrumentationEnabled = instrumentationEnabled;
+}
+
++ (void)setTraceBlock:(TTTAttributedLabelTraceBlock)traceBlock {
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        _traceBlock = [traceBlock copy];
+    }
+}
+
++ (TTTAttributedLabelStatistics *)globalStatistics {
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        return [[TTTAttributedLabelStatistics alloc] initWithCounters:_globalCounters];
+    }
+}
+
++ (void)resetGlobalStatistics {
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        memset(&_globalCounters, 0, sizeof(TTTAttributedLabelCounters));
+    }
+}
+
+- (TTTAttributedLabelCounters *)instrumentationCounters {
+    if (!_instrumentationCounters) {
+        _instrumentationCounters = calloc(1, sizeof(TTTAttributedLabelCounters));
+    }
+
+    return _instrumentationCounters;
+}
+
+- (TTTAttributedLabelStatistics *)statistics {
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        TTTAttributedLabelCounters counters = {{0}, {0}};
+        if (_instrumentationCounters) {
+            counters = *_instrumentationCounters;
+        }
+
+        return [[TTTAttributedLabelStatistics alloc] initWithCounters:counters];
+    }
+}
+
+- (NSUInteger)textMemoryFootprint {
+    NSArray *strings = @[self.attributedText ?: [NSNull null], _fittedAttributedText ?: [NSNull null], self.publishedTextSnapshot.attributedString ?: [NSNull null], self.inactiveAttributedText ?: [NSNull null]];
+
+    NSUInteger footprint = 0;
+    NSHashTable *countedStrings = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    for (id string in strings) {
+        if (string != [NSNull null] && ![countedStrings containsObject:string]) {
+            [countedStrings addObject:string];
+            footprint += [(NSAttributedString *)string length] * sizeof(unichar);
+        }
+    }
+
+    return footprint;
+}
+
+- (void)resetStatistics {
+    @synchronized([TTTAttributedLabelStatistics class]) {
+        if (_instrumentationCounters) {
+            memset(_instrumentationCounters, 0, sizeof(TTTAttributedLabelCounters));
+        }
+    }
+}
+
+#pragma mark -
+
+- (void)setAttributedText:(NSAttributedString *)text {
+    if ([text isEqualToAttributedString:_attributedText]) {
+        return;
+    }
+
+    _attributedText = [text copy];
+    _fittedAttributedText = nil;
+    _fittedTextSize = CGSizeZero;
+
+    [self setNeedsFramesetter];
+    [self setNeedsDisplay];
+
+    if ([self respondsToSelector:@selector(invalidateIntrinsicContentSize)]) {
+        [self invalidateIntrinsicContentSize];
+    }
+
+    [super setText:[self.attributedText string]];
+}
+
+- (NSAttributedString *)renderedAttributedText {
+    return [self textSnapshot].attributedString;
+}
+
+- (NSAttributedString *)attributedStringForRendering {
+    // Share the label text unless a truncation token or context colors require a copy
+    NSAttributedString *string = _fittedAttributedText ?: self.attributedText;
+
+    if (self.attributedTruncationToken) {
+        NSMutableAttributedString *fullString = [string mutableCopy];
+        [fullString appendAttributedString:self.attributedTruncationToken];
+        string = fullString;
+    }
+
+    return NSAttributedStringBySettingColorFromContext(string, self.textColor);
+}
+
+- (TTTAttributedLabelTextSnapshot *)textSnapshot {
+    // A snapshot is published when the label is initialized and whenever its rendered text changes, so readers on other threads never have to create one
+    return self.publishedTextSnapshot;
+}
+
+- (void)setAttributedTruncationToken:(NSAttributedString *)attributedTruncationToken {
+    _attributedTruncationToken = attributedTruncationToken;
+
+    [self setNeedsFramesetter];
+    [self setNeedsDisplay];
+}
+
+- (NSArray *) links {
+    @synchronized(self) {
+        if (!_links) {
+            NSMutableArray *mutableLinks = [NSMutableArray arrayWithCapacity:[_linkModels count]];
+            for (TTTAttributedLabelLink *link in _linkModels) {
+                [mutableLinks addObject:link.result ?: [NSNull null]];
+            }
+
+            _links = [NSArray arrayWithArray:mutableLinks];
+        }
+
+        return _links;
+    }
+}
+
+- (void)setLinkModels:(NSArray *)linkModels {
+    _linkModels = linkModels;
+    
+    [_accessibilityElements removeAllObjects];
+
+    if ([linkModels count] > 0) {
+        [self longPressGestureRecognizer];
+    }
+
+    @synchronized(self) {
+        _links = nil;
+        [_linkIndex removeAllFragments];
+        _linkIntervals = nil;
+    }
+}
+
+- (void)setNeedsFramesetter {
+    // Publish the rendered text as a new snapshot, so that other threads see either the old text and framesetter or the new ones, never a mix
+    self.publishedTextSnapshot = [TTTAttributedLabelTextSnapshot snapshotWithAttributedString:[self attributedStringForRendering] framesetter:NULL numberOfLines:self.numberOfLines textInsets:self.textInsets];
+
+    [self setNeedsTextFrame];
+}
+
+- (void)setNeedsTextFrame {
+    @synchronized(self) {
+        _textFrame = nil;
+        [_linkIndex removeAllFragments];
+    }
+}
+
+- (TTTAttributedLabelFrame *)textFrameForBounds:(CGRect)bounds {
+    if (!self.attributedText) {
+        return nil;
+    }
+
+    @synchronized(self) {
+        if (!_textFrame || !CGRectEqualToRect(_textFrame.bounds, bounds) || _textFrame.numberOfLines != self.numberOfLines) {
+            CTFramesetterRef framesetter = [self framesetter];
+            TTTAttributedLabelLayout *textLayout = _textLayout;
+            CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFrameCreation, self);
+
+            if (textLayout && framesetter == textLayout.framesetter && CGRectEqualToRect(bounds, textLayout.bounds) && (NSUInteger)self.numberOfLines == textLayout.numberOfLines && UIEdgeInsetsEqualToEdgeInsets(self.textInsets, textLayout.textInsets)) {
+                // Reuse the lines typeset by the layout
+                _textFrame = [[TTTAttributedLabelFrame alloc] initWithCTFrame:textLayout.frame
+                                                                       bounds:bounds
+                                                                     textRect:textLayout.textRect
+                                                                numberOfLines:self.numberOfLines
+                                                                  flushFactor:TTTFlushFactorForTextAlignment(self.textAlignment)];
+            } else {
+                CGRect textRect = [self textRectForBounds:bounds limitedToNumberOfLines:self.numberOfLines];
+
+                _textFrame = [[TTTAttributedLabelFrame alloc] initWithFramesetter:framesetter
+                                                                        textRange:CTFramesetterGetBoundedTextRange(framesetter, self.attributedText, CFRangeMake(0, (CFIndex)[self.attributedText length]), textRect.size.width, self.numberOfLines)
+                                                                           bounds:bounds
+                                                                         textRect:textRect
+                                                                    numberOfLines:self.numberOfLines
+                                                                      flushFactor:TTTFlushFactorForTextAlignment(self.textAlignment)];
+            }
+
+            TTTInstrumentationEnd(TTTAttributedLabelTraceEventFrameCreation, self, beginTime);
+
+            beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventTruncation, self);
+            _textFrame.truncationTokenLinkRange = [self truncateTextFrame:_textFrame attributedString:self.renderedAttributedText textRange:CFRangeMake(0, (CFIndex)[self.attributedText length]) overlayAttributes:nil overlayRange:NSMakeRange(NSNotFound, 0)];
+            TTTInstrumentationEnd(TTTAttributedLabelTraceEventTruncation, self, beginTime);
+        }
+
+        return _textFrame;
+    }
+}
+
+- (CTFramesetterRef)framesetter {
+    // Outlive the snapshot, which may be replaced while the caller is still using the framesetter
+    CTFramesetterRef framesetter = [[self textSnapshot] framesetterForLabel:self];
+
+    return framesetter ? (CTFramesetterRef)CFAutorelease(CFRetain(framesetter)) : NULL;
+}
+
+#pragma mark -
+
+- (void)setEnabledTextCheckingTypes:(NSTextCheckingTypes)enabledTextCheckingTypes {
+    if (self.enabledTextCheckingTypes == enabledTextCheckingTypes) {
+        return;
+    }
+    
+    _enabledTextCheckingTypes = enabledTextCheckingTypes;
+
+    // Mentions and hashtags are only found by the scanner
+    if (enabledTextCheckingTypes & (TTTTextCheckingTypeMention | TTTTextCheckingTypeHashtag)) {
+        self.dataDetector = [TTTAttributedLabelScanner scannerWithTypes:enabledTextCheckingTypes];
+    } else {
+        self.dataDetector = enabledTextCheckingTypes ? TTTDataDetectorWithTypes(enabledTextCheckingTypes) : nil;
+    }
+}
+
+- (void)addLink:(TTTAttributedLabelLink *)link {
+    [self addLinks:@[link]];
+}
+
+- (void)addLinks:(NSArray *)links {
+    if (_linkUpdateDepth > 0) {
+        if (!_pendingLinkModels) {
+            _pendingLinkModels = [NSMutableArray array];
+        }
+
+        [_pendingLinkModels addObjectsFromArray:links];
+        return;
+    }
+
+    if ([links count] == 0) {
+        return;
+    }
+
+    NSMutableAttributedString *mutableAttributedString = nil;
+
+    for (TTTAttributedLabelLink *link in links) {
+        if (link.attributes) {
+            if (!mutableAttributedString) {
+                mutableAttributedString = [self.attributedText mutableCopy];
+            }
+
+            [mutableAttributedString addAttributes:link.attributes range:link.result.range];
+        }
+    }
+
+    // Only replace the text, and with it the framesetter, if a link is styled
+    if (mutableAttributedString) {
+        self.attributedText = mutableAttributedString;
+        [self setNeedsDisplay];
+    }
+
+    self.linkModels = [self.linkModels arrayByAddingObjectsFromArray:links];
+}
+
+- (void)performBatchLinkUpdates:(void (^)(void))updates {
+    _linkUpdateDepth++;
+
+    if (updates) {
+        updates();
+    }
+
+    _linkUpdateDepth--;
+
+    if (_linkUpdateDepth == 0 && [_pendingLinkModels count] > 0) {
+        NSArray *pendingLinkModels = [_pendingLinkModels copy];
+        _pendingLinkModels = nil;
+
+        [self addLinks:pendingLinkModels];
+    }
+}
+
+- (TTTAttributedLabelLink *)addLinkWithTextCheckingResult:(NSTextCheckingResult *)result
+                                               attributes:(NSDictionary *)attributes
+{
+    return [self addLinksWithTextCheckingResults:@[result] attributes:attributes].firstObject;
+}
+
+- (NSArray *)addLinksWithTextCheckingResults:(NSArray *)results
+                                  attributes:(NSDictionary *)attributes
+{
+    NSMutableArray *links = [NSMutableArray array];
+    
+    for (NSTextCheckingResult *result in results) {
+        NSDictionary *activeAttributes = attributes ? self.activeLinkAttributes : nil;
+        NSDictionary *inactiveAttributes = attributes ? self.inactiveLinkAttributes : nil;
+        
+        TTTAttributedLabelLink *link = [[TTTAttributedLabelLink alloc] initWithAttributes:attributes
+                                                                         activeAttributes:activeAttributes
+                                                                       inactiveAttributes:inactiveAttributes
+                                                                       textCheckingResult:result];
+        
+        [links addObject:link];
+    }
+    
+    [self addLinks:links];
+    
+    return links;
+}
+
+- (TTTAttributedLabelLink *)addLinkWithTextCheckingResult:(NSTextCheckingResult *)result {
+    return [self addLinkWithTextCheckingResult:result attributes:self.linkAttributes];
+}
+
+- (TTTAttributedLabelLink *)addLinkToURL:(NSURL *)url
+                               withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult linkCheckingResultWithRange:range URL:url]];
+}
+
+- (TTTAttributedLabelLink *)addLinkToAddress:(NSDictionary *)addressComponents
+                                   withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult addressCheckingResultWithRange:range components:addressComponents]];
+}
+
+- (TTTAttributedLabelLink *)addLinkToPhoneNumber:(NSString *)phoneNumber
+                                       withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult phoneNumberCheckingResultWithRange:range phoneNumber:phoneNumber]];
+}
+
+- (TTTAttributedLabelLink *)addLinkToDate:(NSDate *)date
+            withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult dateCheckingResultWithRange:range date:date]];
+}
+
+- (TTTAttributedLabelLink *)addLinkToDate:(NSDate *)date
+                                 timeZone:(NSTimeZone *)timeZone
+                                 duration:(NSTimeInterval)duration
+                                withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult dateCheckingResultWithRange:range date:date timeZone:timeZone duration:duration]];
+}
+
+- (TTTAttributedLabelLink *)addLinkToTransitInformation:(NSDictionary *)components
+                                              withRange:(NSRange)range
+{
+    return [self addLinkWithTextCheckingResult:[NSTextCheckingResult transitInformationCheckingResultWithRange:range components:components]];
+}
+
+#pragma mark -
+
+- (BOOL)containslinkAtPoint:(CGPoint)point {
+    return [self linkAtPoint:point] != nil;
+}
+
+- (TTTAttributedLabelLink *)linkAtPoint:(CGPoint)point {
+    
+    // Stop quickly if none of the points to be tested are in the bounds.
+    if (!CGRectContainsPoint(CGRectInset(self.bounds, -15.f, -15.f), point) || self.linkModels.count == 0) {
+        return nil;
+    }
+    
+    TTTAttributedLabelLink *result = [self linkAtCharacterIndex:[self characterIndexAtPoint:point]];
+    
+    if (!result && self.extendsLinkTouchArea) {
+        result = [self linkAtRadius:15.f aroundPoint:point];
+    }
+    
+    return result;
+}
+
+- (TTTAttributedLabelLink *)linkAtRadius:(const CGFloat)radius aroundPoint:(CGPoint)point {
+    return [[self linkIndex] linkNearestToPoint:point withinRadius:radius];
+}
+
+- (TTTAttributedLabelLinkIndex *)linkIndex {
+    TTTAttributedLabelFrame *textFrame = [self textFrameForBounds:self.bounds];
+    if (!textFrame) {
+        return nil;
+    }
+
+    // The index is only hit tested on the main thread, so it is reset in place rather than replaced
+    @synchronized(self) {
+        if (!_linkIndex) {
+            _linkIndex = [[TTTAttributedLabelLinkIndex alloc] initWithTextFrame:textFrame links:self.linkModels];
+        } else if (_linkIndex.textFrame != textFrame) {
+            [_linkIndex resetWithTextFrame:textFrame links:self.linkModels];
+        }
+
+        return _linkIndex;
+    }
+}
+
+- (TTTAttributedLabelLink *)linkAtCharacterIndex:(CFIndex)idx {
+    // Do not search if the index is outside of the bounds of the text.
+    if (!NSLocationInRange((NSUInteger)idx, NSMakeRange(0, self.attributedText.length))) {
+        return nil;
+    }
+
+    TTTAttributedLabelLinkIntervals *linkIntervals = nil;
+    @synchronized(self) {
+        if (!_linkIntervals) {
+            _linkIntervals = [[TTTAttributedLabelLinkIntervals alloc] initWithLinks:self.linkModels];
+        }
+
+        linkIntervals = _linkIntervals;
+    }
+
+    return [linkIntervals linkAtCharacterIndex:(NSUInteger)idx];
+}
+
+- (CFIndex)characterIndexAtPoint:(CGPoint)p {
+    if (!CGRectContainsPoint(self.bounds, p)) {
+        return NSNotFound;
+    }
+
+    TTTAttributedLabelFrame *textFrame = [self textFrameForBounds:self.bounds];
+    if (!textFrame || textFrame.visibleLineCount == 0) {
+        return NSNotFound;
+    }
+
+    CGRect textRect = textFrame.textRect;
+    if (!CGRectContainsPoint(textRect, p)) {
+        return NSNotFound;
+    }
+
+    // Offset tap coordinates by textRect origin to make them relative to the origin of frame
+    p = CGPointMake(p.x - textRect.origin.x, p.y - textRect.origin.y);
+    // Convert tap coordinates (start at top left) to CT coordinates (start at bottom left)
+    p = CGPointMake(p.x, textRect.size.height - p.y);
+
+    return [textFrame characterIndexAtPoint:p];
+}
+
+- (NSArray *)accessibilityRectsForLink:(TTTAttributedLabelLink *)link {
+    return [[self linkIndex] rectsForLink:link];
+}
+
+- (NSRange)truncateTextFrame:(TTTAttributedLabelFrame *)textFrame
+             attributedString:(NSAttributedString *)attributedString
+                    textRange:(CFRange)textRange
+            overlayAttributes:(NSDictionary *)overlayAttributes
+                 overlayRange:(NSRange)overlayRange
+{
+    textFrame.truncatedLine = NULL;
+
+    NSInteger numberOfLines = textFrame.visibleLineCount;
+    BOOL truncateLastLine = (self.lineBreakMode == TTTLineBreakByTruncatingHead || self.lineBreakMode == TTTLineBreakByTruncatingMiddle || self.lineBreakMode == TTTLineBreakByTruncatingTail);
+    if (numberOfLines == 0 || !truncateLastLine) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+
+    // Check if the range of text in the last line reaches the end of the full attributed string
+    CTLineRef line = [textFrame lineAtIndex:numberOfLines - 1];
+    CFRange lastLineRange = CTLineGetStringRange(line);
+    if ((lastLineRange.length == 0 && lastLineRange.location == 0) || lastLineRange.location + lastLineRange.length >= textRange.location + textRange.length) {
+        return NSMakeRange(NSNotFound, 0);
+    }
+
+    // Get correct truncationType and attribute position
+    CTLineTruncationType truncationType;
+    CFIndex truncationAttributePosition = lastLineRange.location;
+    TTTLineBreakMode lineBreakMode = self.lineBreakMode;
+
+    // Multiple lines, only use UILineBreakModeTailTruncation
+    if (numberOfLines != 1) {
+        lineBreakMode = TTTLineBreakByTruncatingTail;
+    }
+
+    switch (lineBreakMode) {
+        case TTTLineBreakByTruncatingHead:
+            truncationType = kCTLineTruncationStart;
+            break;
+        case TTTLineBreakByTruncatingMiddle:
+            truncationType = kCTLineTruncationMiddle;
+            truncationAttributePosition += (lastLineRange.length / 2);
+            break;
+        case TTTLineBreakByTruncatingTail:
+        default:
+            truncationType = kCTLineTruncationEnd;
+            truncationAttributePosition += (lastLineRange.length - 1);
+            break;
+    }
+
+    NSAttributedString *attributedTruncationString = self.attributedTruncationToken;
+    if (!attributedTruncationString) {
+        NSString *truncationTokenString = @"\u2026"; // Unicode Character 'HORIZONTAL ELLIPSIS' (U+2026)
+
+        NSDictionary *truncationTokenStringAttributes = [attributedString attributesAtIndex:(NSUInteger)truncationAttributePosition effectiveRange:NULL];
+
+        attributedTruncationString = [[NSAttributedString alloc] initWithString:truncationTokenString attributes:truncationTokenStringAttributes];
+    }
+    CTLineRef truncationToken = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)attributedTruncationString);
+
+    // Append truncationToken to the string
+    // because if string isn't too long, CT won't add the truncationToken on its own.
+    // There is no chance of a double truncationToken because CT only adds the
+    // token if it removes characters (and the one we add will go first)
+    NSMutableAttributedString *truncationString = [[NSMutableAttributedString alloc] initWithAttributedString:
+                                                   [attributedString attributedSubstringFromRange:
+                                                    NSMakeRange((NSUInteger)lastLineRange.location,
+                                                                (NSUInteger)lastLineRange.length)]];
+    if (lastLineRange.length > 0) {
+        // Remove any newline at the end (we don't want newline space between the text and the truncation token). There can only be one, because the second would be on the next line.
+        unichar lastCharacter = [[truncationString string] characterAtIndex:(NSUInteger)(lastLineRange.length - 1)];
+        if ([[NSCharacterSet newlineCharacterSet] characterIsMember:lastCharacter]) {
+            [truncationString deleteCharactersInRange:NSMakeRange((NSUInteger)(lastLineRange.length - 1), 1)];
+        }
+    }
+
+    // The truncated line is typeset from its own text, so the attributes of an active link drawn as an overlay are applied here too
+    NSRange truncationOverlayRange = NSIntersectionRange(overlayRange, NSMakeRange((NSUInteger)lastLineRange.location, [truncationString length]));
+    if (overlayAttributes && truncationOverlayRange.length > 0) {
+        [truncationString addAttributes:overlayAttributes range:NSMakeRange(truncationOverlayRange.location - (NSUInteger)lastLineRange.location, truncationOverlayRange.length)];
+    }
+
+    [truncationString appendAttributedString:attributedTruncationString];
+    CTLineRef truncationLine = CTLineCreateWithAttributedString((__bridge CFAttributedStringRef)truncationString);
+
+    // Truncate the line in case it is too long.
+    CTLineRef truncatedLine = CTLineCreateTruncatedLine(truncationLine, textFrame.textRect.size.width, truncationType, truncationToken);
+    if (!truncatedLine) {
+        // If the line is not as wide as the truncationToken, truncatedLine is NULL
+        truncatedLine = CFRetain(truncationToken);
+    }
+
+    textFrame.truncatedLine = truncatedLine;
+    textFrame.truncatedLinePenOffset = (CGFloat)CTLineGetPenOffsetForFlush(truncatedLine, TTTFlushFactorForTextAlignment(self.textAlignment), textFrame.textRect.size.width);
+
+    NSRange tokenLinkRange = NSMakeRange(NSNotFound, 0);
+    if ([attributedTruncationString attribute:NSLinkAttributeName atIndex:0 effectiveRange:NULL]) {
+        NSRange tokenRange = [truncationString.string rangeOfString:attributedTruncationString.string];
+        tokenLinkRange = NSMakeRange((NSUInteger)(lastLineRange.location+lastLineRange.length)-tokenRange.length, (NSUInteger)tokenRange.length);
+    }
+
+    CFRelease(truncatedLine);
+    CFRelease(truncationLine);
+    CFRelease(truncationToken);
+
+    return tokenLinkRange;
+}
+
+- (void)setTruncationTokenLinkRange:(NSRange)range {
+    NSURL *URL = range.location != NSNotFound ? [self.attributedTruncationToken attribute:NSLinkAttributeName atIndex:0 effectiveRange:NULL] : nil;
+    if ([URL isKindOfClass:[NSString class]]) {
+        URL = [NSURL URLWithString:(NSString *)URL];
+    }
+
+    if ((!URL && !_truncationTokenLink) || (NSEqualRanges(_truncationTokenLink.result.range, range) && [_truncationTokenLink.result.URL isEqual:URL])) {
+        return;
+    }
+
+    NSMutableArray *mutableLinkModels = [NSMutableArray arrayWithArray:self.linkModels];
+    if (_truncationTokenLink) {
+        [mutableLinkModels removeObjectIdenticalTo:_truncationTokenLink];
+        _truncationTokenLink = nil;
+    }
+
+    // The token draws with its own attributes, so its link is registered without changing the text or its layout
+    if (URL) {
+        _truncationTokenLink = [[TTTAttributedLabelLink alloc] initWithAttributes:nil
+                                                                 activeAttributes:nil
+                                                               inactiveAttributes:nil
+                                                               textCheckingResult:[NSTextCheckingResult linkCheckingResultWithRange:range URL:URL]];
+        [mutableLinkModels addObject:_truncationTokenLink];
+    }
+
+    self.linkModels = [NSArray arrayWithArray:mutableLinkModels];
+}
+
+- (void)registerTruncationTokenLinkOfTextFrame:(TTTAttributedLabelFrame *)textFrame {
+    // Changing the links resets the accessibility elements and adds a gesture recognizer, so it is left to the main thread rather than done while laying out
+    if (textFrame && [NSThread isMainThread]) {
+        [self setTruncationTokenLinkRange:textFrame.truncationTokenLinkRange];
+    }
+}
+
+#pragma mark - TTTAttributedLabel
+
+- (void)setText:(id)text {
+    NSParameterAssert(!text || [text isKindOfClass:[NSAttributedString class]] || [text isKindOfClass:[NSString class]]);
+
+    if ([text isKindOfClass:[NSString class]]) {
+        [self setText:text afterInheritingLabelAttributesAndConfiguringWithBlock:nil];
+        return;
+    }
+
+    self.attributedText = text;
+    self.activeLink = nil;
+    _textLayout = nil;
+    _truncationTokenLink = nil;
+
+    // Links queued for a batch update refer to the previous text
+    [_pendingLinkModels removeAllObjects];
+    [_detectedLinkModels removeAllObjects];
+    self.linkModels = [NSArray array];
+    [self addLinksFromLinkAttributesInRange:NSMakeRange(0, [self.attributedText length])];
+
+    NSString *string = (text && self.enabledTextCheckingTypes) ? [self.attributedText string] : nil;
+    [self detectLinksInString:string range:NSMakeRange(0, [string length])];
+}
+
+- (void)prepareForReuse {
+    // Cancels pending data detection, and releases the links, layout and framesetter of the previous text. The link index and accessibility elements are cleared, keeping their storage for the next text
+    [self setText:nil];
+
+    @synchronized(self) {
+        _activeLinkTextFrame = nil;
+    }
+
+    [_linkAccessibilityElements removeAllObjects];
+}
+
+- (void)appendText:(id)text {
+    [self replaceTextInRange:NSMakeRange([self.attributedText length], 0) withText:text];
+}
+
+- (void)replaceTextInRange:(NSRange)range
+                  withText:(id)text
+{
+    NSParameterAssert(!text || [text isKindOfClass:[NSAttributedString class]] || [text isKindOfClass:[NSString class]]);
+    NSParameterAssert(NSMaxRange(range) <= [self.attributedText length]);
+
+    if (!self.attributedText) {
+        [self setText:text];
+        return;
+    }
+
+    NSDictionary *labelAttributes = NSAttributedStringAttributesFromLabel(self);
+    NSAttributedString *replacement = nil;
+    if ([text isKindOfClass:[NSString class]]) {
+        replacement = [[NSAttributedString alloc] initWithString:text attributes:labelAttributes];
+    } else {
+        replacement = text ?: [[NSAttributedString alloc] init];
+    }
+
+    NSMutableAttributedString *mutableAttributedString = [self.attributedText mutableCopy];
+    [mutableAttributedString replaceCharactersInRange:range withAttributedString:replacement];
+
+    if ([mutableAttributedString length] == 0) {
+        [self setText:mutableAttributedString];
+        return;
+    }
+
+    // Search the changed paragraphs, with a margin so that links next to the change are found whole, along with any text still waiting for detection
+    NSString *string = [mutableAttributedString string];
+    NSRange detectionRange = NSMakeRange(range.location, [replacement length]);
+    if (_dataDetectionOperation) {
+        detectionRange = NSUnionRange(detectionRange, TTTRangeAdjustedForReplacement(_dataDetectionRange, range, [replacement length]));
+    }
+
+    NSUInteger detectionLocation = detectionRange.location > TTTIncrementalDetectionMargin ? detectionRange.location - TTTIncrementalDetectionMargin : 0;
+    NSUInteger detectionEnd = MIN(NSMaxRange(detectionRange) + TTTIncrementalDetectionMargin, [string length]);
+    detectionRange = [string paragraphRangeForRange:NSMakeRange(detectionLocation, detectionEnd - detectionLocation)];
+
+    // Links are kept and moved, except those over the replaced text, and those the label found itself in the searched paragraphs, which are found again
+    NSMutableArray *mutableLinkModels = [NSMutableArray arrayWithCapacity:[self.linkModels count]];
+    for (TTTAttributedLabelLink *link in self.linkModels) {
+        if (link == _truncationTokenLink) {
+            continue;
+        } else if (link.result.range.location == NSNotFound) {
+            [mutableLinkModels addObject:link];
+            continue;
+        }
+
+        NSRange linkRange = TTTRangeAdjustedForReplacement(link.result.range, range, [replacement length]);
+        BOOL isOverReplacedText = link.result.range.location < NSMaxRange(range) && NSMaxRange(link.result.range) > range.location;
+        BOOL isFoundAgain = [_detectedLinkModels containsObject:link] && linkRange.location < NSMaxRange(detectionRange) && NSMaxRange(linkRange) > detectionRange.location;
+        if (isOverReplacedText || isFoundAgain) {
+            [_detectedLinkModels removeObject:link];
+
+            // Only restyle the text around the replacement, which keeps its own attributes
+            NSUInteger replacementEnd = range.location + [replacement length];
+            if (linkRange.location < range.location) {
+                TTTRestoreAttributesUnderLinkAttributes(mutableAttributedString, link.attributes, labelAttributes, NSMakeRange(linkRange.location, MIN(NSMaxRange(linkRange), range.location) - linkRange.location));
+            }
+
+            if (NSMaxRange(linkRange) > replacementEnd) {
+                NSUInteger location = MAX(linkRange.location, replacementEnd);
+                TTTRestoreAttributesUnderLinkAttributes(mutableAttributedString, link.attributes, labelAttributes, NSMakeRange(location, NSMaxRange(linkRange) - location));
+            }
+
+            continue;
+        }
+
+        if (linkRange.location != link.result.range.location) {
+            link.result = [link.result resultByAdjustingRangesWithOffset:(NSInteger)linkRange.location - (NSInteger)link.result.range.location];
+        }
+
+        [mutableLinkModels addObject:link];
+    }
+
+    self.attributedText = mutableAttributedString;
+    self.activeLink = nil;
+    _textLayout = nil;
+    _truncationTokenLink = nil;
+
+    [_pendingLinkModels removeAllObjects];
+    self.linkModels = [NSArray arrayWithArray:mutableLinkModels];
+    [self addLinksFromLinkAttributesInRange:detectionRange];
+
+    [self detectLinksInString:self.enabledTextCheckingTypes ? [self.attributedText string] : nil range:detectionRange];
+}
+
+- (void)addLinksFromLinkAttributesInRange:(NSRange)range {
+    NSMutableArray *mutableResults = [NSMutableArray array];
+    [self.attributedText enumerateAttribute:NSLinkAttributeName inRange:range options:0 usingBlock:^(id value, NSRange linkRange, __unused BOOL *stop) {
+        if (value) {
+            NSURL *URL = [value isKindOfClass:[NSString class]] ? [NSURL URLWithString:value] : value;
+            [mutableResults addObject:[NSTextCheckingResult linkCheckingResultWithRange:linkRange URL:URL]];
+        }
+    }];
+
+    if ([mutableResults count] > 0) {
+        [self addDetectedLinksWithTextCheckingResults:mutableResults];
+    }
+}
+
+- (void)addDetectedLinksWithTextCheckingResults:(NSArray *)results {
+    // Links the label found itself are found again when their text is replaced, unlike those added by the app
+    if (!_detectedLinkModels) {
+        _detectedLinkModels = [NSHashTable hashTableWithOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality];
+    }
+
+    for (TTTAttributedLabelLink *link in [self addLinksWithTextCheckingResults:results attributes:self.linkAttributes]) {
+        [_detectedLinkModels addObject:link];
+    }
+}
+
+- (void)setTextLayout:(TTTAttributedLabelLayout *)textLayout {
+    if (textLayout) {
+        self.numberOfLines = (NSInteger)textLayout.numberOfLines;
+        self.textInsets = textLayout.textInsets;
+    }
+
+    [self setText:textLayout.attributedString];
+
+    // Adopt the layout's framesetter, unless setting the text styled links or appended a truncation token
+    if (textLayout && [self.renderedAttributedText isEqualToAttributedString:textLayout.attributedString]) {
+        self.publishedTextSnapshot = [TTTAttributedLabelTextSnapshot snapshotWithAttributedString:self.renderedAttributedText framesetter:textLayout.framesetter numberOfLines:self.numberOfLines textInsets:self.textInsets];
+
+        _textLayout = textLayout;
+    }
+}
+
+- (void)detectLinksInString:(NSString *)string
+                       range:(NSRange)range
+{
+    // Supersede any detection still pending for previous text
+    NSUInteger generation = ++_dataDetectionGeneration;
+    if (_dataDetectionOperation) {
+        // Detection that has not started never runs once cancelled, so it is discarded here, on behalf of the label
+        BOOL started = [_dataDetectionOperation isExecuting] || [_dataDetectionOperation isFinished];
+        [_dataDetectionOperation cancel];
+        if (!started) {
+            TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionDiscarded, self);
+        }
+
+        _dataDetectionOperation = nil;
+    }
+
+    id <TTTAttributedLabelDataDetector> dataDetector = self.dataDetector;
+    if ([string length] == 0 || range.length == 0 || !dataDetector) {
+        return;
+    }
+
+    // Results are cached for the searched text alone, so that a paragraph seen before is found in the cache wherever it appears
+    NSString *detectionString = range.length == [string length] ? string : [string substringWithRange:range];
+    NSInteger offset = (NSInteger)range.location;
+
+    TTTAttributedLabelCache *dataDetectionCache = [[self class] sharedDataDetectionCache];
+    TTTAttributedLabelDataDetectionCacheKey *key = [[TTTAttributedLabelDataDetectionCacheKey alloc] initWithString:detectionString dataDetector:dataDetector];
+
+    NSArray *cachedResults = [dataDetectionCache objectForKey:key];
+    if (!cachedResults) {
+        cachedResults = [TTTLoadedCacheArchive() resultsForKey:key];
+        if (cachedResults) {
+            [dataDetectionCache setObject:cachedResults forKey:key];
+        }
+    }
+
+    if (cachedResults) {
+        TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionCacheHit, self);
+        if ([cachedResults count] > 0) {
+            [self addDetectedLinksWithTextCheckingResults:TTTTextCheckingResultsByAdjustingRanges(cachedResults, offset)];
+        }
+
+        return;
+    }
+
+    TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionCacheMiss, self);
+
+    // Detection runs off the main thread, so it is recorded without the label, which must not be retained there
+    __weak __typeof(self)weakSelf = self;
+    NSBlockOperation *operation = [[NSBlockOperation alloc] init];
+    __weak NSBlockOperation *weakOperation = operation;
+    [operation addExecutionBlock:^{
+        if ([weakOperation isCancelled]) {
+            return;
+        }
+
+        CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventDataDetection, nil);
+        NSArray *results = [dataDetector matchesInString:detectionString options:0 range:NSMakeRange(0, [detectionString length])] ?: [NSArray array];
+        TTTInstrumentationEnd(TTTAttributedLabelTraceEventDataDetection, nil, beginTime);
+        [dataDetectionCache setObject:results forKey:key];
+
+        // Results of detection cancelled while it ran are dropped, since the label's text has changed
+        if ([weakOperation isCancelled]) {
+            if ([results count] > 0) {
+                TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionDiscarded, nil);
+            }
+
+            return;
+        }
+
+        // Report back even without results, so that later edits know this text no longer needs to be searched
+        dispatch_async(dispatch_get_main_queue(), ^{
+            __strong __typeof(weakSelf)strongSelf = weakSelf;
+            if (strongSelf && strongSelf->_dataDetectionGeneration == generation && [[strongSelf.attributedText string] isEqualToString:string]) {
+                strongSelf->_dataDetectionOperation = nil;
+
+                if ([results count] > 0) {
+                    [strongSelf addDetectedLinksWithTextCheckingResults:TTTTextCheckingResultsByAdjustingRanges(results, offset)];
+                }
+            } else if ([results count] > 0) {
+                TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionDiscarded, strongSelf);
+            }
+        });
+    }];
+
+    _dataDetectionOperation = operation;
+    _dataDetectionRange = range;
+    [[[self class] dataDetectionQueue] addOperation:operation];
+    TTTInstrumentationMark(TTTAttributedLabelTraceEventDataDetectionQueued, self);
+}
+
+- (void)setText:(id)text
+afterInheritingLabelAttributesAndConfiguringWithBlock:(NSMutableAttributedString * (^)(NSMutableAttributedString *mutableAttributedString))block
+{
+    NSMutableAttributedString *mutableAttributedString = nil;
+    if ([text isKindOfClass:[NSString class]]) {
+        mutableAttributedString = [[NSMutableAttributedString alloc] initWithString:text attributes:NSAttributedStringAttributesFromLabel(self)];
+    } else {
+        mutableAttributedString = [[NSMutableAttributedString alloc] initWithAttributedString:text];
+        [mutableAttributedString addAttributes:NSAttributedStringAttributesFromLabel(self) range:NSMakeRange(0, [mutableAttributedString length])];
+    }
+
+    if (block) {
+        mutableAttributedString = block(mutableAttributedString);
+    }
+
+    [self setText:mutableAttributedString];
+}
+
+- (void)setActiveLink:(TTTAttributedLabelLink *)activeLink {
+    _activeLink = activeLink;
+    _activeLinkTextFrame = nil;
+
+    NSDictionary *activeAttributes = activeLink.activeAttributes ?: self.activeLinkAttributes;
+    BOOL hadActiveLinkOverlay = _activeLinkOverlayAttributes != nil;
+    _activeLinkOverlayAttributes = nil;
+
+    if (_activeLink && activeAttributes.count > 0 && !TTTAttributesAffectLayout(activeAttributes)) {
+        if (self.inactiveAttributedText) {
+            self.attributedText = self.inactiveAttributedText;
+            self.inactiveAttributedText = nil;
+        }
+
+        // Draw the active link over the existing layout, rather than typesetting the text again, with the next display pass
+        _activeLinkOverlayAttributes = activeAttributes;
+        [self setNeedsDisplay];
+    } else if (_activeLink && activeAttributes.count > 0) {
+        if (!self.inactiveAttributedText) {
+            self.inactiveAttributedText = [self.attributedText copy];
+        }
+
+        NSMutableAttributedString *mutableAttributedString = [self.inactiveAttributedText mutableCopy];
+        if (self.activeLink.result.range.length > 0 && NSLocationInRange(NSMaxRange(self.activeLink.result.range) - 1, NSMakeRange(0, [self.inactiveAttributedText length]))) {
+            [mutableAttributedString addAttributes:activeAttributes range:self.activeLink.result.range];
+        }
+
+        self.attributedText = mutableAttributedString;
+        [self setNeedsDisplay];
+
+        [CATransaction flush];
+    } else if (self.inactiveAttributedText) {
+        self.attributedText = self.inactiveAttributedText;
+        self.inactiveAttributedText = nil;
+
+        [self setNeedsDisplay];
+    } else if (hadActiveLinkOverlay) {
+        [self setNeedsDisplay];
+    }
+}
+
+- (TTTAttributedLabelFrame *)activeLinkTextFrameForTextFrame:(TTTAttributedLabelFrame *)textFrame {
+    NSRange activeLinkRange = self.activeLink.result.range;
+    if (!_activeLinkOverlayAttributes || !textFrame || activeLinkRange.length == 0) {
+        return textFrame;
+    }
+
+    @synchronized(self) {
+        if (!_activeLinkTextFrame || _activeLinkTextFrame.frame != textFrame.frame) {
+            CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFrameCreation, self);
+            _activeLinkTextFrame = [textFrame frameByAddingAttributes:_activeLinkOverlayAttributes range:activeLinkRange ofAttributedString:self.renderedAttributedText];
+            TTTInstrumentationEnd(TTTAttributedLabelTraceEventFrameCreation, self, beginTime);
+
+            if (_activeLinkTextFrame != textFrame) {
+                beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventTruncation, self);
+                [self truncateTextFrame:_activeLinkTextFrame attributedString:self.renderedAttributedText textRange:CFRangeMake(0, (CFIndex)[self.attributedText length]) overlayAttributes:_activeLinkOverlayAttributes overlayRange:activeLinkRange];
+                TTTInstrumentationEnd(TTTAttributedLabelTraceEventTruncation, self, beginTime);
+            }
+        }
+
+        return _activeLinkTextFrame;
+    }
+}
+
+- (void)setLinkAttributes:(NSDictionary *)linkAttributes {
+    _linkAttributes = convertNSAttributedStringAttributesToCTAttributes(linkAttributes);
+}
+
+- (void)setActiveLinkAttributes:(NSDictionary *)activeLinkAttributes {
+    _activeLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(activeLinkAttributes);
+}
+
+- (void)setInactiveLinkAttributes:(NSDictionary *)inactiveLinkAttributes {
+    _inactiveLinkAttributes = convertNSAttributedStringAttributesToCTAttributes(inactiveLinkAttributes);
+}
+
+- (BOOL)isTiledRenderingEnabled {
+    return _tiledRenderingEnabled;
+}
+
+- (void)setTiledRenderingEnabled:(BOOL)tiledRenderingEnabled {
+    if (tiledRenderingEnabled == _tiledRenderingEnabled) {
+        return;
+    }
+
+    _tiledRenderingEnabled = tiledRenderingEnabled;
+
+    [self updateContentLayer];
+}
+
+- (BOOL)isBitmapCachingEnabled {
+    return _bitmapCachingEnabled;
+}
+
+- (void)setBitmapCachingEnabled:(BOOL)bitmapCachingEnabled {
+    if (bitmapCachingEnabled == _bitmapCachingEnabled) {
+        return;
+    }
+
+    _bitmapCachingEnabled = bitmapCachingEnabled;
+
+    [self updateContentLayer];
+}
+
+- (void)updateContentLayer {
+    // Tiled rendering takes precedence over caching the bitmap of the whole label
+    Class contentLayerClass = _tiledRenderingEnabled ? [CATiledLayer class] : (_bitmapCachingEnabled ? [CALayer class] : Nil);
+    if ([_contentLayer class] != contentLayerClass) {
+        [_contentLayer removeFromSuperlayer];
+        _contentLayer = nil;
+        _contentLayerDelegate = nil;
+
+        if (contentLayerClass) {
+            _contentLayerDelegate = [[TTTAttributedLabelContentLayerDelegate alloc] init];
+            _contentLayer = [contentLayerClass layer];
+            _contentLayer.delegate = (id)_contentLayerDelegate;
+            [self.layer addSublayer:_contentLayer];
+        }
+    }
+
+    // While the content layer shows the text, the label's own layer draws nothing, so it is neither redrawn when resized nor given a backing store
+    self.layer.needsDisplayOnBoundsChange = !_contentLayer && self.contentMode == UIViewContentModeRedraw;
+    if (_contentLayer) {
+        self.layer.contents = nil;
+    }
+
+    [self setNeedsDisplay];
+}
+
+- (void)layoutContentLayer {
+    CGRect bounds = self.bounds;
+    CGFloat scale = self.contentScaleFactor;
+    if (!CGRectEqualToRect(_contentLayer.frame, bounds) || _contentLayer.contentsScale != scale) {
+        _contentLayer.frame = bounds;
+        _contentLayer.contentsScale = scale;
+        _needsContentLayerUpdate = YES;
+    }
+
+    // Release anything drawn by a display of the label's own layer that was pending when the content layer was added
+    self.layer.contents = nil;
+
+    if (!_needsContentLayerUpdate) {
+        return;
+    }
+
+    if (self.attributedText && !CGRectIsEmpty(bounds)) {
+        // Fit the font size before the text is drawn on other threads, or used as part of the bitmap cache key
+        if (self.adjustsFontSizeToFitWidth && self.numberOfLines > 0) {
+            [self fitFontSizeToSize:UIEdgeInsetsInsetRect(bounds, self.textInsets).size];
+        }
+
+        [self registerTruncationTokenLinkOfTextFrame:[self textFrameForBounds:bounds]];
+    }
+
+    _needsContentLayerUpdate = NO;
+
+    if ([_contentLayer isKindOfClass:[CATiledLayer class]]) {
+        // Tiles span the width of the label, so that each one draws a band of whole lines
+        ((CATiledLayer *)_contentLayer).tileSize = CGSizeMake(MAX((CGFloat)ceil(CGRectGetWidth(bounds) * scale), 1.0f), TTTTiledRenderingTileHeight * scale);
+
+        // Tiles are drawn on background threads, so they draw what the label shows as of now
+        _contentLayerDelegate.drawing = [[TTTAttributedLabelDrawing alloc] initWithLabel:self rect:bounds];
+        [_contentLayer setNeedsDisplay];
+    } else {
+        _contentLayer.contents = (__bridge id)[[self bitmapForBounds:bounds] CGImage];
+    }
+}
+
+- (TTTAttributedLabelStyleCacheKey *)bitmapCacheKey {
+    // Everything that changes how the label draws, other than its text attributes, which are part of the rendered text
+    TTTAttributedLabelLink *activeLink = self.activeLink;
+    NSArray *components = @[self.renderedAttributedText ?: [NSNull null],
+                            [NSValue valueWithCGSize:self.bounds.size],
+                            @(self.contentScaleFactor),
+                            @(self.highlighted),
+                            self.highlightedTextColor ?: [NSNull null],
+                            activeLink ? [NSValue valueWithRange:activeLink.result.range] : [NSNull null],
+                            (activeLink ? _activeLinkOverlayAttributes : nil) ?: [NSNull null],
+                            self.shadowColor ?: [NSNull null],
+                            [NSValue valueWithCGSize:self.shadowOffset],
+                            @(self.shadowRadius),
+                            self.highlightedShadowColor ?: [NSNull null],
+                            [NSValue valueWithCGSize:self.highlightedShadowOffset],
+                            @(self.highlightedShadowRadius),
+                            self.font ?: [NSNull null],
+                            @(self.numberOfLines),
+                            @(self.textAlignment),
+                            @(self.lineBreakMode),
+                            @(self.verticalAlignment),
+                            [NSValue valueWithUIEdgeInsets:self.textInsets],
+                            [NSValue valueWithUIEdgeInsets:self.linkBackgroundEdgeInset]];
+
+    return [[TTTAttributedLabelStyleCacheKey alloc] initWithComponents:components];
+}
+
+#pragma mark - UILabel
+
+- (void)setHighlighted:(BOOL)highlighted {
+    [super setHighlighted:highlighted];
+    [self setNeedsDisplay];
+}
+
+// Fixes crash when loading from a UIStoryboard
+- (UIColor *)textColor {
+	UIColor *color = [super textColor];
+	if (!color) {
+		color = [UIColor blackColor];
+	}
+
+	return color;
+}
+
+- (void)setTextColor:(UIColor *)textColor {
+    UIColor *oldTextColor = self.textColor;
+    [super setTextColor:textColor];
+
+    // Redraw to allow any ColorFromContext attributes a chance to update
+    if (textColor != oldTextColor) {
+        [self setNeedsFramesetter];
+        [self setNeedsDisplay];
+    }
+}
+
+- (void)setNumberOfLines:(NSInteger)numberOfLines {
+    [super setNumberOfLines:numberOfLines];
+    self.publishedTextSnapshot = [self.publishedTextSnapshot snapshotWithNumberOfLines:numberOfLines textInsets:self.textInsets];
+    [self setNeedsFontSizeFit];
+    [self setNeedsTextFrame];
+}
+
+- (void)setAdjustsFontSizeToFitWidth:(BOOL)adjustsFontSizeToFitWidth {
+    [super setAdjustsFontSizeToFitWidth:adjustsFontSizeToFitWidth];
+    [self setNeedsFontSizeFit];
+}
+
+- (void)setMinimumScaleFactor:(CGFloat)minimumScaleFactor {
+    [super setMinimumScaleFactor:minimumScaleFactor];
+    [self setNeedsFontSizeFit];
+}
+
+- (void)setNeedsFontSizeFit {
+    _fittedTextSize = CGSizeZero;
+
+    if (_fittedAttributedText) {
+        _fittedAttributedText = nil;
+        [self setNeedsFramesetter];
+        [self setNeedsDisplay];
+    }
+}
+
+- (void)fitFontSizeToSize:(CGSize)size {
+    // The scale that fits is memoized until the text, size or number of lines change
+    if (CGSizeEqualToSize(size, _fittedTextSize)) {
+        return;
+    }
+
+    _fittedTextSize = size;
+
+    CGFloat minimumScaleFactor = [self respondsToSelector:@selector(minimumScaleFactor)] ? self.minimumScaleFactor : 0.0f;
+    CGFloat scaleFactor = TTTScaleFactorThatFitsAttributedString(self.attributedText, size.width, (NSUInteger)self.numberOfLines, minimumScaleFactor);
+    NSAttributedString *fittedAttributedText = scaleFactor < 1.0f ? NSAttributedStringByScalingFontSize(self.attributedText, scaleFactor) : nil;
+
+    if (fittedAttributedText || _fittedAttributedText) {
+        _fittedAttributedText = fittedAttributedText;
+        [self setNeedsFramesetter];
+
+        if ([self respondsToSelector:@selector(invalidateIntrinsicContentSize)]) {
+            [self invalidateIntrinsicContentSize];
+        }
+    }
+}
+
+- (void)setTextAlignment:(NSTextAlignment)textAlignment {
+    [super setTextAlignment:textAlignment];
+    [self setNeedsTextFrame];
+}
+
+- (void)setLineBreakMode:(NSLineBreakMode)lineBreakMode {
+    [super setLineBreakMode:lineBreakMode];
+
+    // The truncated line is laid out with the text frame
+    [self setNeedsTextFrame];
+    [self setNeedsDisplay];
+}
+
+- (void)setTextInsets:(UIEdgeInsets)textInsets {
+    _textInsets = textInsets;
+    self.publishedTextSnapshot = [self.publishedTextSnapshot snapshotWithNumberOfLines:self.numberOfLines textInsets:textInsets];
+    [self setNeedsTextFrame];
+}
+
+- (void)setVerticalAlignment:(TTTAttributedLabelVerticalAlignment)verticalAlignment {
+    _verticalAlignment = verticalAlignment;
+    [self setNeedsTextFrame];
+}
+
+- (CGRect)textRectForBounds:(CGRect)bounds
+     limitedToNumberOfLines:(NSInteger)numberOfLines
+{
+    @synchronized(self) {
+        if (_textFrame && numberOfLines == _textFrame.numberOfLines && CGRectEqualToRect(bounds, _textFrame.bounds)) {
+            return _textFrame.textRect;
+        }
+    }
+
+    bounds = UIEdgeInsetsInsetRect(bounds, self.textInsets);
+    if (!self.attributedText) {
+        return [super textRectForBounds:bounds limitedToNumberOfLines:numberOfLines];
+    }
+
+    CGRect textRect = bounds;
+
+    // Calculate height with a minimum of double the font pointSize, to ensure that CTFramesetterSuggestFrameSizeWithConstraints doesn't return CGSizeZero, as it would if textRect height is insufficient.
+    textRect.size.height = MAX(self.font.lineHeight * MAX(2, numberOfLines), bounds.size.height);
+
+    // Adjust the text to be in the center vertically, if the text size is smaller than bounds
+    CFRange textRange = CTFramesetterGetBoundedTextRange([self framesetter], self.attributedText, CFRangeMake(0, (CFIndex)[self.attributedText length]), textRect.size.width, numberOfLines);
+    CGSize textSize = CTFramesetterSuggestFrameSizeWithConstraints([self framesetter], textRange, NULL, textRect.size, NULL);
+    textSize = CGSizeMake(CGFloat_ceil(textSize.width), CGFloat_ceil(textSize.height)); // Fix for iOS 4, CTFramesetterSuggestFrameSizeWithConstraints sometimes returns fractional sizes
+
+    if (textSize.height < bounds.size.height) {
+        CGFloat yOffset = 0.0f;
+        switch (self.verticalAlignment) {
+            case TTTAttributedLabelVerticalAlignmentCenter:
+                yOffset = CGFloat_floor((bounds.size.height - textSize.height) / 2.0f);
+                break;
+            case TTTAttributedLabelVerticalAlignmentBottom:
+                yOffset = bounds.size.height - textSize.height;
+                break;
+            case TTTAttributedLabelVerticalAlignmentTop:
+            default:
+                break;
+        }
+
+        textRect.origin.y += yOffset;
+    }
+
+    return textRect;
+}
+
+- (void)drawTextInRect:(CGRect)rect {
+    // The content layer shows the text of tiled labels and of labels caching their bitmap
+    if (_contentLayer) {
+        return;
+    }
+
+    CGRect insetRect = UIEdgeInsetsInsetRect(rect, self.textInsets);
+    if (!self.attributedText) {
+        [super drawTextInRect:insetRect];
+        return;
+    }
+
+    // Adjust the font size to fit width, if necessarry
+    if (self.adjustsFontSizeToFitWidth && self.numberOfLines > 0) {
+        [self fitFontSizeToSize:insetRect.size];
+    }
+
+    [self registerTruncationTokenLinkOfTextFrame:[self textFrameForBounds:rect]];
+    [[[TTTAttributedLabelDrawing alloc] initWithLabel:self rect:rect] drawInContext:UIGraphicsGetCurrentContext()];
+}
+
+#pragma mark - UIAccessibilityElement
+
+- (BOOL)isAccessibilityElement {
+    return NO;
+}
+
+- (NSInteger)accessibilityElementCount {
+    return (NSInteger)[[self accessibilityElements] count];
+}
+
+- (id)accessibilityElementAtIndex:(NSInteger)index {
+    return [[self accessibilityElements] objectAtIndex:(NSUInteger)index];
+}
+
+- (NSInteger)indexOfAccessibilityElement:(id)element {
+    return (NSInteger)[[self accessibilityElements] indexOfObject:element];
+}
+
+- (NSArray *)accessibilityElements {
+    // Accessibility is only queried on the main thread, where the links and their elements are also updated
+    if ([_accessibilityElements count] == 0) {
+        if (!_accessibilityElements) {
+            _accessibilityElements = [NSMutableArray array];
+        }
+
+        if (!_linkAccessibilityElements) {
+            _linkAccessibilityElements = [NSMapTable strongToStrongObjectsMapTable];
+        }
+
+        NSString *sourceText = [self.text isKindOfClass:[NSString class]] ? self.text : [(NSAttributedString *)self.text string];
+
+        // Elements find their rects in the layout when asked, so those for existing links are reused as links are added
+        for (TTTAttributedLabelLink *link in self.linkModels) {
+            
+            if (link.result.range.location == NSNotFound || NSMaxRange(link.result.range) > [sourceText length]) {
+                continue;
+            }
+
+            TTTAccessibilityElement *linkElement = [_linkAccessibilityElements objectForKey:link];
+            if (!linkElement) {
+                NSString *accessibilityLabel = [sourceText substringWithRange:link.result.range];
+                NSString *accessibilityValue = link.accessibilityValue;
+
+                linkElement = [[TTTAccessibilityElement alloc] initWithAccessibilityContainer:self];
+                linkElement.accessibilityTraits = UIAccessibilityTraitLink;
+                linkElement.link = link;
+                linkElement.superview = self;
+                linkElement.accessibilityLabel = accessibilityLabel;
+
+                if (![accessibilityLabel isEqualToString:accessibilityValue]) {
+                    linkElement.accessibilityValue = accessibilityValue;
+                }
+            }
+
+            [_accessibilityElements addObject:linkElement];
+        }
+
+        // Only the elements of the current links are kept
+        [_linkAccessibilityElements removeAllObjects];
+        for (TTTAccessibilityElement *linkElement in _accessibilityElements) {
+            [_linkAccessibilityElements setObject:linkElement forKey:linkElement.link];
+        }
+
+        TTTAccessibilityElement *baseElement = [[TTTAccessibilityElement alloc] initWithAccessibilityContainer:self];
+        baseElement.accessibilityLabel = [super accessibilityLabel];
+        baseElement.accessibilityHint = [super accessibilityHint];
+        baseElement.accessibilityValue = [super accessibilityValue];
+        baseElement.boundingRect = self.bounds;
+        baseElement.superview = self;
+        baseElement.accessibilityTraits = [super accessibilityTraits];
+
+        [_accessibilityElements addObject:baseElement];
+    }
+
+    return _accessibilityElements;
+}
+
+#pragma mark - UIView
+
+- (CGSize)sizeThatFits:(CGSize)size {
+    // Measure the text and framesetter of a single snapshot, which stays valid if the text changes on another thread
+    TTTAttributedLabelTextSnapshot *textSnapshot = [self textSnapshot];
+
+    if (!textSnapshot.attributedString) {
+        // There is no text to measure, so UILabel is asked, unless this is called off the main thread, where UIKit may not be
+        return [NSThread isMainThread] ? [super sizeThatFits:size] : CGSizeZero;
+    } else {
+        CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventSizeThatFits, self);
+
+        // The number of lines and insets are those the text was published with, so nothing is read from the label
+        UIEdgeInsets textInsets = textSnapshot.textInsets;
+        CGSize labelSize = TTTSizeThatFitsAttributedStringWithFramesetter(textSnapshot.attributedString, [textSnapshot framesetterForLabel:self], size, (NSUInteger)textSnapshot.numberOfLines, self);
+        labelSize.width += textInsets.left + textInsets.right;
+        labelSize.height += textInsets.top + textInsets.bottom;
+
+        TTTInstrumentationEnd(TTTAttributedLabelTraceEventSizeThatFits, self, beginTime);
+
+        return labelSize;
+    }
+}
+
+- (void)setPrecomputedSize:(CGSize)size
+           withConstraints:(CGSize)constraints
+{
+    // Sizes are looked up by the text as it is drawn, rather than as it was set
+    TTTAttributedLabelTextSnapshot *textSnapshot = [self textSnapshot];
+    [[self class] setPrecomputedSize:size forAttributedString:textSnapshot.attributedString withConstraints:constraints limitedToNumberOfLines:(NSUInteger)textSnapshot.numberOfLines];
+}
+
+- (CGSize)intrinsicContentSize {
+    // There's an implicit width from the original UILabel implementation
+    return [self sizeThatFits:[super intrinsicContentSize]];
+}
+
+- (void)tintColorDidChange {
+    if (!self.inactiveLinkAttributes || [self.inactiveLinkAttributes count] == 0) {
+        return;
+    }
+
+    BOOL isInactive = (self.tintAdjustmentMode == UIViewTintAdjustmentModeDimmed);
+
+    NSMutableAttributedString *mutableAttributedString = [self.attributedText mutableCopy];
+    for (TTTAttributedLabelLink *link in self.linkModels) {
+        NSDictionary *attributesToRemove = isInactive ? link.attributes : link.inactiveAttributes;
+        NSDictionary *attributesToAdd = isInactive ? link.inactiveAttributes : link.attributes;
+        
+        [attributesToRemove enumerateKeysAndObjectsUsingBlock:^(NSString *name, __unused id value, __unused BOOL *stop) {
+            if (NSMaxRange(link.result.range) <= mutableAttributedString.length) {
+                [mutableAttributedString removeAttribute:name range:link.result.range];
+            }
+        }];
+
+        if (attributesToAdd) {
+            if (NSMaxRange(link.result.range) <= mutableAttributedString.length) {
+                [mutableAttributedString addAttributes:attributesToAdd range:link.result.range];
+            }
+        }
+    }
+
+    self.attributedText = mutableAttributedString;
+
+    [self setNeedsDisplay];
+}
+
+- (UIView *)hitTest:(CGPoint)point
+          withEvent:(UIEvent *)event
+{
+    if (![self linkAtPoint:point] || !self.userInteractionEnabled || self.hidden || self.alpha < 0.01) {
+        return [super hitTest:point withEvent:event];
+    }
+
+    return self;
+}
+
+- (void)layoutSubviews {
+    [super layoutSubviews];
+
+    if (_contentLayer) {
+        [self layoutContentLayer];
+    }
+}
+
+- (void)setNeedsDisplay {
+    if (!_contentLayer) {
+        [super setNeedsDisplay];
+        return;
+    }
+
+    // The content layer is updated as the label is next laid out, rather than the label's own layer drawn
+    _needsContentLayerUpdate = YES;
+    [self setNeedsLayout];
+}
+
+- (void)setNeedsDisplayInRect:(CGRect)rect {
+    if (!_contentLayer) {
+        [super setNeedsDisplayInRect:rect];
+        return;
+    }
+
+    [self setNeedsDisplay];
+}
+
+- (void)setContentMode:(UIViewContentMode)contentMode {
+    [super setContentMode:contentMode];
+
+    if (_contentLayer) {
+        self.layer.needsDisplayOnBoundsChange = NO;
+    }
+}
+
+- (UIImage *)bitmapForBounds:(CGRect)bounds {
+    if (!self.attributedText || CGRectIsEmpty(bounds)) {
+        return nil;
+    }
+
+    TTTAttributedLabelCache *bitmapCache = [[self class] sharedBitmapCache];
+    TTTAttributedLabelStyleCacheKey *key = [self bitmapCacheKey];
+
+    UIImage *image = [bitmapCache objectForKey:key];
+    if (image) {
+        TTTInstrumentationMark(TTTAttributedLabelTraceEventBitmapCacheHit, self);
+    } else {
+        TTTInstrumentationMark(TTTAttributedLabelTraceEventBitmapCacheMiss, self);
+
+        UIGraphicsBeginImageContextWithOptions(bounds.size, NO, self.contentScaleFactor);
+        CGContextTranslateCTM(UIGraphicsGetCurrentContext(), -bounds.origin.x, -bounds.origin.y);
+        [[[TTTAttributedLabelDrawing alloc] initWithLabel:self rect:bounds] drawInContext:UIGraphicsGetCurrentContext()];
+        image = UIGraphicsGetImageFromCurrentImageContext();
+        UIGraphicsEndImageContext();
+
+        // A bitmap larger than the whole budget would only evict every other entry before being evicted itself
+        NSUInteger cost = CGImageGetBytesPerRow(image.CGImage) * CGImageGetHeight(image.CGImage);
+        NSUInteger totalCostLimit = bitmapCache.totalCostLimit;
+        if (image && (totalCostLimit == 0 || cost <= totalCostLimit)) {
+            [bitmapCache setObject:image forKey:key cost:cost];
+        }
+    }
+
+    return image;
+}
+
+#pragma mark - UIResponder
+
+- (BOOL)canBecomeFirstResponder {
+    return YES;
+}
+
+- (BOOL)canPerformAction:(SEL)action
+              withSender:(__unused id)sender
+{
+#if !TARGET_OS_TV
+    return (action == @selector(copy:));
+#else
+    return NO;
+#endif
+}
+
+- (void)touchesBegan:(NSSet *)touches
+           withEvent:(UIEvent *)event
+{
+    UITouch *touch = [touches anyObject];
+
+    self.activeLink = [self linkAtPoint:[touch locationInView:self]];
+
+    if (!self.activeLink) {
+        [super touchesBegan:touches withEvent:event];
+    }
+}
+
+- (void)touchesMoved:(NSSet *)touches
+           withEvent:(UIEvent *)event
+{
+    if (self.activeLink) {
+        UITouch *touch = [touches anyObject];
+
+        if (self.activeLink != [self linkAtPoint:[touch locationInView:self]]) {
+            self.activeLink = nil;
+        }
+    } else {
+        [super touchesMoved:touches withEvent:event];
+    }
+}
+
+- (void)touchesEnded:(NSSet *)touches
+           withEvent:(UIEvent *)event
+{
+    if (self.activeLink) {
+        if (self.activeLink.linkTapBlock) {
+            self.activeLink.linkTapBlock(self, self.activeLink);
+            self.activeLink = nil;
+            return;
+        }
+        
+        NSTextCheckingResult *result = self.activeLink.result;
+        self.activeLink = nil;
+
+        switch (result.resultType) {
+            case NSTextCheckingTypeLink:
+                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithURL:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithURL:result.URL];
+                    return;
+                }
+                break;
+            case NSTextCheckingTypeAddress:
+                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithAddress:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithAddress:result.addressComponents];
+                    return;
+                }
+                break;
+            case NSTextCheckingTypePhoneNumber:
+                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithPhoneNumber:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithPhoneNumber:result.phoneNumber];
+                    return;
+                }
+                break;
+            case NSTextCheckingTypeDate:
+                if (result.timeZone && [self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithDate:timeZone:duration:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithDate:result.date timeZone:result.timeZone duration:result.duration];
+                    return;
+                } else if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithDate:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithDate:result.date];
+                    return;
+                }
+                break;
+            case NSTextCheckingTypeTransitInformation:
+                if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithTransitInformation:)]) {
+                    [self.delegate attributedLabel:self didSelectLinkWithTransitInformation:result.components];
+                    return;
+                }
+            default:
+                break;
+        }
+
+        // Fallback to `attributedLabel:didSelectLinkWithTextCheckingResult:` if no other delegate method matched.
+        if ([self.delegate respondsToSelector:@selector(attributedLabel:didSelectLinkWithTextCheckingResult:)]) {
+            [self.delegate attributedLabel:self didSelectLinkWithTextCheckingResult:result];
+        }
+    } else {
+        [super touchesEnded:touches withEvent:event];
+    }
+}
+
+- (void)touchesCancelled:(NSSet *)touches
+               withEvent:(UIEvent *)event
+{
+    if (self.activeLink) {
+        self.activeLink = nil;
+    } else {
+        [super touchesCancelled:touches withEvent:event];
+    }
+}
+
+#pragma mark - UIGestureRecognizerDelegate
+
+- (BOOL)gestureRecognizer:(UIGestureRecognizer *)gestureRecognizer shouldReceiveTouch:(UITouch *)touch {
+    return [self containslinkAtPoint:[touch locationInView:self]];
+}
+
+#pragma mark - UILongPressGestureRecognizer
+
+- (void)longPressGestureDidFire:(UILongPressGestureRecognizer *)sender {
+    switch (sender.state) {
+        case UIGestureRecognizerStateBegan: {
+            CGPoint touchPoint = [sender locationInView:self];
+            TTTAttributedLabelLink *link = [self linkAtPoint:touchPoint];
+            
+            if (link) {
+                if (link.linkLongPressBlock) {
+                    link.linkLongPressBlock(self, link);
+                    return;
+                }
+                
+                NSTextCheckingResult *result = link.result;
+                
+                if (!result) {
+                    return;
+                }
+                
+                switch (result.resultType) {
+                    case NSTextCheckingTypeLink:
+                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithURL:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithURL:result.URL atPoint:touchPoint];
+                            return;
+                        }
+                        break;
+                    case NSTextCheckingTypeAddress:
+                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithAddress:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithAddress:result.addressComponents atPoint:touchPoint];
+                            return;
+                        }
+                        break;
+                    case NSTextCheckingTypePhoneNumber:
+                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithPhoneNumber:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithPhoneNumber:result.phoneNumber atPoint:touchPoint];
+                            return;
+                        }
+                        break;
+                    case NSTextCheckingTypeDate:
+                        if (result.timeZone && [self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithDate:timeZone:duration:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithDate:result.date timeZone:result.timeZone duration:result.duration atPoint:touchPoint];
+                            return;
+                        } else if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithDate:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithDate:result.date atPoint:touchPoint];
+                            return;
+                        }
+                        break;
+                    case NSTextCheckingTypeTransitInformation:
+                        if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithTransitInformation:atPoint:)]) {
+                            [self.delegate attributedLabel:self didLongPressLinkWithTransitInformation:result.components atPoint:touchPoint];
+                            return;
+                        }
+                    default:
+                        break;
+                }
+                
+                // Fallback to `attributedLabel:didLongPressLinkWithTextCheckingResult:atPoint:` if no other delegate method matched.
+                if ([self.delegate respondsToSelector:@selector(attributedLabel:didLongPressLinkWithTextCheckingResult:atPoint:)]) {
+                    [self.delegate attributedLabel:self didLongPressLinkWithTextCheckingResult:result atPoint:touchPoint];
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+#if !TARGET_OS_TV
+#pragma mark - UIResponderStandardEditActions
+
+- (void)copy:(__unused id)sender {
+    [[UIPasteboard generalPasteboard] setString:self.text];
+}
+#endif
+
+#pragma mark - NSCoding
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [super encodeWithCoder:coder];
+
+    [coder encodeObject:@(self.enabledTextCheckingTypes) forKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))];
+
+    [coder encodeObject:self.linkModels forKey:NSStringFromSelector(@selector(linkModels))];
+    if ([NSMutableParagraphStyle class]) {
+        [coder encodeObject:self.linkAttributes forKey:NSStringFromSelector(@selector(linkAttributes))];
+        [coder encodeObject:self.activeLinkAttributes forKey:NSStringFromSelector(@selector(activeLinkAttributes))];
+        [coder encodeObject:self.inactiveLinkAttributes forKey:NSStringFromSelector(@selector(inactiveLinkAttributes))];
+    }
+    [coder encodeObject:@(self.shadowRadius) forKey:NSStringFromSelector(@selector(shadowRadius))];
+    [coder encodeObject:@(self.highlightedShadowRadius) forKey:NSStringFromSelector(@selector(highlightedShadowRadius))];
+    [coder encodeCGSize:self.highlightedShadowOffset forKey:NSStringFromSelector(@selector(highlightedShadowOffset))];
+    [coder encodeObject:self.highlightedShadowColor forKey:NSStringFromSelector(@selector(highlightedShadowColor))];
+    [coder encodeObject:@(self.kern) forKey:NSStringFromSelector(@selector(kern))];
+    [coder encodeObject:@(self.firstLineIndent) forKey:NSStringFromSelector(@selector(firstLineIndent))];
+    [coder encodeObject:@(self.lineSpacing) forKey:NSStringFromSelector(@selector(lineSpacing))];
+    [coder encodeObject:@(self.lineHeightMultiple) forKey:NSStringFromSelector(@selector(lineHeightMultiple))];
+    [coder encodeUIEdgeInsets:self.textInsets forKey:NSStringFromSelector(@selector(textInsets))];
+    [coder encodeInteger:self.verticalAlignment forKey:NSStringFromSelector(@selector(verticalAlignment))];
+    [coder encodeBool:self.tiledRenderingEnabled forKey:NSStringFromSelector(@selector(tiledRenderingEnabled))];
+    [coder encodeBool:self.bitmapCachingEnabled forKey:NSStringFromSelector(@selector(bitmapCachingEnabled))];
+
+    [coder encodeObject:self.attributedTruncationToken forKey:NSStringFromSelector(@selector(attributedTruncationToken))];
+
+    [coder encodeObject:NSStringFromUIEdgeInsets(self.linkBackgroundEdgeInset) forKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))];
+    [coder encodeObject:self.attributedText forKey:NSStringFromSelector(@selector(attributedText))];
+    [coder encodeObject:self.text forKey:NSStringFromSelector(@selector(text))];
+}
+
+- (id)initWithCoder:(NSCoder *)coder {
+    self = [super initWithCoder:coder];
+    if (!self) {
+        return nil;
+    }
+
+    [self commonInit];
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))]) {
+        self.enabledTextCheckingTypes = [[coder decodeObjectForKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))] unsignedLongLongValue];
+    }
+
+    if ([NSMutableParagraphStyle class]) {
+        if ([coder containsValueForKey:NSStringFromSelector(@selector(linkAttributes))]) {
+            self.linkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(linkAttributes))];
+        }
+
+        if ([coder containsValueForKey:NSStringFromSelector(@selector(activeLinkAttributes))]) {
+            self.activeLinkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(activeLinkAttributes))];
+        }
+
+        if ([coder containsValueForKey:NSStringFromSelector(@selector(inactiveLinkAttributes))]) {
+            self.inactiveLinkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(inactiveLinkAttributes))];
+        }
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(links))]) {
+        NSArray *oldLinks = [coder decodeObjectForKey:NSStringFromSelector(@selector(links))];
+        [self addLinksWithTextCheckingResults:oldLinks attributes:nil];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(linkModels))]) {
+        self.linkModels = [coder decodeObjectForKey:NSStringFromSelector(@selector(linkModels))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(shadowRadius))]) {
+        self.shadowRadius = [[coder decodeObjectForKey:NSStringFromSelector(@selector(shadowRadius))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowRadius))]) {
+        self.highlightedShadowRadius = [[coder decodeObjectForKey:NSStringFromSelector(@selector(highlightedShadowRadius))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowOffset))]) {
+        self.highlightedShadowOffset = [coder decodeCGSizeForKey:NSStringFromSelector(@selector(highlightedShadowOffset))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowColor))]) {
+        self.highlightedShadowColor = [coder decodeObjectForKey:NSStringFromSelector(@selector(highlightedShadowColor))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(kern))]) {
+        self.kern = [[coder decodeObjectForKey:NSStringFromSelector(@selector(kern))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(firstLineIndent))]) {
+        self.firstLineIndent = [[coder decodeObjectForKey:NSStringFromSelector(@selector(firstLineIndent))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(lineSpacing))]) {
+        self.lineSpacing = [[coder decodeObjectForKey:NSStringFromSelector(@selector(lineSpacing))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(minimumLineHeight))]) {
+        self.minimumLineHeight = [[coder decodeObjectForKey:NSStringFromSelector(@selector(minimumLineHeight))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(maximumLineHeight))]) {
+        self.maximumLineHeight = [[coder decodeObjectForKey:NSStringFromSelector(@selector(maximumLineHeight))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(lineHeightMultiple))]) {
+        self.lineHeightMultiple = [[coder decodeObjectForKey:NSStringFromSelector(@selector(lineHeightMultiple))] floatValue];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(textInsets))]) {
+        self.textInsets = [coder decodeUIEdgeInsetsForKey:NSStringFromSelector(@selector(textInsets))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(verticalAlignment))]) {
+        self.verticalAlignment = [coder decodeIntegerForKey:NSStringFromSelector(@selector(verticalAlignment))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(tiledRenderingEnabled))]) {
+        self.tiledRenderingEnabled = [coder decodeBoolForKey:NSStringFromSelector(@selector(tiledRenderingEnabled))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(bitmapCachingEnabled))]) {
+        self.bitmapCachingEnabled = [coder decodeBoolForKey:NSStringFromSelector(@selector(bitmapCachingEnabled))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(attributedTruncationToken))]) {
+        self.attributedTruncationToken = [coder decodeObjectForKey:NSStringFromSelector(@selector(attributedTruncationToken))];
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))]) {
+        self.linkBackgroundEdgeInset = UIEdgeInsetsFromString([coder decodeObjectForKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))]);
+    }
+
+    if ([coder containsValueForKey:NSStringFromSelector(@selector(attributedText))]) {
+        self.attributedText = [coder decodeObjectForKey:NSStringFromSelector(@selector(attributedText))];
+    } else {
+        self.text = super.text;
+    }
+    
+    return self;
+}
+
+@end
+
+#pragma mark - TTTAttributedLabelLink
+
+@implementation TTTAttributedLabelLink
+
+- (instancetype)initWithAttributes:(NSDictionary *)attributes
+                  activeAttributes:(NSDictionary *)activeAttributes
+                inactiveAttributes:(NSDictionary *)inactiveAttributes
+                textCheckingResult:(NSTextCheckingResult *)result {
+    
+    if ((self = [super init])) {
+        _result = result;
+        _attributes = [attributes copy];
+        _activeAttributes = [activeAttributes copy];
+        _inactiveAttributes = [inactiveAttributes copy];
+    }
+    
+    return self;
+}
+
+- (instancetype)initWithAttributesFromLabel:(TTTAttributedLabel*)label
+                         textCheckingResult:(NSTextCheckingResult *)result {
+    
+    return [self initWithAttributes:label.linkAttributes
+                   activeAttributes:label.activeLinkAttributes
+                 inactiveAttributes:label.inactiveLinkAttributes
+                 textCheckingResult:result];
+}
+
+#pragma mark - Accessibility
+
+- (NSString *) accessibilityValue {
+    if ([_accessibilityValue length] == 0) {
+        switch (self.result.resultType) {
+            case NSTextCheckingTypeLink:
+                _accessibilityValue = self.result.URL.absoluteString;
+                break;
+            case NSTextCheckingTypePhoneNumber:
+                _accessibilityValue = self.result.phoneNumber;
+                break;
+            case NSTextCheckingTypeDate:
+                _accessibilityValue = [NSDateFormatter localizedStringFromDate:self.result.date
+                                                                     dateStyle:NSDateFormatterLongStyle
+                                                                     timeStyle:NSDateFormatterLongStyle];
+                break;
+            default:
+                break;
+        }
+    }
+    
+    return _accessibilityValue;
+}
+
+#pragma mark - NSCoding
+
+- (void)encodeWithCoder:(NSCoder *)aCoder {
+    [aCoder encodeObject:self.result forKey:NSStringFromSelector(@selector(result))];
+    [aCoder encodeObject:self.attributes forKey:NSStringFromSelector(@selector(attributes))];
+    [aCoder encodeObject:self.activeAttributes forKey:NSStringFromSelector(@selector(activeAttributes))];
+    [aCoder encodeObject:self.inactiveAttributes forKey:NSStringFromSelector(@selector(inactiveAttributes))];
+    [aCoder encodeObject:self.accessibilityValue forKey:NSStringFromSelector(@selector(accessibilityValue))];
+}
+
+- (id)initWithCoder:(NSCoder *)aDecoder {
+    if ((self = [super init])) {
+        _result = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(result))];
+        _attributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(attributes))];
+        _activeAttributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(activeAttributes))];
+        _inactiveAttributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(inactiveAttributes))];
+        self.accessibilityValue = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(accessibilityValue))];
+    }
+    
+    return self;
+}
+
+@end
+
+#pragma mark - TTTAttributedLabelCache
+
+@interface TTTAttributedLabelCacheEntry : NSObject
+@property (nonatomic, strong) id key;
+@property (nonatomic, strong) id object;
+@property (nonatomic, assign) NSUInteger cost;
+@property (nonatomic, unsafe_unretained) TTTAttributedLabelCacheEntry *previous;
+@property (nonatomic, unsafe_unretained) TTTAttributedLabelCacheEntry *next;
+@end
+
+@implementation TTTAttributedLabelCacheEntry
+@end
+
+@implementation TTTAttributedLabelCache {
+@private
+    NSMutableDictionary *_entries;
+    // Entries are ordered from most (head) to least (tail) recently used, and are retained by `_entries`
+    __unsafe_unretained TTTAttributedLabelCacheEntry *_head;
+    __unsafe_unretained TTTAttributedLabelCacheEntry *_tail;
+}
+
+@synthesize countLimit = _countLimit;
+@synthesize totalCostLimit = _totalCostLimit;
+@synthesize totalCost = _totalCost;
+@synthesize hitCount = _hitCount;
+@synthesize missCount = _missCount;
+
+- (instancetype)init {
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _entries = [NSMutableDictionary dictionary];
+
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (NSUInteger)countLimit {
+    @synchronized(self) {
+        return _countLimit;
+    }
+}
+
+- (void)setCountLimit:(NSUInteger)countLimit {
+    @synchronized(self) {
+        _countLimit = countLimit;
+        [self evictEntriesExceedingLimits];
+    }
+}
+
+- (NSUInteger)totalCostLimit {
+    @synchronized(self) {
+        return _totalCostLimit;
+    }
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    @synchronized(self) {
+        _totalCostLimit = totalCostLimit;
+        [self evictEntriesExceedingLimits];
+    }
+}
+
+- (NSUInteger)count {
+    @synchronized(self) {
+        return [_entries count];
+    }
+}
+
+- (NSUInteger)totalCost {
+    @synchronized(self) {
+        return _totalCost;
+    }
+}
+
+- (NSUInteger)hitCount {
+    @synchronized(self) {
+        return _hitCount;
+    }
+}
+
+- (NSUInteger)missCount {
+    @synchronized(self) {
+        return _missCount;
+    }
+}
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id object))block {
+    NSArray *entries = nil;
+    @synchronized(self) {
+        entries = [_entries allValues];
+    }
+
+    for (TTTAttributedLabelCacheEntry *entry in entries) {
+        block(entry.key, entry.object);
+    }
+}
+
+- (id)objectForKey:(id)key {
+    if (!key) {
+        return nil;
+    }
+
+    @synchronized(self) {
+        TTTAttributedLabelCacheEntry *entry = [_entries objectForKey:key];
+        if (!entry) {
+            _missCount++;
+            return nil;
+        }
+
+        _hitCount++;
+        [self unlinkEntry:entry];
+        [self linkEntryAtHead:entry];
+
+        return entry.object;
+    }
+}
+
+- (void)setObject:(id)object
+           forKey:(id <NSCopying>)key
+{
+    [self setObject:object forKey:key cost:0];
+}
+
+- (void)setObject:(id)object
+           forKey:(id <NSCopying>)key
+             cost:(NSUInteger)cost
+{
+    if (!key) {
+        return;
+    }
+
+    if (!object) {
+        [self removeObjectForKey:key];
+        return;
+    }
+
+    id copiedKey = [(id <NSCopying>)key copyWithZone:NULL];
+
+    @synchronized(self) {
+        TTTAttributedLabelCacheEntry *entry = [_entries objectForKey:copiedKey];
+        if (entry) {
+            _totalCost -= entry.cost;
+            [self unlinkEntry:entry];
+        } else {
+            entry = [[TTTAttributedLabelCacheEntry alloc] init];
+            entry.key = copiedKey;
+            [_entries setObject:entry forKey:copiedKey];
+        }
+
+        entry.object = object;
+        entry.cost = cost;
+        _totalCost += cost;
+        [self linkEntryAtHead:entry];
+
+        [self evictEntriesExceedingLimits];
+    }
+}
+
+- (void)removeObjectForKey:(id)key {
+    if (!key) {
+        return;
+    }
+
+    @synchronized(self) {
+        TTTAttributedLabelCacheEntry *entry = [_entries objectForKey:key];
+        if (entry) {
+            [self removeEntry:entry];
+        }
+    }
+}
+
+- (void)removeAllObjects {
+    @synchronized(self) {
+        _head = nil;
+        _tail = nil;
+        _totalCost = 0;
+        [_entries removeAllObjects];
+    }
+}
+
+- (void)resetStatistics {
+    @synchronized(self) {
+        _hitCount = 0;
+        _missCount = 0;
+    }
+}
+
+#pragma mark -
+
+// The following methods must be called while holding the lock on self
+
+- (void)linkEntryAtHead:(TTTAttributedLabelCacheEntry *)entry {
+    entry.previous = nil;
+    entry.next = _head;
+
+    if (_head) {
+        _head.previous = entry;
+    }
+
+    _head = entry;
+
+    if (!_tail) {
+        _tail = entry;
+    }
+}
+
+- (void)unlinkEntry:(TTTAttributedLabelCacheEntry *)entry {
+    if (entry.previous) {
+        entry.previous.next = entry.next;
+    } else {
+        _head = entry.next;
+    }
+
+    if (entry.next) {
+        entry.next.previous = entry.previous;
+    } else {
+        _tail = entry.previous;
+    }
+
+    entry.previous = nil;
+    entry.next = nil;
+}
+
+- (void)removeEntry:(TTTAttributedLabelCacheEntry *)entry {
+    [self unlinkEntry:entry];
+    _totalCost -= entry.cost;
+    [_entries removeObjectForKey:entry.key];
+}
+
+- (void)evictEntriesExceedingLimits {
+    while (_tail && ((_countLimit > 0 && [_entries count] > _countLimit) || (_totalCostLimit > 0 && _totalCost > _totalCostLimit))) {
+        [self removeEntry:_tail];
+    }
+}
+
+@end
+
+#pragma mark - TTTAttributedLabelLayout
+
+@implementation TTTAttributedLabelLayout
+
+- (instancetype)initWithAttributedString:(NSAttributedString *)attributedString
+                                   width:(CGFloat)width
+                           numberOfLines:(NSUInteger)numberOfLines
+                              textInsets:(UIEdgeInsets)textInsets
+{
+    self = [super init];
+    if (!self) {
+        return nil;
+    }
+
+    _attributedString = [attributedString copy];
+    _width = width;
+    _numberOfLines = numberOfLines;
+    _textInsets = textInsets;
+
+    if ([_attributedString length] == 0) {
+        return self;
+    }
+
+    CFTimeInterval beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFramesetterCreation, nil);
+    _framesetter = CTFramesetterCreateWithAttributedString((__bridge CFAttributedStringRef)_attributedString);
+    TTTInstrumentationEnd(TTTAttributedLabelTraceEventFramesetterCreation, nil, beginTime);
+    if (!_framesetter) {
+        return self;
+    }
+
+    CGFloat textWidth = MAX(width - textInsets.left - textInsets.right, 0.0f);
+    CGSize textSize = TTTSizeThatFitsAttributedStringWithFramesetter(_attributedString, _framesetter, CGSizeMake(textWidth, TTTFLOAT_MAX), numberOfLines, nil);
+
+    _size = CGSizeMake(textSize.width + textInsets.left + textInsets.right, textSize.height + textInsets.top + textInsets.bottom);
+    _bounds = CGRectMake(0.0f, 0.0f, width, _size.height);
+    _textRect = CGRectMake(textInsets.left, textInsets.top, textWidth, textSize.height);
+
+    // Typeset the lines that a label with these bounds displays, so that it does not have to
+    CGMutablePathRef path = CGPathCreateMutable();
+    CGPathAddRect(path, NULL, _textRect);
+    beginTime = TTTInstrumentationBegin(TTTAttributedLabelTraceEventFrameCreation, nil);
+    _frame = CTFramesetterCreateFrame(_framesetter, CTFramesetterGetBoundedTextRange(_framesetter, _attributedString, CFRangeMake(0, (CFIndex)[_attributedString length]), textWidth, (NSInteger)numberOfLines), path, NULL);
+    TTTInstrumentationEnd(TTTAttributedLabelTraceEventFrameCreation, nil, beginTime);
+    CGPathRelease(path);
+
+    return self;
+}
+
+- (void)dealloc {
+    if (_frame) {
+        CFRelease(_frame);
+    }
+
+    if (_framesetter) {
+        CFRelease(_framesetter);
+    }
+}
+
+@end
+
+#pragma mark - TTTAttributedLabelStatistics
+
+@implementation TTTAttributedLabelStatistics {
+@private
+    TTTAttributedLabelCounters _counters;
+}
+
+- (instancetype)initWithCounters:(TTTAttributedLabelCounters)counters {
+    self = [super init];
+    if (!self) {
+        return nil;
     }
+
+    _counters = counters;
+
+    return self;
 }
 
-#if !TARGET_OS_TV
-#pragma mark - UIResponderStandardEditActions
+- (NSUInteger)countForEvent:(TTTAttributedLabelTraceEvent)event {
+    if (event < 0 || event >= kTTTTraceEventCount) {
+        return 0;
+    }
 
-- (void)copy:(__unused id)sender {
-    [[UIPasteboard generalPasteboard] setString:self.text];
+    return _counters.counts[event];
 }
-#endif
 
-#pragma mark - NSCoding
+- (NSTimeInterval)durationForEvent:(TTTAttributedLabelTraceEvent)event {
+    if (event < 0 || event >= kTTTTraceEventCount) {
+        return 0;
+    }
 
-- (void)encodeWithCoder:(NSCoder *)coder {
-    [super encodeWithCoder:coder];
+    return _counters.durations[event];
+}
 
-    [coder encodeObject:@(self.enabledTextCheckingTypes) forKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))];
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p framesetters: %lu, frames: %lu, sizeThatFits: %lu, truncations: %lu, detections: %lu queued, %lu run, %lu discarded, size cache: %lu hits, %lu misses, detection cache: %lu hits, %lu misses, bitmap cache: %lu hits, %lu misses>", NSStringFromClass([self class]), (void *)self,
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventFramesetterCreation],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventFrameCreation],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventSizeThatFits],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventTruncation],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventDataDetectionQueued],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventDataDetection],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventDataDetectionDiscarded],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventSizeCacheHit],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventSizeCacheMiss],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventDataDetectionCacheHit],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventDataDetectionCacheMiss],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventBitmapCacheHit],
+            (unsigned long)_counters.counts[TTTAttributedLabelTraceEventBitmapCacheMiss]];
+}
 
-    [coder encodeObject:self.linkModels forKey:NSStringFromSelector(@selector(linkModels))];
-    if ([NSMutableParagraphStyle class]) {
-        [coder encodeObject:self.linkAttributes forKey:NSStringFromSelector(@selector(linkAttributes))];
-        [coder encodeObject:self.activeLinkAttributes forKey:NSStringFromSelector(@selector(activeLinkAttributes))];
-        [coder encodeObject:self.inactiveLinkAttributes forKey:NSStringFromSelector(@selector(inactiveLinkAttributes))];
-    }
-    [coder encodeObject:@(self.shadowRadius) forKey:NSStringFromSelector(@selector(shadowRadius))];
-    [coder encodeObject:@(self.highlightedShadowRadius) forKey:NSStringFromSelector(@selector(highlightedShadowRadius))];
-    [coder encodeCGSize:self.highlightedShadowOffset forKey:NSStringFromSelector(@selector(highlightedShadowOffset))];
-    [coder encodeObject:self.highlightedShadowColor forKey:NSStringFromSelector(@selector(highlightedShadowColor))];
-    [coder encodeObject:@(self.kern) forKey:NSStringFromSelector(@selector(kern))];
-    [coder encodeObject:@(self.firstLineIndent) forKey:NSStringFromSelector(@selector(firstLineIndent))];
-    [coder encodeObject:@(self.lineSpacing) forKey:NSStringFromSelector(@selector(lineSpacing))];
-    [coder encodeObject:@(self.lineHeightMultiple) forKey:NSStringFromSelector(@selector(lineHeightMultiple))];
-    [coder encodeUIEdgeInsets:self.textInsets forKey:NSStringFromSelector(@selector(textInsets))];
-    [coder encodeInteger:self.verticalAlignment forKey:NSStringFromSelector(@selector(verticalAlignment))];
+@end
 
-    [coder encodeObject:self.attributedTruncationToken forKey:NSStringFromSelector(@selector(attributedTruncationToken))];
+#pragma mark - TTTAttributedLabelScanner
 
-    [coder encodeObject:NSStringFromUIEdgeInsets(self.linkBackgroundEdgeInset) forKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))];
-    [coder encodeObject:self.attributedText forKey:NSStringFromSelector(@selector(attributedText))];
-    [coder encodeObject:self.text forKey:NSStringFromSelector(@selector(text))];
+static inline BOOL TTTIsASCIILetter(unichar c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
-- (id)initWithCoder:(NSCoder *)coder {
-    self = [super initWithCoder:coder];
-    if (!self) {
-        return nil;
-    }
+static inline BOOL TTTIsASCIIDigit(unichar c) {
+    return c >= '0' && c <= '9';
+}
 
-    [self commonInit];
+static inline BOOL TTTIsHostCharacter(unichar c) {
+    return TTTIsASCIILetter(c) || TTTIsASCIIDigit(c) || c == '-';
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))]) {
-        self.enabledTextCheckingTypes = [[coder decodeObjectForKey:NSStringFromSelector(@selector(enabledTextCheckingTypes))] unsignedLongLongValue];
-    }
+static inline BOOL TTTIsSchemeCharacter(unichar c) {
+    return TTTIsASCIILetter(c) || TTTIsASCIIDigit(c) || c == '+' || c == '-' || c == '.';
+}
 
-    if ([NSMutableParagraphStyle class]) {
-        if ([coder containsValueForKey:NSStringFromSelector(@selector(linkAttributes))]) {
-            self.linkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(linkAttributes))];
-        }
+static inline BOOL TTTIsEmailLocalPartCharacter(unichar c) {
+    return TTTIsASCIILetter(c) || TTTIsASCIIDigit(c) || c == '.' || c == '_' || c == '%' || c == '+' || c == '-';
+}
 
-        if ([coder containsValueForKey:NSStringFromSelector(@selector(activeLinkAttributes))]) {
-            self.activeLinkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(activeLinkAttributes))];
-        }
+static inline BOOL TTTIsURLCharacter(unichar c) {
+    return c > ' ' && c < 0x7F && c != '<' && c != '>' && c != '"' && c != '{' && c != '}' && c != '|' && c != '\\' && c != '^' && c != '`';
+}
 
-        if ([coder containsValueForKey:NSStringFromSelector(@selector(inactiveLinkAttributes))]) {
-            self.inactiveLinkAttributes = [coder decodeObjectForKey:NSStringFromSelector(@selector(inactiveLinkAttributes))];
-        }
-    }
+static inline BOOL TTTIsMentionCharacter(unichar c) {
+    return TTTIsASCIILetter(c) || TTTIsASCIIDigit(c) || c == '_';
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(links))]) {
-        NSArray *oldLinks = [coder decodeObjectForKey:NSStringFromSelector(@selector(links))];
-        [self addLinksWithTextCheckingResults:oldLinks attributes:nil];
-    }
+static inline BOOL TTTIsHashtagCharacter(unichar c) {
+    static NSCharacterSet *_alphanumericCharacterSet = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _alphanumericCharacterSet = [NSCharacterSet alphanumericCharacterSet];
+    });
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(linkModels))]) {
-        self.linkModels = [coder decodeObjectForKey:NSStringFromSelector(@selector(linkModels))];
-    }
+    return TTTIsMentionCharacter(c) || (c > 0x7F && [_alphanumericCharacterSet characterIsMember:c]);
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(shadowRadius))]) {
-        self.shadowRadius = [[coder decodeObjectForKey:NSStringFromSelector(@selector(shadowRadius))] floatValue];
-    }
+static inline BOOL TTTIsPhoneSeparator(unichar c) {
+    return c == ' ' || c == '-' || c == '.' || c == '(' || c == ')';
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowRadius))]) {
-        self.highlightedShadowRadius = [[coder decodeObjectForKey:NSStringFromSelector(@selector(highlightedShadowRadius))] floatValue];
-    }
+static uint64_t const TTTUTF16LaneOnes = 0x0001000100010001ULL;
+static uint64_t const TTTUTF16LaneHighBits = 0x8000800080008000ULL;
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowOffset))]) {
-        self.highlightedShadowOffset = [coder decodeCGSizeForKey:NSStringFromSelector(@selector(highlightedShadowOffset))];
-    }
+static inline uint64_t TTTUTF16LanesEqualToZero(uint64_t lanes) {
+    return (lanes - TTTUTF16LaneOnes) & ~lanes & TTTUTF16LaneHighBits;
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(highlightedShadowColor))]) {
-        self.highlightedShadowColor = [coder decodeObjectForKey:NSStringFromSelector(@selector(highlightedShadowColor))];
-    }
+// Tests four UTF-16 code units at once for a `.`, an `@`, a unit in 0x30-0x3F, which covers digits and `:`, and optionally a `#`
+static inline BOOL TTTUTF16BlockMayStartMatch(const unichar *characters, BOOL matchesNumberSign) {
+    uint64_t lanes;
+    memcpy(&lanes, characters, sizeof(lanes));
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(kern))]) {
-        self.kern = [[coder decodeObjectForKey:NSStringFromSelector(@selector(kern))] floatValue];
+    uint64_t matches = (TTTUTF16LanesEqualToZero(lanes ^ (TTTUTF16LaneOnes * '.')) |
+                        TTTUTF16LanesEqualToZero(lanes ^ (TTTUTF16LaneOnes * '@')) |
+                        TTTUTF16LanesEqualToZero((lanes & (TTTUTF16LaneOnes * 0xFFF0)) ^ (TTTUTF16LaneOnes * 0x0030)));
+    if (matchesNumberSign) {
+        matches |= TTTUTF16LanesEqualToZero(lanes ^ (TTTUTF16LaneOnes * '#'));
     }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(firstLineIndent))]) {
-        self.firstLineIndent = [[coder decodeObjectForKey:NSStringFromSelector(@selector(firstLineIndent))] floatValue];
-    }
+    return matches != 0;
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(lineSpacing))]) {
-        self.lineSpacing = [[coder decodeObjectForKey:NSStringFromSelector(@selector(lineSpacing))] floatValue];
-    }
+// Excludes trailing punctuation, which usually ends the sentence rather than the URL
+static NSUInteger TTTURLEndByTrimmingPunctuation(const unichar *characters, NSUInteger start, NSUInteger end) {
+    while (end > start) {
+        unichar c = characters[end - 1];
+        if (c == '.' || c == ',' || c == ';' || c == ':' || c == '!' || c == '?' || c == '\'' || c == '"') {
+            end--;
+        } else if (c == ')') {
+            NSInteger depth = 0;
+            for (NSUInteger idx = start; idx < end; idx++) {
+                depth += characters[idx] == '(' ? 1 : (characters[idx] == ')' ? -1 : 0);
+            }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(minimumLineHeight))]) {
-        self.minimumLineHeight = [[coder decodeObjectForKey:NSStringFromSelector(@selector(minimumLineHeight))] floatValue];
-    }
+            if (depth >= 0) {
+                break;
+            }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(maximumLineHeight))]) {
-        self.maximumLineHeight = [[coder decodeObjectForKey:NSStringFromSelector(@selector(maximumLineHeight))] floatValue];
+            end--;
+        } else {
+            break;
+        }
     }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(lineHeightMultiple))]) {
-        self.lineHeightMultiple = [[coder decodeObjectForKey:NSStringFromSelector(@selector(lineHeightMultiple))] floatValue];
-    }
+    return end;
+}
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(textInsets))]) {
-        self.textInsets = [coder decodeUIEdgeInsetsForKey:NSStringFromSelector(@selector(textInsets))];
-    }
+// Returns the end of the host starting at `start`, or `start` if it does not end in a plausible top-level domain
+static NSUInteger TTTHostEnd(const unichar *characters, NSUInteger start, NSUInteger length, BOOL requiresKnownTopLevelDomain) {
+    static NSSet *_topLevelDomains = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _topLevelDomains = [NSSet setWithObjects:@"com", @"net", @"org", @"edu", @"gov", @"mil", @"int", @"info", @"biz", @"name", @"pro", @"io", @"co", @"me", @"app", @"dev", @"tv", @"ly", @"fm", nil];
+    });
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(verticalAlignment))]) {
-        self.verticalAlignment = [coder decodeIntegerForKey:NSStringFromSelector(@selector(verticalAlignment))];
+    NSUInteger end = start;
+    NSUInteger lastDot = NSNotFound;
+    while (end < length && (TTTIsHostCharacter(characters[end]) || (characters[end] == '.' && end > start && end + 1 < length && TTTIsHostCharacter(characters[end + 1])))) {
+        if (characters[end] == '.') {
+            lastDot = end;
+        }
+        end++;
     }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(attributedTruncationToken))]) {
-        self.attributedTruncationToken = [coder decodeObjectForKey:NSStringFromSelector(@selector(attributedTruncationToken))];
+    if (lastDot == NSNotFound || end - lastDot - 1 < 2) {
+        return start;
     }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))]) {
-        self.linkBackgroundEdgeInset = UIEdgeInsetsFromString([coder decodeObjectForKey:NSStringFromSelector(@selector(linkBackgroundEdgeInset))]);
+    for (NSUInteger idx = lastDot + 1; idx < end; idx++) {
+        if (!TTTIsASCIILetter(characters[idx])) {
+            return start;
+        }
     }
 
-    if ([coder containsValueForKey:NSStringFromSelector(@selector(attributedText))]) {
-        self.attributedText = [coder decodeObjectForKey:NSStringFromSelector(@selector(attributedText))];
-    } else {
-        self.text = super.text;
+    if (requiresKnownTopLevelDomain) {
+        NSString *topLevelDomain = [[NSString alloc] initWithCharactersNoCopy:(unichar *)(characters + lastDot + 1) length:end - lastDot - 1 freeWhenDone:NO];
+        // Two letter country code domains are only accepted in lowercase, which rules out most abbreviations
+        BOOL isCountryCode = [topLevelDomain length] == 2 && [[topLevelDomain lowercaseString] isEqualToString:topLevelDomain];
+        if (!isCountryCode && ![_topLevelDomains containsObject:[topLevelDomain lowercaseString]]) {
+            return start;
+        }
     }
-    
-    return self;
+
+    return end;
 }
 
-@end
+@implementation TTTAttributedLabelScanner
 
-#pragma mark - TTTAttributedLabelLink
+@synthesize checkingTypes = _checkingTypes;
+@synthesize configurationIdentifier = _configurationIdentifier;
 
-@implementation TTTAttributedLabelLink
++ (instancetype)scannerWithTypes:(NSTextCheckingTypes)checkingTypes {
+    return [[self alloc] initWithTypes:checkingTypes];
+}
 
-- (instancetype)initWithAttributes:(NSDictionary *)attributes
-                  activeAttributes:(NSDictionary *)activeAttributes
-                inactiveAttributes:(NSDictionary *)inactiveAttributes
-                textCheckingResult:(NSTextCheckingResult *)result {
-    
-    if ((self = [super init])) {
-        _result = result;
-        _attributes = [attributes copy];
-        _activeAttributes = [activeAttributes copy];
-        _inactiveAttributes = [inactiveAttributes copy];
+- (instancetype)initWithTypes:(NSTextCheckingTypes)checkingTypes {
+    return [self initWithTypes:checkingTypes mentionURLScheme:@"mention" hashtagURLScheme:@"hashtag"];
+}
+
+- (instancetype)initWithTypes:(NSTextCheckingTypes)checkingTypes
+             mentionURLScheme:(NSString *)mentionURLScheme
+             hashtagURLScheme:(NSString *)hashtagURLScheme
+{
+    NSParameterAssert(mentionURLScheme);
+    NSParameterAssert(hashtagURLScheme);
+
+    self = [super init];
+    if (!self) {
+        return nil;
     }
-    
+
+    _checkingTypes = checkingTypes & (NSTextCheckingTypeLink | NSTextCheckingTypePhoneNumber | TTTTextCheckingTypeMention | TTTTextCheckingTypeHashtag);
+    _mentionURLScheme = [mentionURLScheme copy];
+    _hashtagURLScheme = [hashtagURLScheme copy];
+
+    // Scanners that link mentions or hashtags to different schemes find different results for the same text
+    _configurationIdentifier = [NSString stringWithFormat:@"%@ %@", _mentionURLScheme, _hashtagURLScheme];
+
     return self;
 }
 
-- (instancetype)initWithAttributesFromLabel:(TTTAttributedLabel*)label
-                         textCheckingResult:(NSTextCheckingResult *)result {
-    
-    return [self initWithAttributes:label.linkAttributes
-                   activeAttributes:label.activeLinkAttributes
-                 inactiveAttributes:label.inactiveLinkAttributes
-                 textCheckingResult:result];
-}
+- (NSArray *)matchesInString:(NSString *)string
+                     options:(__unused NSMatchingOptions)options
+                       range:(NSRange)range
+{
+    NSMutableArray *results = [NSMutableArray array];
+    NSUInteger length = range.length;
+    if (length == 0 || _checkingTypes == 0) {
+        return results;
+    }
 
-#pragma mark - Accessibility
+    BOOL detectsLinks = (_checkingTypes & NSTextCheckingTypeLink) != 0;
+    BOOL detectsPhoneNumbers = (_checkingTypes & NSTextCheckingTypePhoneNumber) != 0;
+    BOOL detectsMentions = (_checkingTypes & TTTTextCheckingTypeMention) != 0;
+    BOOL detectsHashtags = (_checkingTypes & TTTTextCheckingTypeHashtag) != 0;
 
-- (NSString *) accessibilityValue {
-    if ([_accessibilityValue length] == 0) {
-        switch (self.result.resultType) {
-            case NSTextCheckingTypeLink:
-                _accessibilityValue = self.result.URL.absoluteString;
-                break;
-            case NSTextCheckingTypePhoneNumber:
-                _accessibilityValue = self.result.phoneNumber;
-                break;
-            case NSTextCheckingTypeDate:
-                _accessibilityValue = [NSDateFormatter localizedStringFromDate:self.result.date
-                                                                     dateStyle:NSDateFormatterLongStyle
-                                                                     timeStyle:NSDateFormatterLongStyle];
-                break;
-            default:
-                break;
+    unichar *characters = malloc(length * sizeof(unichar));
+    [string getCharacters:characters range:range];
+
+    // Matches may extend back before the character that triggered them, but never into a previous match
+    NSUInteger previousMatchEnd = 0;
+    NSUInteger idx = 0;
+
+    while (idx < length) {
+        if (idx + 4 <= length && !TTTUTF16BlockMayStartMatch(characters + idx, detectsHashtags)) {
+            idx += 4;
+            continue;
         }
-    }
-    
-    return _accessibilityValue;
-}
 
-#pragma mark - NSCoding
+        unichar c = characters[idx];
+        NSRange matchRange = NSMakeRange(NSNotFound, 0);
+        NSTextCheckingResult *result = nil;
 
-- (void)encodeWithCoder:(NSCoder *)aCoder {
-    [aCoder encodeObject:self.result forKey:NSStringFromSelector(@selector(result))];
-    [aCoder encodeObject:self.attributes forKey:NSStringFromSelector(@selector(attributes))];
-    [aCoder encodeObject:self.activeAttributes forKey:NSStringFromSelector(@selector(activeAttributes))];
-    [aCoder encodeObject:self.inactiveAttributes forKey:NSStringFromSelector(@selector(inactiveAttributes))];
-    [aCoder encodeObject:self.accessibilityValue forKey:NSStringFromSelector(@selector(accessibilityValue))];
-}
+        if (detectsLinks && c == ':' && idx + 2 < length && characters[idx + 1] == '/' && characters[idx + 2] == '/') {
+            NSUInteger start = idx;
+            while (start > previousMatchEnd && TTTIsSchemeCharacter(characters[start - 1])) {
+                start--;
+            }
+            while (start < idx && !TTTIsASCIILetter(characters[start])) {
+                start++;
+            }
 
-- (id)initWithCoder:(NSCoder *)aDecoder {
-    if ((self = [super init])) {
-        _result = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(result))];
-        _attributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(attributes))];
-        _activeAttributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(activeAttributes))];
-        _inactiveAttributes = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(inactiveAttributes))];
-        self.accessibilityValue = [aDecoder decodeObjectForKey:NSStringFromSelector(@selector(accessibilityValue))];
+            NSUInteger end = idx + 3;
+            while (end < length && TTTIsURLCharacter(characters[end])) {
+                end++;
+            }
+            end = TTTURLEndByTrimmingPunctuation(characters, idx + 3, end);
+
+            if (start < idx && end > idx + 3) {
+                matchRange = NSMakeRange(start, end - start);
+                NSURL *URL = [NSURL URLWithString:[string substringWithRange:NSMakeRange(range.location + start, end - start)]];
+                if (URL) {
+                    result = [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(range.location + start, end - start) URL:URL];
+                }
+            }
+        } else if ((detectsLinks || detectsMentions) && c == '@') {
+            NSUInteger start = idx;
+            while (detectsLinks && start > previousMatchEnd && TTTIsEmailLocalPartCharacter(characters[start - 1])) {
+                start--;
+            }
+
+            NSUInteger end = detectsLinks ? TTTHostEnd(characters, idx + 1, length, NO) : idx + 1;
+            if (start < idx && end > idx + 1) {
+                matchRange = NSMakeRange(start, end - start);
+                NSString *address = [string substringWithRange:NSMakeRange(range.location + start, end - start)];
+                NSURL *URL = [NSURL URLWithString:[@"mailto:" stringByAppendingString:address]];
+                if (URL) {
+                    result = [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(range.location + start, end - start) URL:URL];
+                }
+            } else if (detectsMentions && (idx == 0 || !(TTTIsMentionCharacter(characters[idx - 1]) || characters[idx - 1] == '@'))) {
+                // Mentions start a word, so that the `@` of an address that is not matched as one does not start a mention
+                end = idx + 1;
+                while (end < length && TTTIsMentionCharacter(characters[end])) {
+                    end++;
+                }
+
+                if (end > idx + 1) {
+                    matchRange = NSMakeRange(idx, end - idx);
+                    NSString *name = [string substringWithRange:NSMakeRange(range.location + idx + 1, end - idx - 1)];
+                    NSURL *URL = [NSURL URLWithString:[NSString stringWithFormat:@"%@:%@", _mentionURLScheme, name]];
+                    if (URL) {
+                        result = [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(range.location + idx, end - idx) URL:URL];
+                    }
+                }
+            }
+        } else if (detectsHashtags && c == '#') {
+            // Hashtags start a word, which excludes character references such as `&#39;`, and are not only digits
+            BOOL isBoundary = idx == 0 || !(TTTIsHashtagCharacter(characters[idx - 1]) || characters[idx - 1] == '&' || characters[idx - 1] == '#');
+            NSUInteger end = idx + 1;
+            BOOL hasNonDigit = NO;
+            while (isBoundary && end < length && TTTIsHashtagCharacter(characters[end])) {
+                hasNonDigit = hasNonDigit || !TTTIsASCIIDigit(characters[end]);
+                end++;
+            }
+
+            if (hasNonDigit) {
+                matchRange = NSMakeRange(idx, end - idx);
+                NSString *tag = [string substringWithRange:NSMakeRange(range.location + idx + 1, end - idx - 1)];
+                NSString *escapedTag = [tag stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet URLPathAllowedCharacterSet]];
+                NSURL *URL = escapedTag ? [NSURL URLWithString:[NSString stringWithFormat:@"%@:%@", _hashtagURLScheme, escapedTag]] : nil;
+                if (URL) {
+                    result = [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(range.location + idx, end - idx) URL:URL];
+                }
+            }
+        } else if (detectsLinks && c == '.') {
+            NSUInteger start = idx;
+            while (start > previousMatchEnd && TTTIsHostCharacter(characters[start - 1])) {
+                start--;
+            }
+
+            // Hosts are not part of an email address, path or longer word
+            BOOL isBoundary = start == 0 || !(TTTIsURLCharacter(characters[start - 1]) && characters[start - 1] != '(' && characters[start - 1] != '\'' && characters[start - 1] != '"');
+            BOOL hasWWWPrefix = idx - start == 3 && (characters[start] | 0x20) == 'w' && (characters[start + 1] | 0x20) == 'w' && (characters[start + 2] | 0x20) == 'w';
+
+            NSUInteger hostEnd = (start < idx && isBoundary) ? TTTHostEnd(characters, start, length, !hasWWWPrefix) : start;
+            if (hostEnd > start && (hostEnd == length || characters[hostEnd] != '@')) {
+                NSUInteger end = hostEnd;
+                if (end < length && (characters[end] == '/' || characters[end] == ':' || characters[end] == '?' || characters[end] == '#')) {
+                    while (end < length && TTTIsURLCharacter(characters[end])) {
+                        end++;
+                    }
+                    end = MAX(TTTURLEndByTrimmingPunctuation(characters, hostEnd, end), hostEnd);
+                }
+
+                matchRange = NSMakeRange(start, end - start);
+                NSURL *URL = [NSURL URLWithString:[@"http://" stringByAppendingString:[string substringWithRange:NSMakeRange(range.location + start, end - start)]]];
+                if (URL) {
+                    result = [NSTextCheckingResult linkCheckingResultWithRange:NSMakeRange(range.location + start, end - start) URL:URL];
+                }
+            }
+        } else if (detectsPhoneNumbers && TTTIsASCIIDigit(c)) {
+            NSUInteger start = idx;
+            if (start > previousMatchEnd && (characters[start - 1] == '+' || characters[start - 1] == '(')) {
+                start--;
+            }
+
+            NSUInteger end = idx;
+            NSUInteger numberOfDigits = 0;
+            NSUInteger numberOfSeparators = 0;
+            unichar lastSeparator = 0;
+            while (end < length) {
+                if (TTTIsASCIIDigit(characters[end])) {
+                    numberOfDigits++;
+                } else if (!TTTIsPhoneSeparator(characters[end]) || end + 1 >= length || !(TTTIsASCIIDigit(characters[end + 1]) || characters[end + 1] == '(' || (characters[end] == ')' && characters[end + 1] == ' '))) {
+                    break;
+                } else {
+                    numberOfSeparators++;
+                    lastSeparator = characters[end];
+                }
+                end++;
+            }
+
+            BOOL isBoundary = (start == 0 || !(TTTIsASCIILetter(characters[start - 1]) || TTTIsASCIIDigit(characters[start - 1]))) && (end == length || !TTTIsASCIILetter(characters[end]));
+            // A single `.` separates the parts of a decimal number rather than a phone number
+            BOOL isDecimalNumber = numberOfSeparators == 1 && lastSeparator == '.';
+            if (isBoundary && !isDecimalNumber && numberOfDigits >= 7 && numberOfDigits <= 15) {
+                matchRange = NSMakeRange(start, end - start);
+                NSRange phoneNumberRange = NSMakeRange(range.location + start, end - start);
+                result = [NSTextCheckingResult phoneNumberCheckingResultWithRange:phoneNumberRange phoneNumber:[string substringWithRange:phoneNumberRange]];
+            } else {
+                // None of the remaining digits in this run can start a phone number either
+                idx = MAX(end, idx + 1);
+                continue;
+            }
+        }
+
+        if (result) {
+            [results addObject:result];
+        }
+
+        if (matchRange.location != NSNotFound) {
+            previousMatchEnd = NSMaxRange(matchRange);
+            idx = MAX(previousMatchEnd, idx + 1);
+        } else {
+            idx++;
+        }
     }
-    
-    return self;
+
+    free(characters);
+
+    return results;
 }
 
 @end
@@ -1793,8 +5199,7 @@ static inline CGColorRef CGColorRefFromColor(id color) {
 }
 
 static inline CTFontRef CTFontRefFromUIFont(UIFont * font) {
-    CTFontRef ctfont = CTFontCreateWithName((__bridge CFStringRef)font.fontName, font.pointSize, NULL);
-    return CFAutorelease(ctfont);
+    return (CTFontRef)CFAutorelease(CFBridgingRetain(TTTFontWithName(font.fontName, font.pointSize)));
 }
 
 static inline NSDictionary * convertNSAttributedStringAttributesToCTAttributes(NSDictionary *attributes) {